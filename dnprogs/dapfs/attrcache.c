@@ -0,0 +1,216 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+
+/* Cache of file attributes, so that 'ls -l' doesn't need a DAP
+   DIRECTORY access for every file it looks at.
+
+   Entries come from getattr and from the attributes FAL sends with a
+   directory listing. Each one lasts for attr_timeout seconds, or
+   negative_timeout if it says the file isn't there. Anything we change
+   ourselves is forgotten straight away, but changes made on the remote
+   system will not be seen until the entry runs out. */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "attrcache.h"
+
+#define HASH_SIZE   1024
+#define MAX_ENTRIES 16384
+
+struct attr_entry
+{
+	struct attr_entry *next;
+	double expires;
+	int missing;
+	struct stat stbuf;
+	char path[1];
+};
+
+static struct attr_entry *hash_table[HASH_SIZE];
+static int num_entries;
+static double attr_ttl = 0.0;
+static double negative_ttl = 0.0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static unsigned int hash(const char *path)
+{
+	unsigned int h = 0;
+
+	while (*path)
+		h = h*31 + (unsigned char)*path++;
+	return h % HASH_SIZE;
+}
+
+/* Call these with the lock held */
+static struct attr_entry **find(const char *path)
+{
+	struct attr_entry **e = &hash_table[hash(path)];
+
+	while (*e && strcmp((*e)->path, path))
+		e = &(*e)->next;
+	return e;
+}
+
+static void remove_entry(struct attr_entry **e)
+{
+	struct attr_entry *old = *e;
+
+	*e = old->next;
+	free(old);
+	num_entries--;
+}
+
+static void remove_expired(double t)
+{
+	int i;
+
+	for (i=0; i<HASH_SIZE; i++)
+	{
+		struct attr_entry **e = &hash_table[i];
+
+		while (*e)
+		{
+			if ((*e)->expires <= t)
+				remove_entry(e);
+			else
+				e = &(*e)->next;
+		}
+	}
+}
+
+static void add(const char *path, const struct stat *stbuf, double ttl)
+{
+	struct attr_entry **e;
+	struct attr_entry *new_entry;
+	double t;
+
+	if (ttl <= 0.0)
+		return;
+
+	t = now();
+	pthread_mutex_lock(&cache_lock);
+
+	e = find(path);
+	if (*e)
+		remove_entry(e);
+
+	if (num_entries >= MAX_ENTRIES)
+		remove_expired(t);
+
+	/* Still full, just do without */
+	if (num_entries >= MAX_ENTRIES)
+		goto out;
+
+	new_entry = malloc(sizeof(struct attr_entry) + strlen(path));
+	if (!new_entry)
+		goto out;
+
+	strcpy(new_entry->path, path);
+	new_entry->expires = t + ttl;
+	new_entry->missing = (stbuf == NULL);
+	if (stbuf)
+		new_entry->stbuf = *stbuf;
+
+	e = &hash_table[hash(path)];
+	new_entry->next = *e;
+	*e = new_entry;
+	num_entries++;
+out:
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void attr_cache_init(double attr_timeout, double negative_timeout)
+{
+	attr_ttl = attr_timeout;
+	negative_ttl = negative_timeout;
+}
+
+int attr_cache_get(const char *path, struct stat *stbuf)
+{
+	struct attr_entry **e;
+	int ret = 1;
+
+	pthread_mutex_lock(&cache_lock);
+	e = find(path);
+	if (*e)
+	{
+		if ((*e)->expires <= now())
+			remove_entry(e);
+		else if ((*e)->missing)
+			ret = -ENOENT;
+		else
+		{
+			*stbuf = (*e)->stbuf;
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return ret;
+}
+
+void attr_cache_put(const char *path, const struct stat *stbuf)
+{
+	add(path, stbuf, attr_ttl);
+}
+
+void attr_cache_put_missing(const char *path)
+{
+	add(path, NULL, negative_ttl);
+}
+
+void attr_cache_forget(const char *path)
+{
+	int len = strlen(path);
+	char parent[len+1];
+	char *slash;
+	int i;
+
+	strcpy(parent, path);
+	slash = strrchr(parent, '/');
+	if (slash)
+		*slash = '\0';
+
+	pthread_mutex_lock(&cache_lock);
+	for (i=0; i<HASH_SIZE; i++)
+	{
+		struct attr_entry **e = &hash_table[i];
+
+		while (*e)
+		{
+			char *p = (*e)->path;
+
+			if (strcmp(p, parent) == 0 ||
+			    (strncmp(p, path, len) == 0 &&
+			     (p[len] == '\0' || p[len] == '/')))
+				remove_entry(e);
+			else
+				e = &(*e)->next;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,26 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+/* attrcache.c */
+/* Timeouts are in seconds, 0 turns that part of the cache off */
+void attr_cache_init(double attr_timeout, double negative_timeout);
+
+/* Returns 0 and fills in stbuf if we know about the file, -ENOENT if we
+   know it isn't there, or 1 if we have to ask */
+int  attr_cache_get(const char *path, struct stat *stbuf);
+void attr_cache_put(const char *path, const struct stat *stbuf);
+void attr_cache_put_missing(const char *path);
+
+/* Forget the file, anything under it and the directory it is in */
+void attr_cache_forget(const char *path);
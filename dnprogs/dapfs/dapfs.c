@@ -30,6 +30,7 @@
 #include <syslog.h>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/statfs.h>
 #include <netdnet/dn.h>
 #include "rms.h"
@@ -37,6 +38,7 @@
 #include "dapfs_dap.h"
 #include "filenames.h"
 #include "kfifo.h"
+#include "attrcache.h"
 
 #define RMS_BUF_SIZE 65536
 
@@ -53,10 +55,16 @@ struct dapfs_handle
 	off_t offset;
 	// Circular buffer of data read from VMS
 	struct kfifo *kf;
+	// FUSE can call us from several threads at once for the same file
+	pthread_mutex_t lock;
 };
 
 static char mountdir[BUFLEN];
 static int blockmode = 0; // Default to record mode
+static double cache_timeout = 5.0;
+static double negative_cache_timeout = 2.0;
+static int connections = 4;
+static char fuse_timeouts[BUFLEN];
 char prefix[BUFLEN];
 int debuglevel = 0;
 
@@ -138,11 +146,15 @@ static int dapfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 static int dapfs_unlink(const char *path)
 {
 	char vername[strlen(path)+3];
+	int res;
+
 	if (debuglevel&1)
 		fprintf(stderr, "dapfs_unlink: %s\n", path);
 
 	sprintf(vername, "%s;*", path);
-	return dap_delete_file(vername);
+	res = dap_delete_file(vername);
+	attr_cache_forget(path);
+	return res;
 }
 
 /* We can't do chown/chmod/utime but don't error as the user gets annoyed */
@@ -168,6 +180,7 @@ static int dapfs_rmdir(const char *path)
 	char vmsname[VMSNAME_LEN];
 	char reply[BUFLEN];
 	int len;
+	int res;
 
 	if (debuglevel&1)
 		fprintf(stderr, "dapfs_rmdir: %s\n", path);
@@ -183,17 +196,28 @@ static int dapfs_rmdir(const char *path)
 	sprintf(fullname, "REMOVE %s.DIR;1", vmsname);
 	len = get_object_info(fullname, reply);
 	if (len == 2) // "OK"
+	{
+		attr_cache_forget(path);
 		return 0;
+	}
 
 	sprintf(dirname, "%s.DIR;1", path);
-	return dap_delete_file(dirname);
+	res = dap_delete_file(dirname);
+	attr_cache_forget(path);
+	return res;
 }
 
 static int dapfs_rename(const char *from, const char *to)
 {
+	int res;
+
 	if (debuglevel&1)
 		fprintf(stderr, "dapfs_rename: from: %s to: %s\n", from, to);
-	return dap_rename_file(from, to);
+
+	res = dap_rename_file(from, to);
+	attr_cache_forget(from);
+	attr_cache_forget(to);
+	return res;
 }
 
 static int dapfs_truncate(const char *path, off_t size)
@@ -228,6 +252,7 @@ static int dapfs_truncate(const char *path, off_t size)
 	res = rms_truncate(rmsh, NULL);
 finish:
 	rms_close(rmsh);
+	attr_cache_forget(path);
 	return res;
 }
 
@@ -269,8 +294,9 @@ static int dapfs_mkdir(const char *path, mode_t mode)
 	len = get_object_info(fullname, reply);
 	if (len != 2) // "OK"
 		return -errno;
-	else
-		return 0;
+
+	attr_cache_forget(path);
+	return 0;
 }
 
 static int dapfs_statfs(const char *path, struct statfs *stbuf)
@@ -321,6 +347,7 @@ static int dapfs_mknod(const char *path, mode_t mode, dev_t dev)
 	if (!rmsh)
 		return -errno;
 	rms_close(rmsh);
+	attr_cache_forget(path);
 	return 0;
 }
 
@@ -340,6 +367,7 @@ static int dapfs_open(const char *path, struct fuse_file_info *fi)
 
 	memset(h, 0, sizeof(*h));
 	memset(&fab, 0, sizeof(struct FAB));
+	pthread_mutex_init(&h->lock, NULL);
 	h->kf = kfifo_alloc(RMS_BUF_SIZE*4);
 
 	make_vms_filespec(path, vmsname, 0);
@@ -364,6 +392,7 @@ static int dapfs_open(const char *path, struct fuse_file_info *fi)
 		if (debuglevel)
 			fprintf(stderr, "rms_open returned NULL, errno=%d (rmserror: %s)\n", errno, rms_openerror());
 
+		pthread_mutex_destroy(&h->lock);
 		free(h);
 
 		if (!saved_errno) // Catch all...TODO
@@ -371,6 +400,10 @@ static int dapfs_open(const char *path, struct fuse_file_info *fi)
 		return -saved_errno;
 	}
 
+	/* It may have just been created or truncated */
+	if (fi->flags & (O_CREAT|O_WRONLY|O_RDWR))
+		attr_cache_forget(path);
+
 	/* Save RMS attributes of the file */
 	h->org = fab.fab$b_org;
 	h->rat = fab.fab$b_rat;
@@ -383,8 +416,8 @@ static int dapfs_open(const char *path, struct fuse_file_info *fi)
 	return 0;
 }
 
-static int dapfs_read(const char *path, char *buf, size_t size, off_t offset,
-		      struct fuse_file_info *fi)
+static int read_file(const char *path, char *buf, size_t size, off_t offset,
+		     struct fuse_file_info *fi)
 {
 	int res;
 	size_t to_copy;
@@ -492,8 +525,8 @@ static int dapfs_read(const char *path, char *buf, size_t size, off_t offset,
 	return res;
 }
 
-static int dapfs_write(const char *path, const char *buf, size_t size,
-		       off_t offset, struct fuse_file_info *fi)
+static int write_file(const char *path, const char *buf, size_t size,
+		      off_t offset, struct fuse_file_info *fi)
 {
 	int res;
 	struct RAB rab;
@@ -529,6 +562,38 @@ static int dapfs_write(const char *path, const char *buf, size_t size,
 	return res;
 }
 
+/* Reads and writes on the same file have to take turns as they share
+   the RMS handle and the read buffer */
+static int dapfs_read(const char *path, char *buf, size_t size, off_t offset,
+		      struct fuse_file_info *fi)
+{
+	struct dapfs_handle *h = (struct dapfs_handle *)fi->fh;
+	int res;
+
+	if (!h)
+		return read_file(path, buf, size, offset, fi);
+
+	pthread_mutex_lock(&h->lock);
+	res = read_file(path, buf, size, offset, fi);
+	pthread_mutex_unlock(&h->lock);
+	return res;
+}
+
+static int dapfs_write(const char *path, const char *buf, size_t size,
+		       off_t offset, struct fuse_file_info *fi)
+{
+	struct dapfs_handle *h = (struct dapfs_handle *)fi->fh;
+	int res;
+
+	if (!h)
+		return write_file(path, buf, size, offset, fi);
+
+	pthread_mutex_lock(&h->lock);
+	res = write_file(path, buf, size, offset, fi);
+	pthread_mutex_unlock(&h->lock);
+	return res;
+}
+
 static int dapfs_release(const char *path, struct fuse_file_info *fi)
 {
 	struct dapfs_handle *h = (struct dapfs_handle *)fi->fh;
@@ -541,7 +606,10 @@ static int dapfs_release(const char *path, struct fuse_file_info *fi)
 		return -EBADF;
 
 	ret = rms_close(h->rmsh);
+	if (fi->flags & (O_WRONLY|O_RDWR))
+		attr_cache_forget(path);
 	kfifo_free(h->kf);
+	pthread_mutex_destroy(&h->lock);
 	free(h);
 	fi->fh = 0L;
 
@@ -562,14 +630,25 @@ static int dapfs_getattr(const char *path, struct stat *stbuf)
 		res = stat("/", stbuf);
 	}
 	else {
-		res = dapfs_getattr_dap(path, stbuf);
+		res = attr_cache_get(path, stbuf);
+		if (res == 1) {
+			res = dapfs_getattr_dap(path, stbuf);
+
+			/* If this failed and there's no file type, see if it is a directory */
+			if (res == -ENOENT && strchr(path, '.')==NULL) {
+				char dirname[BUFLEN];
+				sprintf(dirname, "%s.dir", path);
+				memset(stbuf,0x0, sizeof(*stbuf));
+				res = dapfs_getattr_dap(dirname, stbuf);
+			}
 
-		/* If this failed and there's no file type, see if it is a directory */
-		if (res == -ENOENT && strchr(path, '.')==NULL) {
-			char dirname[BUFLEN];
-			sprintf(dirname, "%s.dir", path);
-			res = dapfs_getattr_dap(dirname, stbuf);
+			if (res == 0)
+				attr_cache_put(path, stbuf);
+			if (res == -ENOENT)
+				attr_cache_put_missing(path);
 		}
+		else if (debuglevel&1)
+			fprintf(stderr, "dapfs_getattr: %s is cached\n", path);
 	}
 	if (debuglevel&1)
 		fprintf(stderr, "dapfs_getattr: returning %d\n", res);
@@ -636,6 +715,20 @@ static int process_options(char *options)
 			blockmode = 0;
 			processed = 1;
 		}
+		if (strncmp("cache_timeout=", optptr, 14) == 0 && option) {
+			cache_timeout = atof(option);
+			sprintf(fuse_timeouts+strlen(fuse_timeouts), ",attr_timeout=%s,entry_timeout=%s", option, option);
+			processed = 1;
+		}
+		if (strncmp("connections=", optptr, 12) == 0 && option) {
+			connections = atoi(option);
+			processed = 1;
+		}
+		if (strncmp("negative_cache_timeout=", optptr, 23) == 0 && option) {
+			negative_cache_timeout = atof(option);
+			sprintf(fuse_timeouts+strlen(fuse_timeouts), ",negative_timeout=%s", option);
+			processed = 1;
+		}
 		t = strtok(NULL, ",");
 	}
 	if (!password)
@@ -688,6 +781,10 @@ static void find_options(int *argc, char *argv[])
 
 int main(int argc, char *argv[])
 {
+	char *fuse_argv[argc+3];
+	int fuse_argc;
+	int i;
+
 	if (argc < 2) {
 		fprintf(stderr, "Usage:\n");
 		fprintf(stderr, "   mount.dapfs <node> <mountpoint> -ousername=<user>,password=<password>\n");
@@ -713,11 +810,23 @@ int main(int argc, char *argv[])
 	if (debuglevel&2 && blockmode)
 		fprintf(stderr, "Sending files in BLOCK mode\n");
 
+	attr_cache_init(cache_timeout, negative_cache_timeout);
+
 	// Make a scratch connection - also verifies the path name nice and early
-	if (dap_init()) {
+	if (dap_init(connections)) {
 		syslog(LOG_ERR, "Cannot connect to '%s'\n", prefix);
 		return -ENOTCONN;
 	}
 
-	return fuse_main(argc-1, argv+1, &dapfs_oper);
+	// Let FUSE keep things for as long as we do
+	fuse_argc = 0;
+	for (i=1; i < argc; i++)
+		fuse_argv[fuse_argc++] = argv[i];
+	if (fuse_timeouts[0]) {
+		fuse_argv[fuse_argc++] = "-o";
+		fuse_argv[fuse_argc++] = fuse_timeouts+1; // Skip the first comma
+	}
+	fuse_argv[fuse_argc] = NULL;
+
+	return fuse_main(fuse_argc, fuse_argv, &dapfs_oper);
 }
@@ -26,6 +26,8 @@
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <poll.h>
 #include <sys/statfs.h>
 #include <sys/select.h>
 #include <sys/socket.h>
@@ -38,10 +40,24 @@
 extern "C" {
 #include "filenames.h"
 #include "dapfs.h"
+#include "attrcache.h"
 }
 
-// CC This isn't going to work!
-static dap_connection conn(debuglevel);
+// Links to FAL for getattr, readdir, delete and rename. Each operation
+// takes one for as long as it needs it so that, for example, a slow
+// directory listing doesn't hold up everything else on the mount. Files
+// that are opened get their own links through librms.
+struct pool_link
+{
+	dap_connection *conn;
+	bool connected;
+	bool busy;
+};
+
+static struct pool_link *pool;
+static int pool_size;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_free = PTHREAD_COND_INITIALIZER;
 
 static int dap_connect(dap_connection &c)
 {
@@ -60,11 +76,80 @@ static int dap_connect(dap_connection &c)
 	return 0;
 }
 
-static void restart_dap()
+// Throw away a link and make a new one next time it's needed
+static void reset_link(struct pool_link *l)
 {
-	syslog(LOG_INFO, "Restarting dapfs connection\n");
-	conn.close();
-	dap_connect(conn);
+	delete l->conn;
+	l->conn = new dap_connection(debuglevel);
+	l->connected = false;
+}
+
+// Nothing should arrive on a link that isn't being used. If something
+// has then the remote end has closed it or we have got out of step.
+static bool link_is_idle(struct pool_link *l)
+{
+	struct pollfd pfd;
+
+	pfd.fd = l->conn->get_fd();
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return !l->conn->have_input() && poll(&pfd, 1, 0) == 0;
+}
+
+static void put_link(struct pool_link *l, bool broken);
+
+// Wait for a free link, connecting it if it isn't already.
+// Returns NULL if we can't get through to the remote end.
+static struct pool_link *get_link()
+{
+	struct pool_link *l = NULL;
+	int i;
+
+	pthread_mutex_lock(&pool_lock);
+	while (!l)
+	{
+		// Rather one that's already up
+		for (i=0; i<pool_size; i++)
+		{
+			if (!pool[i].busy &&
+			    (!l || (pool[i].connected && !l->connected)))
+				l = &pool[i];
+		}
+		if (!l)
+			pthread_cond_wait(&pool_free, &pool_lock);
+	}
+	l->busy = true;
+	pthread_mutex_unlock(&pool_lock);
+
+	if (l->connected && !link_is_idle(l))
+	{
+		syslog(LOG_INFO, "Restarting dapfs connection\n");
+		reset_link(l);
+	}
+
+	if (!l->connected)
+	{
+		if (dap_connect(*l->conn))
+		{
+			put_link(l, true);
+			return NULL;
+		}
+		l->connected = true;
+	}
+	return l;
+}
+
+// Give a link back. If it failed, or was left in a state we don't know,
+// then throw it away and the next user will make a new one.
+static void put_link(struct pool_link *l, bool broken)
+{
+	if (broken)
+		reset_link(l);
+
+	pthread_mutex_lock(&pool_lock);
+	l->busy = false;
+	pthread_cond_signal(&pool_free);
+	pthread_mutex_unlock(&pool_lock);
 }
 
 int get_object_info(char *command, char *reply)
@@ -210,12 +295,16 @@ static void add_to_stat(dap_message *m, struct stat *stbuf)
 int dapfs_getattr_dap(const char *path, struct stat *stbuf)
 {
 	char vmsname[VMSNAME_LEN];
-	char name[80];
 	int ret = 0;
-	int size;
+	struct pool_link *l;
 
 	make_vms_filespec(path, vmsname, 0);
 
+	l = get_link();
+	if (!l)
+		return -ENOTCONN;
+	dap_connection &conn = *l->conn;
+
 	dap_access_message acc;
 	acc.set_accfunc(dap_access_message::DIRECTORY);
 	acc.set_accopt(1);
@@ -224,7 +313,7 @@ int dapfs_getattr_dap(const char *path, struct stat *stbuf)
 			dap_access_message::DISPLAY_DATE_MASK |
 			dap_access_message::DISPLAY_PROT_MASK);
 	if (!acc.write(conn)) {
-		restart_dap();
+		put_link(l, true);
 		return -EIO;
 	}
 
@@ -247,44 +336,71 @@ int dapfs_getattr_dap(const char *path, struct stat *stbuf)
 				dap_contran_message cm;
 				cm.set_confunc(dap_contran_message::SKIP);
 				if (!cm.write(conn)) {
-					restart_dap();
+					put_link(l, true);
 					delete m;
 					return -EIO;
 				}
 			}
 			else
 			{
-				ret = -ENOENT; // TODO better error ??
-
-				// Clean connection status.
-				dap_contran_message cm;
-				cm.set_confunc(dap_contran_message::SKIP);
-				if (!cm.write(conn)) {
-					restart_dap();
-					ret = -EIO;
-				}
+				// Not every FAL wants a SKIP here (ours
+				// drops the link if it gets one) so we
+				// don't know what state the remote end is
+				// in. Start again with a new link.
+				put_link(l, true);
+				delete m;
+				return -ENOENT; // TODO better error ??
 			}
 		}
 		delete m;
 	}
+
+	// Lost the link
+	put_link(l, true);
+	return -EIO;
+
 finished:
+	put_link(l, false);
 	return ret;
 }
 
+// Keep the attributes that came with a directory listing so that the
+// getattr calls that usually follow it don't go back to the remote end.
+// All the versions of a file have the same unix name and VMS lists the
+// newest first, which is the one getattr would find, so only the first
+// of them is kept. 'last' is the name of the previous entry.
+static void cache_dir_entry(const char *dir, const char *name, struct stat *stbuf,
+			    char *last)
+{
+	char fullname[strlen(dir)+strlen(name)+2];
+
+	if (strcmp(name, last) == 0)
+		return;
+	strcpy(last, name);
+
+	if (dir[strlen(dir)-1] == '/')
+		sprintf(fullname, "%s%s", dir, name);
+	else
+		sprintf(fullname, "%s/%s", dir, name);
+	attr_cache_put(fullname, stbuf);
+}
+
 int dapfs_readdir_dap(const char *path, void *buf, fuse_fill_dir_t filler,
 		      off_t offset, struct fuse_file_info *fi)
 {
-	dap_connection c(debuglevel);
+	const char *dirpath = path;
 	char vmsname[VMSNAME_LEN];
-	char wildname[strlen(path)+2];
+	char wildname[strlen(path)+5];
 	char name[80];
+	char last_cached[BUFLEN] = "";
 	struct stat stbuf;
-	int size;
-	int ret;
+	bool broken = false;
+	struct pool_link *l;
 
-	ret = dap_connect(c);
-	if (ret)
-		return ret;
+	l = get_link();
+	if (!l)
+		return -ENOTCONN;
+	dap_connection &c = *l->conn;
 
 	memset(&stbuf, 0, sizeof(stbuf));
 
@@ -309,7 +425,7 @@ int dapfs_readdir_dap(const char *path, void *buf, fuse_fill_dir_t filler,
 			dap_access_message::DISPLAY_DATE_MASK |
 			dap_access_message::DISPLAY_PROT_MASK);
 	if (!acc.write(c)) {
-		c.close();
+		put_link(l, true);
 		return -EIO;
 	}
 
@@ -338,6 +454,7 @@ int dapfs_readdir_dap(const char *path, void *buf, fuse_fill_dir_t filler,
 				}
 
 				/* Tell Fuse */
+				cache_dir_entry(dirpath, unixname, &stbuf, last_cached);
 				filler(buf, unixname, &stbuf, 0);
 
 				/* Prepare for next name */
@@ -382,6 +499,7 @@ int dapfs_readdir_dap(const char *path, void *buf, fuse_fill_dir_t filler,
 			{
 				printf("Error opening %s: %s\n", vmsname, sm->get_message());
 				name_pending = false;
+				broken = true;
 				goto flush;
 			}
 			break;
@@ -395,7 +513,7 @@ int dapfs_readdir_dap(const char *path, void *buf, fuse_fill_dir_t filler,
 finished:
 	// An error:
 	fprintf(stderr, "Error: %s\n", c.get_error());
-	c.close();
+	put_link(l, true);
 	return 2;
 
 flush:
@@ -409,9 +527,10 @@ flush:
 			char *ext = strstr(unixname, ".dir");
 			if (ext) *ext = '\0';
 		}
+		cache_dir_entry(dirpath, unixname, &stbuf, last_cached);
 		filler(buf, unixname, &stbuf, 0);
 	}
-	c.close();
+	put_link(l, broken);
 	return 0;
 }
 
@@ -419,22 +538,26 @@ flush:
 int dap_delete_file(const char *path)
 {
 	char vmsname[VMSNAME_LEN];
-	char name[80];
 	int ret;
-	int size;
+	struct pool_link *l;
 
 	make_vms_filespec(path, vmsname, 0);
 
 	if (vmsname[strlen(vmsname)-1] == '.')
 		vmsname[strlen(vmsname)-1] = '\0';
 
+	l = get_link();
+	if (!l)
+		return -ENOTCONN;
+	dap_connection &conn = *l->conn;
+
 	dap_access_message acc;
 	acc.set_accfunc(dap_access_message::ERASE);
 	acc.set_accopt(1);
 	acc.set_filespec(vmsname);
 	acc.set_display(0);
         if (!acc.write(conn)) {
-		restart_dap();
+		put_link(l, true);
 		return -EIO;
 	}
 
@@ -442,6 +565,10 @@ int dap_delete_file(const char *path)
 	ret = 0;
 	while(1) {
 		dap_message *m = dap_message::read_message(conn, true);
+		if (!m) {
+			put_link(l, true);
+			return -EIO;
+		}
 
 		switch (m->get_type())
 		{
@@ -463,6 +590,7 @@ int dap_delete_file(const char *path)
 	}
 
 	end:
+	put_link(l, false);
 	return ret;
 }
 
@@ -472,8 +600,8 @@ int dap_rename_file(const char *from, const char *to)
 	char vmsto[VMSNAME_LEN];
 	char dirname[BUFLEN];
 	int ret;
-	int size;
 	struct stat stbuf;
+	struct pool_link *l;
 
 	// If it's a directory then add .DIR to the name
 	if ( (ret = dapfs_getattr_dap(from, &stbuf))) {
@@ -509,13 +637,18 @@ int dap_rename_file(const char *from, const char *to)
 			strcat(vmsto, ".DIR");
 	}
 
+	l = get_link();
+	if (!l)
+		return -ENOTCONN;
+	dap_connection &conn = *l->conn;
+
 	dap_access_message acc;
 	acc.set_accfunc(dap_access_message::RENAME);
 	acc.set_accopt(1);
 	acc.set_filespec(vmsfrom);
 	acc.set_display(0);
         if (!acc.write(conn)) {
-		restart_dap();
+		put_link(l, true);
 		return -EIO;
 	}
 
@@ -523,7 +656,7 @@ int dap_rename_file(const char *from, const char *to)
 	nam.set_nametype(dap_name_message::FILESPEC);
 	nam.set_namespec(vmsto);
 	if (!nam.write(conn)) {
-		restart_dap();
+		put_link(l, true);
 		return -EIO;
 	}
 
@@ -531,31 +664,52 @@ int dap_rename_file(const char *from, const char *to)
 	ret = 0;
 	while (1) {
 		dap_message *m = dap_message::read_message(conn, true);
+		if (!m) {
+			put_link(l, true);
+			return -EIO;
+		}
+
 		switch (m->get_type())
 		{
 		case dap_message::ACCOMP:
+			delete m;
 			goto end;
 
 		case dap_message::STATUS:
-		{
-			dap_status_message *sm = (dap_status_message *)m;
 			ret = -EPERM; // Default error!
+			delete m;
 			goto end;
 		}
-		}
+		delete m;
 	}
 	end:
+	put_link(l, false);
 	return ret;
 }
 
 
-int dap_init()
+int dap_init(int connections)
 {
-	struct accessdata_dn accessdata;
-	char node[BUFLEN], filespec[VMSNAME_LEN];
+	struct pool_link *l;
+	int i;
+
+	if (connections < 1)
+		connections = 1;
+
+	pool = new pool_link[connections];
+	pool_size = connections;
+	for (i=0; i<pool_size; i++)
+	{
+		pool[i].conn = new dap_connection(debuglevel);
+		pool[i].connected = false;
+		pool[i].busy = false;
+	}
 
-	if (dap_connect(conn))
+	// Connect the first one now, the rest as they are needed
+	l = get_link();
+	if (!l)
 		return -ENOTCONN;
+	put_link(l, false);
 
 	return 0;
 }
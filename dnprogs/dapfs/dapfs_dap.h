@@ -9,7 +9,7 @@ extern "C" {
 	int dap_delete_file(const char *path);
 	int dap_rename_file(const char *from, const char *to);
 	int get_object_info(char *command, char *reply);
-	int dap_init(void);
+	int dap_init(int connections);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,136 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+// checkpoint.cc
+// Restart checkpoints for dncopy.
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "file.h"
+#include "checkpoint.h"
+
+checkpoint::checkpoint():
+    start_vbn(0),
+    bytes(0),
+    saved_at(0),
+    save_failed(false)
+{
+    name[0] = '\0';
+}
+
+// The checkpoint file is a line of text giving the block number, a line
+// saying what was being copied and then a copy of the block.
+unsigned int checkpoint::load(const char *localname, file *in,
+			      const char *outname)
+{
+    unsigned int vbn = 0;
+    char line[sizeof(copy)+1];
+    char *p;
+
+    snprintf(name, sizeof(name), "%s.dncopy-ckpt", localname);
+    snprintf(copy, sizeof(copy), "%s %llu %ld %s", in->get_printname(),
+	     in->get_size(), (long)in->get_date(), outname);
+
+    // It has to fit on one line
+    for (p = copy; *p; p++)
+	if (*p == '\n') *p = '?';
+
+    FILE *f = fopen(name, "r");
+    if (!f) return 0;
+
+    if (fscanf(f, "dncopy checkpoint %u", &vbn) != 1 ||
+	getc(f) != '\n' ||
+	!fgets(line, sizeof(line), f) ||
+	(p = strchr(line, '\n')) == NULL ||
+	(*p = '\0', strcmp(line, copy)) ||
+	fread(saved, 1, sizeof(saved), f) != sizeof(saved))
+	vbn = 0;
+
+    fclose(f);
+    return vbn;
+}
+
+bool checkpoint::matches(const char *block)
+{
+    return memcmp(block, saved, sizeof(saved)) == 0;
+}
+
+void checkpoint::start(unsigned int vbn)
+{
+    start_vbn = vbn;
+    bytes = saved_at = 0;
+}
+
+int checkpoint::written(file *out, const char *buf, int len)
+{
+    // Keep the last whole block we wrote
+    if (len >= file::BLOCK_SIZE)
+    {
+	memcpy(last, buf + len - file::BLOCK_SIZE, file::BLOCK_SIZE);
+    }
+    else
+    {
+	memmove(last, last + len, file::BLOCK_SIZE - len);
+	memcpy(last + file::BLOCK_SIZE - len, buf, len);
+    }
+    bytes += len;
+
+    // Only at the end of a block, and not too often because of the sync.
+    if (bytes - saved_at < INTERVAL || bytes % file::BLOCK_SIZE)
+	return 0;
+
+    if (out->sync()) return -1;
+    saved_at = bytes;
+    memcpy(saved, last, sizeof(saved));
+
+    // Not being able to save it isn't a reason to stop the copy
+    if (!save() && !save_failed)
+    {
+	fprintf(stderr, "Can't write checkpoint %s: %s\n", name, strerror(errno));
+	save_failed = true;
+    }
+    return 0;
+}
+
+// Write it to a new file and rename that over the old one so there's
+// always a good checkpoint there.
+bool checkpoint::save()
+{
+    char newname[sizeof(name)+4];
+
+    snprintf(newname, sizeof(newname), "%s.new", name);
+
+    FILE *f = fopen(newname, "w");
+    if (!f) return false;
+
+    fprintf(f, "dncopy checkpoint %u\n%s\n",
+	    start_vbn + (unsigned int)(bytes / file::BLOCK_SIZE), copy);
+    fwrite(saved, 1, sizeof(saved), f);
+    if (fflush(f) || fsync(fileno(f)))
+    {
+	fclose(f);
+	unlink(newname);
+	return false;
+    }
+    fclose(f);
+    return rename(newname, name) == 0;
+}
+
+void checkpoint::remove()
+{
+    if (in_use())
+	unlink(name);
+}
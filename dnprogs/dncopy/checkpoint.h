@@ -0,0 +1,54 @@
+// Restart checkpoints for block copies (-R).
+//
+// While a file is being copied in block mode the output is made to put
+// what it has on disk every so often and then the number of the last
+// block that got there, along with a copy of that block, is saved in a
+// small file beside the local end of the copy ("<file>.dncopy-ckpt").
+// The checkpoint also records which copy it belongs to: the input file's
+// name, size and date and the name of the output.
+// If the copy is interrupted then running it again finds the checkpoint,
+// checks it is for the same copy of an unchanged file, reads the block
+// back from the output to make sure it is still what we wrote and
+// carries on from the block after it. The checkpoint is removed when
+// the file has been copied.
+
+class checkpoint
+{
+ public:
+    checkpoint();
+
+    // Look for a checkpoint for a local file and return the block to
+    // carry on after, or 0 to start at the beginning. If the checkpoint
+    // was taken copying anything other than 'in' to 'outname' then it
+    // is ignored.
+    unsigned int load(const char *localname, file *in, const char *outname);
+    bool in_use() { return name[0] != '\0'; }
+
+    // Is this (block 'vbn' of the output as it is now) what was there
+    // when the checkpoint was taken?
+    bool matches(const char *block);
+
+    // The copy is starting after block 'vbn'.
+    void start(unsigned int vbn);
+
+    // Account for data that has been written to 'out' and take a new
+    // checkpoint if it's time. Returns -1 if out->sync() failed.
+    int  written(file *out, const char *buf, int len);
+
+    // The file got there; forget it.
+    void remove();
+
+ private:
+    static const unsigned long long INTERVAL = 1024*1024;
+
+    bool save();
+
+    char name[MAX_PATH+32];
+    char copy[MAX_PATH*2+64];    // What is being copied where
+    unsigned int start_vbn;
+    unsigned long long bytes;    // Written since start_vbn
+    unsigned long long saved_at; // Value of bytes at the last checkpoint
+    bool save_failed;
+    char saved[file::BLOCK_SIZE]; // The last block in the checkpoint
+    char last[file::BLOCK_SIZE];  // The last block written
+};
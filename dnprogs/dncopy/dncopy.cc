@@ -14,6 +14,7 @@
  */
 #include <sys/types.h>
 #include <sys/time.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,19 +28,47 @@
 #include "file.h"
 #include "dnetfile.h"
 #include "unixfile.h"
+#include "pipeline.h"
+#include "checkpoint.h"
 
 static bool  dntype = false;
 static bool  cont_on_error = false;
 
+// Everything needed to copy a file once the options have been parsed
+struct copy_options
+{
+    int   bufsize;
+    int   rfm;
+    int   rat;
+    int   org;
+    int   flags;
+    int   connect_timeout;
+    int   keep_version;
+    int   remove_cr;
+    int   verbose;
+    int   num_buffers;
+    char *protection;
+};
+
+// copy_file() couldn't open the output file
+static const int COPY_NO_OUTPUT = -1;
+
 // Prototypes
 static void usage(char *name, int dntype, FILE *f);
 static file *getFile(const char *name, int verbosity);
+static int copy_file(file *in, file *out, char *buf, pipeline *copier,
+		     struct copy_options &o, const char *name,
+		     unsigned long long &bytes_copied);
+static int copy_parallel(dnetfile *in, const char *inname, const char *outname,
+			 int jobs, struct copy_options &o,
+			 unsigned long long &bytes_copied);
 static void get_env_as_args(char **argv[], int &argc, char *env);
 static void do_options(int argc, char *argv[],
 		       int &rfm, int &rat, int &org,
 		       int &interactive, int &keep_version, int &user_bufsize,
 		       int &remove_cr, int &show_stats, int &verbose,
-		       int &flags, char *protection, int &connect_timeout);
+		       int &flags, char *protection, int &connect_timeout,
+		       int &num_buffers, int &jobs);
 
 // Start here:
 int main(int argc, char *argv[])
@@ -63,6 +92,11 @@ int main(int argc, char *argv[])
     int   printfile = 0;
     int   flags = 0;
     int   connect_timeout = 60;
+    int   num_buffers = 8;
+    int   jobs = 1;
+    int   exit_status = 0;
+    pipeline *copier = NULL;
+    struct copy_options options;
     char  opt;
     char  protection[255]={'\0'};
     struct timeval start_tv;
@@ -88,14 +122,16 @@ int main(int argc, char *argv[])
 	do_options(env_argc, env_argv,
 		   rfm, rat,org,
 		   interactive, keep_version, user_bufsize,
-		   remove_cr, show_stats, verbose, flags, protection, connect_timeout);
+		   remove_cr, show_stats, verbose, flags, protection, connect_timeout,
+		   num_buffers, jobs);
 
 
 // Parse the command-line options
     do_options(argc, argv,
 	       rfm, rat,org,
 	       interactive, keep_version, user_bufsize,
-	       remove_cr, show_stats, verbose, flags, protection, connect_timeout);
+	       remove_cr, show_stats, verbose, flags, protection, connect_timeout,
+	       num_buffers, jobs);
 
     // Work out the buffer size. The default for block transfers is 512
     // bytes unless the user specified otherwise.
@@ -105,6 +141,13 @@ int main(int argc, char *argv[])
       if (org == file::MODE_BLOCK)
 	  bufsize = 512;
 
+    // Restarting in the middle of a file only makes sense for blocks
+    if ((flags & file::FILE_FLAGS_RESTART) && org != file::MODE_BLOCK)
+    {
+	fprintf(stderr, "-R needs block mode (-m block)\n");
+	return 2;
+    }
+
     // If the user wants a block transfer and did not specify
     // a record format then default to FIXed length records
     // with no carriage control.
@@ -155,6 +198,19 @@ int main(int argc, char *argv[])
 	return 2;
     }
 
+    // Unless they asked us not to, read the next records while we are
+    // writing the last ones.
+    if (num_buffers > 0)
+    {
+	copier = new pipeline(num_buffers);
+	if (!copier->init())
+	{
+	    fprintf(stderr, "Cannot allocate transfer buffers\n");
+	    out->close();
+	    return 2;
+	}
+    }
+
     // Set up the network links if necessary
     if (out->setup_link(bufsize, rfm, rat, org, flags, connect_timeout))
     {
@@ -165,6 +221,18 @@ int main(int argc, char *argv[])
     // Reduce the buffer size to the biggest the output host can handle.
     bufsize = out->max_buffersize(bufsize);
 
+    options.bufsize         = bufsize;
+    options.rfm             = rfm;
+    options.rat             = rat;
+    options.org             = org;
+    options.flags           = flags;
+    options.connect_timeout = connect_timeout;
+    options.keep_version    = keep_version;
+    options.remove_cr       = remove_cr;
+    options.verbose         = verbose;
+    options.num_buffers     = num_buffers;
+    options.protection      = protection;
+
     for (filenum = optind; filenum < last_infile; filenum++)
     {
 	    in = getFile(argv[filenum], verbose);
@@ -192,11 +260,23 @@ int main(int argc, char *argv[])
 	if (show_stats)
 	    gettimeofday(&start_tv, NULL);
 
+	// Copy the files in a remote wildcard several at a time if we
+	// were asked to
+	if (jobs > 1 && in->iswildcard() && dnetfile::isMine(argv[filenum]) &&
+	    !interactive && !dntype)
+	{
+	    int status = copy_parallel((dnetfile *)in, argv[filenum],
+				       argv[argc-1], jobs, options,
+				       bytes_copied);
+	    delete in;
+	    if (status)
+		exit_status = status;
+	    continue;
+	}
+
 	// Copy the file(s)
 	do
 	{
-	    int buflen;
-	    int blocks = 0;
 	    int do_copy = !interactive;
 
 
@@ -226,87 +306,17 @@ int main(int argc, char *argv[])
 
 	    if (do_copy)
 	    {
-		// If the output is a directory so we need to add the
-		// input file's basename to it.
-		out->set_protection(protection);
-		if (out->isdirectory())
+		int status = copy_file(in, out, buf, copier, options, NULL,
+				       bytes_copied);
+		if (status == COPY_NO_OUTPUT)
 		{
-		    if (out->open(in->get_basename(keep_version), "w+"))
-		    {
-			out->perror("Error opening file for output");
-			in->close();
-			if (cont_on_error)
-			    continue;
-			else
-			    return 1;
-		    }
-		}
-		else
-		{
-		    if (out->open("w+"))
-		    {
-			out->perror("Error opening file for output");
-			in->close();
+		    if (cont_on_error)
+			continue;
+		    else
 			return 1;
-		    }
-		}
-
-		if (dntype && verbose) printf("\n%s\n\n", in->get_printname());
-
-		// Copy the data
-		while ( ((buflen = in->read(buf, bufsize))) >= 0 )
-		{
-		    // Remove trailing CRs if required
-		    if (remove_cr &&
-			org == file::MODE_RECORD &&
-			buf[buflen-2] == '\r')
-		    {
-			// CR is before the LF in the buffer.
-			buf[buflen-2] = buf[buflen-1];
-			buflen--;
-		    }
-
-		    if (out->write(buf, buflen) < 0)
-		    {
-			out->perror("Error writing");
-			in->close();
-			return 3;
-		    }
-		    blocks++;
-		    bytes_copied += buflen;
 		}
-
-		// If we finished with an error then display it
-		if (!in->eof())
-		{
-		    in->perror("Error reading");
-		    out->close();
-		    return 3;
-		}
-
-		// Set the file protection.
-		if (out->set_umask(in->get_umask()) && !dntype)
-		{
-		    out->perror("Error setting protection");
-		    // Non-fatal error this one.
-		}
-		if (!dntype)
-		{
-		    if (out->close())
-		    {
-			out->perror("Error closing output");
-			return 3;
-		    }
-		}
-
-		// Log the operation if we were asked
-		if (verbose && !dntype)
-		    printf("'%s' copied to '%s', %d %s\n",
-			   in->get_printname(),
-			   out->get_printname(),
-			   blocks,
-			   in->get_format_name());
-
+		if (status)
+		    return status;
 	    }
 	    if (in->close())
 	    {
@@ -333,7 +343,442 @@ int main(int argc, char *argv[])
 	rate = (double)(bytes_copied/1024) / (double)centi_seconds * 100.0;
 	printf("Sent %lld bytes in %1.2f seconds: %4.2fK/s\n",
 	       bytes_copied, show_secs, rate);
+	if (copier)
+	    copier->show_stats();
+    }
+    return exit_status;
+}
+
+// Print an error from a file, with the name of the file in front of it
+// if we were given one.
+static void report(file *f, const char *msg, const char *name)
+{
+    flockfile(stderr);
+    if (name)
+	fprintf(stderr, "%s: ", name);
+    f->perror(msg);
+    funlockfile(stderr);
+}
+
+// Open the output for an input file that has been opened. If the output
+// is a directory then we need to add the input file's basename to it.
+static int open_output(file *in, file *out, struct copy_options &o)
+{
+    if (out->isdirectory())
+	return out->open(in->get_basename(o.keep_version), "w+");
+    else
+	return out->open("w+");
+}
+
+// Copy an input file that has been opened to the output. 'name' is put
+// in front of any error messages. Returns 0, COPY_NO_OUTPUT if the output
+// is a directory and the file couldn't be created in it (in which case
+// the input has been closed), or an exit code.
+static int copy_file(file *in, file *out, char *buf, pipeline *copier,
+		     struct copy_options &o, const char *name,
+		     unsigned long long &bytes_copied)
+{
+    int buflen;
+    int blocks = 0;
+    unsigned int restart_vbn = 0;
+    checkpoint ckpt;
+
+    // For -R keep a checkpoint beside whichever end of the copy is here
+    // and see if there's one left from last time.
+    if (o.flags & file::FILE_FLAGS_RESTART)
+    {
+	const char *local;
+	const char *outname;
+
+	if (out->isdirectory())
+	{
+	    local = out->get_localname(in->get_basename(o.keep_version));
+	    outname = local ? local :
+		out->get_printname(in->get_basename(o.keep_version));
+	}
+	else
+	{
+	    local = out->get_localname(NULL);
+	    outname = local ? local : out->get_printname();
+	}
+	if (!local)
+	    local = in->get_localname(NULL);
+
+	if (local)
+	    restart_vbn = ckpt.load(local, in, outname);
+	if (restart_vbn && out->restart_at(restart_vbn))
+	    restart_vbn = 0;
+    }
+
+    // Let the output reserve the space it needs before we start
+    if (o.flags & file::FILE_FLAGS_FAST)
+	out->set_size(in->get_size());
+
+    out->set_protection(o.protection);
+    if (open_output(in, out, o))
+    {
+	report(out, "Error opening file for output", name);
+	in->close();
+	return out->isdirectory() ? COPY_NO_OUTPUT : 1;
+    }
+
+    // Make sure the output still ends with what we wrote before carrying
+    // on, otherwise copy the whole file again.
+    if (restart_vbn)
+    {
+	char *tail = out->restart_tail();
+
+	if (!tail || !ckpt.matches(tail) || in->restart_at(restart_vbn))
+	{
+	    flockfile(stderr);
+	    if (name)
+		fprintf(stderr, "%s: ", name);
+	    fprintf(stderr, "Output does not match the checkpoint, copying all of it\n");
+	    funlockfile(stderr);
+
+	    restart_vbn = 0;
+	    out->close();
+	    if (open_output(in, out, o))
+	    {
+		report(out, "Error opening file for output", name);
+		in->close();
+		return out->isdirectory() ? COPY_NO_OUTPUT : 1;
+	    }
+	}
+	else if (o.verbose)
+	    printf("Restarting '%s' after block %u\n",
+		   in->get_printname(), restart_vbn);
+    }
+    ckpt.start(restart_vbn);
+
+    if (dntype && o.verbose) printf("\n%s\n\n", in->get_printname());
+
+    // Copy the data
+    if (copier)
+    {
+	switch (copier->copy(in, out, o.bufsize,
+			     o.remove_cr && o.org == file::MODE_RECORD,
+			     ckpt.in_use() ? &ckpt : NULL,
+			     blocks, bytes_copied))
+	{
+	case 1:
+	    report(in, "Error reading", name);
+	    out->close();
+	    return 3;
+
+	case 2:
+	    report(out, "Error writing", name);
+	    in->close();
+	    return 3;
+	}
+    }
+    else while ( ((buflen = in->read(buf, o.bufsize))) >= 0 )
+    {
+	// Remove trailing CRs if required
+	if (o.remove_cr &&
+	    o.org == file::MODE_RECORD &&
+	    buf[buflen-2] == '\r')
+	{
+	    // CR is before the LF in the buffer.
+	    buf[buflen-2] = buf[buflen-1];
+	    buflen--;
+	}
+
+	if (out->write(buf, buflen) < 0 ||
+	    (ckpt.in_use() && ckpt.written(out, buf, buflen)))
+	{
+	    report(out, "Error writing", name);
+	    in->close();
+	    return 3;
+	}
+	blocks++;
+	bytes_copied += buflen;
+    }
+
+    // If we finished with an error then display it
+    if (!copier && !in->eof())
+    {
+	report(in, "Error reading", name);
+	out->close();
+	return 3;
+    }
+
+    // Set the file protection.
+    if (out->set_umask(in->get_umask()) && !dntype)
+    {
+	report(out, "Error setting protection", name);
+	// Non-fatal error this one.
+    }
+    if (!dntype)
+    {
+	if (out->close())
+	{
+	    report(out, "Error closing output", name);
+	    return 3;
+	}
+	ckpt.remove();
+    }
+
+    // Log the operation if we were asked
+    if (o.verbose && !dntype)
+	printf("'%s' copied to '%s', %d %s\n",
+	       in->get_printname(),
+	       out->get_printname(),
+	       blocks,
+	       in->get_format_name());
+    return 0;
+}
+
+// Parallel wildcard copies (-j). The wildcard is expanded once and each
+// worker takes the next name off the list, keeping its own links to the
+// input and output nodes for all of the files it copies.
+// Names that end up in the same output file (several versions of one
+// file without -k) are chained together and copied by one worker in
+// list order, so the result is the same as a serial copy.
+struct copy_job
+{
+    struct copy_options *options;
+    char         prefix[MAX_PATH+1]; // node"user password"::
+    const char  *outname;
+    char       **names;
+    int          num_names;
+    int         *next_same; // Next name with the same output, or -1
+    bool        *chained;   // Copied as part of an earlier name's chain
+    int          next_name;
+    int          failed;
+    unsigned long long bytes_copied;
+    pthread_mutex_t lock;
+};
+
+static void *copy_worker(void *arg)
+{
+    struct copy_job *job = (struct copy_job *)arg;
+    struct copy_options &o = *job->options;
+    dnetfile *in = NULL;
+    file     *out = NULL;
+    pipeline *copier = NULL;
+    char     *buf = NULL;
+    unsigned long long bytes_copied = 0;
+    int       failed = 0;
+
+    if (o.num_buffers > 0)
+    {
+	copier = new pipeline(o.num_buffers);
+	if (!copier->init())
+	{
+	    delete copier;
+	    copier = NULL;
+	}
+    }
+    if (!copier)
+	buf = (char *)malloc(65536);
+
+    for (;;)
+    {
+	int i;
+
+	pthread_mutex_lock(&job->lock);
+	while (job->next_name < job->num_names &&
+	       job->chained[job->next_name])
+	    job->next_name++;
+	i = job->next_name;
+	if (i < job->num_names) job->next_name++;
+	pthread_mutex_unlock(&job->lock);
+	if (i == job->num_names) break;
+
+	for (; i != -1; i = job->next_same[i])
+	{
+	    int status;
+	    char *name = job->names[i];
+
+	    // Make new links for the first file, or if the last one went wrong
+	    if (!out)
+	    {
+		out = getFile(job->outname, o.verbose);
+		if (out->setup_link(o.bufsize, o.rfm, o.rat, o.org, o.flags,
+				    o.connect_timeout))
+		{
+		    report(out, "Error setting up output link", name);
+		    delete out;
+		    out = NULL;
+		    failed++;
+		    continue;
+		}
+	    }
+
+	    if (!in)
+	    {
+		char fullname[MAX_PATH*2+1];
+
+		sprintf(fullname, "%s%s", job->prefix, name);
+		in = new dnetfile(fullname, o.verbose);
+		if (in->setup_link(o.bufsize, o.rfm, o.rat, o.org, o.flags,
+				   o.connect_timeout))
+		{
+		    report(in, "Error setting up input link", name);
+		    delete in;
+		    in = NULL;
+		    failed++;
+		    continue;
+		}
+		status = in->open("r");
+	    }
+	    else
+	    {
+		status = in->reopen(name, "r");
+	    }
+
+	    if (status)
+	    {
+		report(in, "Error opening file for input", name);
+		status = 1;
+	    }
+	    else
+	    {
+		status = copy_file(in, out, buf, copier, o, name, bytes_copied);
+		if (status == 0 && in->close())
+		{
+		    report(in, "Error closing input", name);
+		    status = 3;
+		}
+	    }
+
+	    // Don't trust the links after an error
+	    if (status)
+	    {
+		failed++;
+		delete in;
+		in = NULL;
+		delete out;
+		out = NULL;
+	    }
+	}
     }
+
+    delete in;
+    delete out;
+    delete copier;
+    free(buf);
+
+    pthread_mutex_lock(&job->lock);
+    job->failed += failed;
+    job->bytes_copied += bytes_copied;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// The name a remote file gets when it is copied into a directory, worked
+// out the same way as dnetfile::make_basename()
+static void output_name(const char *name, int keep_version, char *basename)
+{
+    const char *start;
+    char *end;
+
+    start = rindex(name, ']');
+    if (!start) start = rindex(name, ':');
+    if (!start) start = name-1;
+    strcpy(basename, start+1);
+
+    if (!keep_version)
+    {
+	end = rindex(basename, ';');
+	if (end) *end = '\0';
+    }
+
+    for (; *basename; basename++)
+	*basename = tolower(*basename);
+}
+
+// 'in' has been set up but not opened
+static int copy_parallel(dnetfile *in, const char *inname, const char *outname,
+			 int jobs, struct copy_options &o,
+			 unsigned long long &bytes_copied)
+{
+    struct copy_job job;
+    pthread_t *threads;
+    int i;
+
+    job.options      = &o;
+    job.outname      = outname;
+    job.next_name    = 0;
+    job.failed       = 0;
+    job.bytes_copied = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    // Keep the node and access control to put in front of each name
+    strcpy(job.prefix, inname);
+    *(strstr(job.prefix, "::") + 2) = '\0';
+
+    job.num_names = in->list_files(&job.names);
+    if (job.num_names < 0)
+    {
+	in->perror("Error opening file for input");
+	return 1;
+    }
+    if (job.num_names == 0)
+	return 0;
+
+    // Chain together the names that will be written to the same file
+    char (*outnames)[MAX_PATH+1] =
+	(char (*)[MAX_PATH+1])malloc(job.num_names * (MAX_PATH+1));
+    job.next_same = (int *)malloc(job.num_names * sizeof(int));
+    job.chained   = (bool *)calloc(job.num_names, sizeof(bool));
+    for (i=0; i<job.num_names; i++)
+    {
+	output_name(job.names[i], o.keep_version, outnames[i]);
+	job.next_same[i] = -1;
+    }
+    for (i=0; i<job.num_names; i++)
+    {
+	int last = i;
+
+	if (job.chained[i])
+	    continue;
+	for (int j=i+1; j<job.num_names; j++)
+	{
+	    if (!job.chained[j] && strcmp(outnames[i], outnames[j]) == 0)
+	    {
+		job.next_same[last] = j;
+		job.chained[j] = true;
+		last = j;
+	    }
+	}
+    }
+    free(outnames);
+
+    if (jobs > job.num_names) jobs = job.num_names;
+    threads = (pthread_t *)malloc(jobs * sizeof(pthread_t));
+    for (i=0; i<jobs; i++)
+    {
+	if (pthread_create(&threads[i], NULL, copy_worker, &job))
+	{
+	    perror("Can't start copy thread");
+	    break;
+	}
+    }
+
+    // If none of them started then do it here
+    if (i == 0)
+	copy_worker(&job);
+    while (i > 0)
+	pthread_join(threads[--i], NULL);
+
+    free(threads);
+    for (i=0; i<job.num_names; i++)
+	free(job.names[i]);
+    free(job.names);
+    free(job.next_same);
+    free(job.chained);
+    pthread_mutex_destroy(&job.lock);
+
+    bytes_copied += job.bytes_copied;
+    if (job.failed)
+    {
+	fprintf(stderr, "%d of %d files not copied\n", job.failed,
+		job.num_names);
+	return 3;
+    }
+    return 0;
 }
 
 // Print a usage message. We can be called as dncopy or dntype so adapt
@@ -366,6 +811,10 @@ static void usage(char *name, int dntype, FILE *f)
 	fprintf(f, "  -P        (s)print file to SYS$PRINT\n");
 	fprintf(f, "  -D        (s)delete file on close. Only really useful with -P\n");
 	fprintf(f, "  -T <secs>    connect timeout in seconds (default 60)\n");
+	fprintf(f, "  -B <n>       read up to <n> buffers ahead of the write (default 8, 0 = off)\n");
+	fprintf(f, "  -j <n>       copy up to <n> files from a remote wildcard at once\n");
+	fprintf(f, "  -R           keep a checkpoint and restart an interrupted block copy\n");
+	fprintf(f, "  -F           big buffers and preallocation for local files (-FF: O_DIRECT)\n");
         fprintf(f, "  -V           show version number\n");
         fprintf(f, "\n");
         fprintf(f, " (s) - only useful when sending files to VMS\n");
@@ -447,12 +896,13 @@ static void do_options(int argc, char *argv[],
 		       int &rfm, int &rat, int &org,
 		       int &interactive, int &keep_version, int &user_bufsize,
 		       int &remove_cr, int &show_stats, int &verbose,
-		       int &flags, char *protection, int &connect_timeout)
+		       int &flags, char *protection, int &connect_timeout,
+		       int &num_buffers, int &jobs)
 {
     int opt;
     opterr = 0;
     optind = 0;
-    while ((opt=getopt(argc,argv,"?Vvhdr:a:b:kislm:p:PDET:")) != EOF)
+    while ((opt=getopt(argc,argv,"?Vvhdr:a:b:kislm:p:PDRFET:B:j:")) != EOF)
     {
 	switch(opt) {
 	case 'h':
@@ -537,10 +987,29 @@ static void do_options(int argc, char *argv[],
 	    flags |= file::FILE_FLAGS_DELETE;
 	    break;
 
+	case 'R':
+	    flags |= file::FILE_FLAGS_RESTART;
+	    break;
+
+	case 'F':
+	    // Twice for O_DIRECT
+	    if (flags & file::FILE_FLAGS_FAST)
+		flags |= file::FILE_FLAGS_DIRECT;
+	    flags |= file::FILE_FLAGS_FAST;
+	    break;
+
 	case 'b':
 	    user_bufsize = atoi(optarg);
 	    break;
 
+	case 'B':
+	    num_buffers = atoi(optarg);
+	    break;
+
+	case 'j':
+	    jobs = atoi(optarg);
+	    break;
+
 	case 'p':
 	    strcpy(protection, optarg);
 	    strcpy(protection, optarg);
@@ -46,6 +46,11 @@ dnetfile::dnetfile(const char *n, int verbosity):
     verbose = verbosity;
     lasterror = NULL;
     protection = NULL;
+    restart_vbn = 0;
+    get_pending = FALSE;
+    have_tail = FALSE;
+    file_size = size_hint = 0;
+    file_date = 0;
     strcpy(fname, n);
     strcpy(name, n);
 
@@ -156,10 +161,7 @@ int dnetfile::open(const char *mode)
 		status = dap_send_name();
 		if (status) return status;
 	    }
-	    status = dap_send_access();
-	    if (status) return status;
-
-	    status = dap_get_file_entry(&real_rfm, &real_rat);
+	    status = dap_open_output(&real_rfm, &real_rat);
 	    if (status) return status;
 	}
 	else
@@ -189,27 +191,79 @@ int dnetfile::open(const char *mode)
     else if (writing) // new file to create on already open link
     {
         dap_send_attributes();
-        dap_send_access();
-	status = dap_get_file_entry(&real_rfm, &real_rat);
+	status = dap_open_output(&real_rfm, &real_rat);
     	if (status) return status;
     }
     status = dap_send_connect();
     if (status) return status;
 
+    // If we might be restarting a copy then the caller may yet want to
+    // start part way through the file.
+    if (!writing && (user_flags & FILE_FLAGS_RESTART))
+    {
+	get_pending = TRUE;
+	return 0;
+    }
+
+    // Or we are restarting one, so see what got there last time
+    have_tail = FALSE;
+    if (writing && restart_vbn)
+    {
+	status = dap_get_tail();
+	if (status) return status;
+	if (!have_tail) restart_vbn = 0;
+    }
+
     status = dap_send_get_or_put();
     return status;
 }
 
+// Open a different file on a link that has finished with the last one
+// (or not been used yet). The filespec does not include the node name.
+int dnetfile::reopen(const char *filespec, const char *mode)
+{
+    // Take the remote end's reply to the last close
+    if (isOpen && !writing && dap_get_accomp())
+	return -1;
+
+    strcpy(name, filespec);
+    strcpy(filname, filespec);
+    wildcard = FALSE;
+    isOpen = FALSE;
+    lasterror = NULL;
+    return open(mode);
+}
+
+// Get the full names of all the files that match our wildcard. Returns
+// the number of names, each malloced, or -1.
+int dnetfile::list_files(char ***names)
+{
+    if (dap_send_directory()) return -1;
+    return dap_get_directory(names);
+}
+
 // Close the file but leave the link open in case there are any more to
 // read/write
 int dnetfile::close()
 {
+    // Never asked for the data, there's nothing to stop
+    get_pending = FALSE;
     return dap_send_accomp();
 }
 
 // Read a block or a record
 int dnetfile::read(char *buf, int len)
 {
+    if (get_pending)
+    {
+	get_pending = FALSE;
+	if (dap_send_get_or_put())
+	{
+	    lasterror = conn.get_error();
+	    return -1;
+	}
+    }
+
     int retlen = dap_get_record(buf, len);
     if (retlen < 0) return retlen; // Empty record.
 
@@ -263,6 +317,47 @@ int dnetfile::write(char *buf, int len)
     return dap_put_record(buf, len);
 }
 
+// Carry on after block 'vbn'. For a file being read this must be called
+// after open() and before the first read(); for a file being written, before
+// open().
+int dnetfile::restart_at(unsigned int vbn)
+{
+    if (isOpen && !writing && !get_pending)
+    {
+	lasterror = "file is already being read";
+	return -1;
+    }
+    restart_vbn = vbn;
+    return 0;
+}
+
+char *dnetfile::restart_tail()
+{
+    return have_tail ? tail : NULL;
+}
+
+// Ask the remote end to put what we have sent so far on disk
+int dnetfile::sync()
+{
+    return dap_send_flush();
+}
+
+unsigned long long dnetfile::get_size()
+{
+    return file_size;
+}
+
+time_t dnetfile::get_date()
+{
+    return file_date;
+}
+
+// Tell the remote end how big a file we are about to create
+void dnetfile::set_size(unsigned long long size)
+{
+    size_hint = size;
+}
+
 /* Get the next filename in a wildcard list */
 int dnetfile::next()
 {
@@ -365,7 +460,7 @@ void dnetfile::make_basename(int keep_version)
 // logging
 char *dnetfile::get_printname(char *filename)
 {
-    static char pname[1024];
+    char *pname = printname;
 
     strcpy(pname, node);
     if (*user)
@@ -31,6 +31,16 @@ public:
     virtual bool  iswildcard();
     virtual int   max_buffersize(int biggest);
     virtual void  set_protection(char *prot);
+    virtual int   restart_at(unsigned int vbn);
+    virtual char *restart_tail();
+    virtual int   sync();
+    virtual unsigned long long get_size();
+    virtual time_t get_date();
+    virtual void  set_size(unsigned long long size);
+
+// For parallel wildcard copies
+    int   list_files(char ***names);
+    int   reopen(const char *filespec, const char *mode);
 
  private:
 /* Parameters */
@@ -70,9 +80,21 @@ public:
     unsigned int prot;
     char *protection; /* VMS style protection string from cmdline */
 
+/* Restarting a block copy */
+    unsigned int restart_vbn; // Block to carry on after
+    bool  get_pending;        // Haven't sent the $GET yet
+    bool  have_tail;
+    char  tail[BLOCK_SIZE];   // Block restart_vbn of the output
+
+/* Size of the remote file, or what we expect to send */
+    unsigned long long file_size;
+    unsigned long long size_hint;
+    time_t file_date; // Revision date, only asked for by -R
+
     char  filname[80];
     char  volname[80];
     char  dirname[80];
+    char  printname[1024];
 
 /* Filename handling */
     void make_basename(int keep_version);
@@ -92,6 +114,12 @@ public:
     int   dap_get_status();
     int   dap_check_status(dap_message *m, int status);
     int   dap_send_skip();
+    int   dap_get_accomp();
+    int   dap_get_tail();
+    int   dap_open_output(int *rfm, int *rat);
+    int   dap_send_flush();
+    int   dap_send_directory();
+    int   dap_get_directory(char ***names);
     char *dap_error(int code);
 
 };
@@ -83,6 +83,16 @@ int dnetfile::dap_send_access()
 	acc.set_accfunc(dap_access_message::CREATE);
 	acc.set_fac(dap_access_message::FB$PUT);
 	acc.set_shr(1<<dap_access_message::FB$BRO);
+
+	// Restarting: open the file that is there so we can read back the
+	// last block we wrote and then write after it.
+	if (restart_vbn)
+	{
+	    acc.set_accfunc(dap_access_message::OPEN);
+	    acc.set_fac((1<<dap_access_message::FB$PUT) |
+			(1<<dap_access_message::FB$GET) |
+			(1<<dap_access_message::FB$BIO));
+	}
     }
     else // We build our own attributes message when writing.
     {
@@ -102,9 +112,12 @@ int dnetfile::dap_send_access()
 
 	att.write(conn);
     }
+    // -R needs to know if the file has changed since the checkpoint
     acc.set_display(dap_access_message::DISPLAY_MAIN_MASK |
 		    dap_access_message::DISPLAY_PROT_MASK |
-		    dap_access_message::DISPLAY_NAME_MASK);
+		    dap_access_message::DISPLAY_NAME_MASK |
+		    ((user_flags & FILE_FLAGS_RESTART) && !writing ?
+		     dap_access_message::DISPLAY_DATE_MASK : 0));
     acc.set_filespec(filname);
     acc.write(conn);
     return !conn.set_blocked(false);
@@ -120,6 +133,8 @@ int dnetfile::dap_get_file_entry(int *rfm, int *rat)
 
     strcpy(sentname, filname); // Save in case of error
     dirname[0] = volname[0] = filname[0] = '\0';
+    file_size = 0;
+    file_date = 0;
 
     dap_message *m;
     while ( ((m = dap_message::read_message(conn, true))) )
@@ -159,6 +174,11 @@ int dnetfile::dap_get_file_entry(int *rfm, int *rat)
 		*rfm = am->get_rfm();
 		*rat = am->get_rat();
 		file_fsz = am->get_fsz();
+
+		// Not everyone sends EBK, but the allocation will do
+		file_size = am->get_size();
+		if (!file_size && am->get_menu_bit(dap_attrib_message::MENU_ALQ))
+		    file_size = (unsigned long long)am->get_alq() * 512;
 	    }
 	    break;
 	case dap_message::PROTECT:
@@ -168,6 +188,16 @@ int dnetfile::dap_get_file_entry(int *rfm, int *rat)
 	    }
 	    break;
 
+	case dap_message::DATE:
+	    {
+		dap_date_message *dm =(dap_date_message *)m;
+		if (*dm->get_rdt())
+		    file_date = dm->get_rdt_time();
+		else if (*dm->get_cdt())
+		    file_date = dm->get_cdt_time();
+	    }
+	    break;
+
 	case dap_message::ACK:
 	    return 0;
 
@@ -208,6 +238,16 @@ int dnetfile::dap_send_connect()
 
 }
 /*-------------------------------------------------------------------------*/
+// A VBN as a CONTROL message key: four bytes, low byte first
+static int vbn_key(unsigned int vbn, char *key)
+{
+    key[0] = vbn & 0xFF;
+    key[1] = (vbn >> 8) & 0xFF;
+    key[2] = (vbn >> 16) & 0xFF;
+    key[3] = (vbn >> 24) & 0xFF;
+    return 4;
+}
+
 // Sends a CONTROL message with $GET or $PUT as the action
 // Also enables block mode for reading files with -mblock requested.
 // Note we don't really write files in block mode only read them.
@@ -234,8 +274,112 @@ int dnetfile::dap_send_get_or_put()
     {
     	ctl.set_rop_bit(dap_control_message::RB$RRL);
     }
+
+    // Start at the block after the one we are restarting from
+    if (restart_vbn)
+    {
+	char key[4];
+
+	if (verbose > 2) DAPLOG((LOG_INFO, "starting at VBN %u\n", restart_vbn+1));
+	ctl.set_rac(dap_control_message::BLOCKFT);
+	ctl.set_key(key, vbn_key(restart_vbn + 1, key));
+	restart_vbn = 0;
+    }
     return !ctl.write(conn);
 }
+
+// Send the ACCESS for a file we are going to write. If we were asked to
+// carry on writing one that can't be opened then create it instead.
+int dnetfile::dap_open_output(int *rfm, int *rat)
+{
+    char spec[sizeof(filname)];
+
+    strcpy(spec, filname);
+    int status = dap_send_access();
+    if (status) return status;
+
+    status = dap_get_file_entry(rfm, rat);
+    if (status && restart_vbn)
+    {
+	if (verbose > 1) DAPLOG((LOG_INFO, "can't reopen %s, creating it\n", spec));
+	strcpy(filname, spec);
+	restart_vbn = 0;
+	lasterror = NULL;
+	dap_send_attributes();
+	if (wildcard && dap_send_name()) return -1;
+	status = dap_send_access();
+	if (status) return status;
+	status = dap_get_file_entry(rfm, rat);
+    }
+    return status;
+}
+
+// Read block restart_vbn of a file we are about to carry on writing.
+// It is fine for it not to be there, have_tail says whether it was.
+int dnetfile::dap_get_tail()
+{
+    if (verbose > 2) DAPLOG((LOG_INFO, "in dap_get_tail(%u)\n", restart_vbn));
+
+    char key[4];
+
+    dap_control_message ctl;
+    ctl.set_ctlfunc(dap_control_message::GET);
+    ctl.set_rac(dap_control_message::BLOCK);
+    ctl.set_key(key, vbn_key(restart_vbn, key));
+    if (!ctl.write(conn))
+    {
+	lasterror = conn.get_error();
+	return -1;
+    }
+
+    dap_message *m;
+    while ( ((m = dap_message::read_message(conn, true))) )
+    {
+	if (m->get_type() == dap_message::DATA)
+	{
+	    dap_data_message *dm = (dap_data_message *)m;
+	    if (dm->get_datalen() >= BLOCK_SIZE)
+	    {
+		memcpy(tail, dm->get_dataptr(), BLOCK_SIZE);
+		have_tail = TRUE;
+	    }
+	    delete m;
+	    continue;
+	}
+	if (m->get_type() == dap_message::STATUS)
+	{
+	    dap_status_message *sm = (dap_status_message *)m;
+
+	    // Not that many blocks
+	    if ((sm->get_code() & 0xFF) == 047)
+	    {
+		have_tail = FALSE;
+		delete m;
+		return 0;
+	    }
+	    return dap_check_status(m, 0);
+	}
+	delete m;
+    }
+    lasterror = conn.get_error();
+    return -1;
+}
+
+// Send a $FLUSH in the middle of a $PUT. There's no reply unless it fails
+// and dap_put_record() picks that up.
+int dnetfile::dap_send_flush()
+{
+    if (verbose > 2) DAPLOG((LOG_INFO, "in dap_send_flush()\n"));
+
+    dap_control_message ctl;
+    ctl.set_ctlfunc(dap_control_message::FLUSH);
+    if (!ctl.write(conn) || !conn.set_blocked(false))
+    {
+	lasterror = conn.get_error();
+	return -1;
+    }
+    return 0;
+}
 /*-------------------------------------------------------------------------*/
 
 // Send Access Complete.
@@ -337,6 +481,10 @@ int dnetfile::dap_send_attributes()
     att.set_bls(512);
     att.set_mrs(user_bufsize);
 
+// Ask for all the space we will need up front
+    if (size_hint)
+	att.set_alq((size_hint + 511) / 512);
+
 // CR attributes on all but BLOCK mode sends
     if (transfer_mode != MODE_BLOCK)
     {
@@ -390,6 +538,129 @@ int dnetfile::dap_send_skip()
     return !ct.write(conn);
 }
 
+// Wait for the ACCOMP that answers a close
+int dnetfile::dap_get_accomp()
+{
+    if (verbose > 2) DAPLOG((LOG_INFO, "in dap_get_accomp()\n"));
+
+    dap_message *m;
+    while ( ((m = dap_message::read_message(conn, true))) )
+    {
+	int type = m->get_type();
+
+	// Anything still left over from the file
+	if (type == dap_message::STATUS)
+	{
+	    dap_status_message *sm = (dap_status_message *)m;
+	    if ((sm->get_code() & 0xFF) == 047)
+		delete m;
+	    else if (dap_check_status(m, 0))
+		return -1;
+	    continue;
+	}
+	delete m;
+	if (type == dap_message::ACCOMP)
+	    return 0;
+    }
+    lasterror = conn.get_error();
+    return -1;
+}
+
+// Ask for a directory listing of the wildcard
+int dnetfile::dap_send_directory()
+{
+    if (verbose > 2) DAPLOG((LOG_INFO, "in dap_send_directory(%s)\n", name));
+
+    dap_access_message acc;
+    acc.set_accfunc(dap_access_message::DIRECTORY);
+    acc.set_accopt(1);
+    acc.set_filespec(name);
+    acc.set_display(dap_access_message::DISPLAY_MAIN_MASK);
+    if (!acc.write(conn))
+    {
+	lasterror = conn.get_error();
+	return -1;
+    }
+    return 0;
+}
+
+// Read the directory listing. Files that are locked are left out just as
+// they are when copying the wildcard directly.
+int dnetfile::dap_get_directory(char ***names)
+{
+    int    num_names = 0;
+    int    max_names = 0;
+    char **list = NULL;
+    char   filename[80] = "";
+
+    volname[0] = dirname[0] = '\0';
+
+    dap_message *m;
+    while ( ((m = dap_message::read_message(conn, true))) )
+    {
+	switch (m->get_type())
+	{
+	case dap_message::NAME:
+	    {
+		dap_name_message *nm = (dap_name_message *)m;
+		switch (nm->get_nametype())
+		{
+		case dap_name_message::VOLUME:
+		    strcpy(volname, nm->get_namespec());
+		    break;
+
+		case dap_name_message::DIRECTORY:
+		    strcpy(dirname, nm->get_namespec());
+		    break;
+
+		case dap_name_message::FILENAME:
+		    strcpy(filename, nm->get_namespec());
+		    break;
+		}
+	    }
+	    break;
+
+	case dap_message::ACK: // End of a file's details
+	    if (filename[0])
+	    {
+		if (num_names == max_names)
+		{
+		    max_names = max_names ? max_names*2 : 64;
+		    list = (char **)realloc(list, max_names * sizeof(char *));
+		}
+		list[num_names] = (char *)malloc(strlen(volname) + strlen(dirname) +
+						 strlen(filename) + 1);
+		sprintf(list[num_names++], "%s%s%s", volname, dirname, filename);
+		filename[0] = '\0';
+	    }
+	    break;
+
+	case dap_message::ACCOMP: // End of the list
+	    delete m;
+	    *names = list;
+	    return num_names;
+
+	case dap_message::STATUS:
+	    {
+		dap_status_message *sm = (dap_status_message *)m;
+		if (sm->get_code() == 0x4030) // Locked
+		{
+		    filename[0] = '\0';
+		    dap_send_skip();
+		    break;
+		}
+		for (int i=0; i<num_names; i++)
+		    free(list[i]);
+		free(list);
+		return dap_check_status(m, -1);
+	    }
+	}
+	delete m;
+    }
+    lasterror = conn.get_error();
+    return -1;
+}
+
 // Check a STATUS message. code 0225 is Success and 047 is EOF so we return a
 // correct status code for those cases.
 int dnetfile::dap_check_status(dap_message *m, int status)
@@ -2,6 +2,8 @@
 #ifndef _CC_FILE_H
 #define _CC_FILE_H
 
+#include <sys/types.h>
+
 #ifndef TRUE
 #define TRUE  1
 #define FALSE 0
@@ -37,6 +39,27 @@ class file
     virtual int   max_buffersize(int biggest) = 0;
     virtual void  set_protection(char *vmsprot) {};
 
+// Restartable block copies (-R). restart_at() says to carry on after
+// block 'vbn': an input file that is open starts reading at the next
+// block, an output file opened after this keeps its first vbn blocks and
+// restart_tail() then returns block vbn as it is now (NULL if it isn't
+// there) so the caller can check it is what was written last time.
+    virtual int   restart_at(unsigned int vbn) { return -1; };
+    virtual char *restart_tail() { return 0; };
+    virtual int   sync() { return 0; };
+
+// How big the file is, or is going to be, in bytes (0 if we don't know)
+// so that the other end can make room for it.
+    virtual unsigned long long get_size() { return 0; };
+    virtual void  set_size(unsigned long long size) {};
+
+// When the file was last changed (0 if we don't know)
+    virtual time_t get_date() { return 0; };
+
+// The name of the file on this system (of 'basename' in it if it is a
+// directory) or NULL if it is somewhere else.
+    virtual const char *get_localname(const char *basename) { return 0; };
+
 // Some constants
 
     static const int MODE_DEFAULT = -1;
@@ -62,6 +85,11 @@ class file
     static const int FILE_FLAGS_RRL = 1;
     static const int FILE_FLAGS_SPOOL = 2;
     static const int FILE_FLAGS_DELETE = 4;
+    static const int FILE_FLAGS_RESTART = 8;
+    static const int FILE_FLAGS_FAST = 16;   // Big aligned local I/O
+    static const int FILE_FLAGS_DIRECT = 32; // ...and O_DIRECT
+
+    static const int BLOCK_SIZE = 512; // Size of a VBN
 
  private:
     // Disable copy constructor
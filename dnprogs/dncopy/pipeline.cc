@@ -0,0 +1,262 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+// pipeline.cc
+// Reader thread and ring of buffers for dncopy.
+#include <sys/types.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "file.h"
+#include "checkpoint.h"
+#include "pipeline.h"
+
+pipeline::pipeline(int n):
+    num_buffers(n),
+    buffers(NULL),
+    lengths(NULL),
+    in(NULL)
+{
+    memset(&read_stats, 0, sizeof(read_stats));
+    memset(&write_stats, 0, sizeof(write_stats));
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&not_empty, NULL);
+    pthread_cond_init(&not_full, NULL);
+}
+
+pipeline::~pipeline()
+{
+    if (buffers)
+    {
+	for (int i=0; i<num_buffers; i++)
+	    free(buffers[i]);
+	free(buffers);
+    }
+    free(lengths);
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&not_empty);
+    pthread_cond_destroy(&not_full);
+}
+
+bool pipeline::init()
+{
+    buffers = (char **)calloc(num_buffers, sizeof(char *));
+    lengths = (int *)calloc(num_buffers, sizeof(int));
+    if (!buffers || !lengths) return false;
+
+    for (int i=0; i<num_buffers; i++)
+    {
+	buffers[i] = (char *)malloc(BUFFER_SIZE);
+	if (!buffers[i]) return false;
+    }
+    return true;
+}
+
+double pipeline::now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+void *pipeline::reader_start(void *p)
+{
+    ((pipeline *)p)->reader();
+    return NULL;
+}
+
+// The reader thread. It only touches a buffer before it has been handed
+// to the writer, or after the writer has finished with it, so the data
+// itself doesn't need locking.
+void pipeline::reader()
+{
+    int used = 0;   // In buffers[tail]
+
+    for (;;)
+    {
+	// Need a new buffer
+	if (used == 0)
+	{
+	    double start = now();
+
+	    pthread_mutex_lock(&lock);
+	    while (count == num_buffers && !stop)
+		pthread_cond_wait(&not_full, &lock);
+	    bool stopped = stop;
+	    pthread_mutex_unlock(&lock);
+	    if (stopped) break;
+
+	    read_stats.waiting += now() - start;
+	}
+
+	double start = now();
+	char *rec = buffers[tail] + used;
+	int len = in->read(rec + sizeof(int), read_size);
+	read_stats.busy += now() - start;
+
+	if (len < 0)
+	{
+	    // errno belongs to this thread, keep it for in->perror()
+	    read_errno = errno;
+	    read_ok = in->eof();
+	    break;
+	}
+	memcpy(rec, &len, sizeof(int));
+	used += sizeof(int) + len;
+	read_stats.bytes += len;
+
+	// Pass it on if there's no room for another or the writer would
+	// otherwise be sitting there doing nothing (but not a record at a
+	// time). dnetfile::read() can add a byte or two to a record so
+	// leave some slack.
+	pthread_mutex_lock(&lock);
+	if (BUFFER_SIZE - used < MAX_RECORD + 16 ||
+	    (writer_idle && used >= MIN_HANDOFF))
+	{
+	    lengths[tail] = used;
+	    tail = (tail + 1) % num_buffers;
+	    count++;
+	    used = 0;
+	    pthread_cond_signal(&not_empty);
+	}
+	pthread_mutex_unlock(&lock);
+    }
+
+    pthread_mutex_lock(&lock);
+    if (used)
+    {
+	lengths[tail] = used;
+	tail = (tail + 1) % num_buffers;
+	count++;
+    }
+    finished = true;
+    pthread_cond_signal(&not_empty);
+    pthread_mutex_unlock(&lock);
+}
+
+int pipeline::copy(file *infile, file *out, int bufsize, bool remove_cr,
+		   checkpoint *ckpt, int &blocks, unsigned long long &bytes)
+{
+    pthread_t thread;
+    int status = 0;
+    int write_errno = 0;
+
+    in = infile;
+    read_size = bufsize;
+    if (read_size > MAX_RECORD) read_size = MAX_RECORD;
+    head = tail = count = 0;
+    finished = stop = read_ok = writer_idle = false;
+    read_errno = 0;
+
+    if (pthread_create(&thread, NULL, reader_start, this))
+    {
+	perror("Can't start reader thread");
+	return 1;
+    }
+
+    while (status == 0)
+    {
+	double start = now();
+
+	pthread_mutex_lock(&lock);
+	writer_idle = true;
+	while (count == 0 && !finished)
+	    pthread_cond_wait(&not_empty, &lock);
+	writer_idle = false;
+	bool empty = (count == 0);
+	pthread_mutex_unlock(&lock);
+	if (empty) break; // Reader has finished and we have it all
+
+	write_stats.waiting += now() - start;
+
+	char *ptr = buffers[head];
+	char *end = ptr + lengths[head];
+
+	start = now();
+	while (ptr < end)
+	{
+	    int buflen;
+	    char *buf = ptr + sizeof(int);
+
+	    memcpy(&buflen, ptr, sizeof(int));
+	    ptr += sizeof(int) + buflen;
+
+	    // Remove trailing CRs if required
+	    if (remove_cr && buflen > 1 && buf[buflen-2] == '\r')
+	    {
+		// CR is before the LF in the buffer.
+		buf[buflen-2] = buf[buflen-1];
+		buflen--;
+	    }
+
+	    if (out->write(buf, buflen) < 0 ||
+		(ckpt && ckpt->written(out, buf, buflen)))
+	    {
+		write_errno = errno;
+		status = 2;
+		break;
+	    }
+	    write_stats.bytes += buflen;
+	    blocks++;
+	    bytes += buflen;
+	}
+	write_stats.busy += now() - start;
+
+	pthread_mutex_lock(&lock);
+	head = (head + 1) % num_buffers;
+	count--;
+	pthread_cond_signal(&not_full);
+	pthread_mutex_unlock(&lock);
+    }
+
+    // Tell the reader to give up if we didn't get to the end
+    pthread_mutex_lock(&lock);
+    stop = true;
+    pthread_cond_signal(&not_full);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    if (status == 0 && !read_ok)
+    {
+	errno = read_errno;
+	status = 1;
+    }
+    if (status == 2)
+	errno = write_errno;
+    return status;
+}
+
+void pipeline::show_stage(const char *name, stage_stats &s)
+{
+    double rate = 0.0;
+
+    if (s.busy > 0.0)
+	rate = (double)(s.bytes/1024) / s.busy;
+    printf("%s: %lld bytes in %1.2f seconds: %4.2fK/s, waited %1.2f seconds\n",
+	   name, s.bytes, s.busy, rate, s.waiting);
+}
+
+// Say how fast each side went while it was working. The slower one
+// is the one doing less waiting.
+void pipeline::show_stats()
+{
+    show_stage("Read ", read_stats);
+    show_stage("Write", write_stats);
+}
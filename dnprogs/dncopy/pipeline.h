@@ -0,0 +1,74 @@
+// Overlapped copy between two files.
+//
+// A reader thread reads records (or blocks) from the input file into a
+// ring of buffers while the calling thread writes them out of the other
+// end, so a network receive and a disk write (or a disk read and a
+// network send) go on at the same time. The ring is bounded so a fast
+// reader can't get more than a few buffers ahead of a slow writer.
+//
+// Each buffer holds as many records as will fit. It is handed to the
+// writer when it is full, or sooner if the writer has nothing to do,
+// so that small records don't mean a thread switch each.
+//
+// The time each side spends working and waiting for the other is kept
+// so that -s can say which end is holding things up.
+
+class checkpoint;
+
+class pipeline
+{
+ public:
+    pipeline(int num_buffers);
+    ~pipeline();
+
+    bool init();
+
+    // Copy the whole of 'in' to 'out'. Returns 0 if it all went, 1 if
+    // reading failed or 2 if writing failed; in->perror() or out->perror()
+    // will then say why. If there is a checkpoint it is told about
+    // everything that is written.
+    int  copy(file *in, file *out, int bufsize, bool remove_cr,
+	      checkpoint *ckpt, int &blocks, unsigned long long &bytes);
+
+    void show_stats();
+
+ private:
+    // Always allow for the largest record the remote end can stream
+    // to us, whatever size we asked for.
+    static const int MAX_RECORD  = 65536;
+    static const int BUFFER_SIZE = 4*MAX_RECORD;
+    static const int MIN_HANDOFF = 16384;
+
+    struct stage_stats
+    {
+	unsigned long long bytes;
+	double busy;     // Seconds in read() or write()
+	double waiting;  // Seconds waiting for the other side
+    };
+
+    static void *reader_start(void *);
+    void reader();
+    static double now();
+    static void show_stage(const char *name, stage_stats &s);
+
+    int    num_buffers;
+    char **buffers;  // Records, each an int length then the data
+    int   *lengths;  // Bytes used in each buffer
+    int    head;     // Next one for the writer
+    int    tail;     // Next one for the reader
+    int    count;    // Number handed to the writer
+    bool   finished; // Reader has stopped
+    bool   stop;     // Writer wants the reader to stop
+    bool   writer_idle;
+    bool   read_ok;  // Reader stopped at EOF
+    int    read_errno;
+    file  *in;
+    int    read_size;
+
+    stage_stats read_stats;
+    stage_stats write_stats;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+};
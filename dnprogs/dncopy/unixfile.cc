@@ -15,6 +15,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <string.h>
@@ -41,7 +43,8 @@ int unixfile::open(const char *mode)
     }
     else
     {
-	stream = fopen(filename, mode);
+	stream = open_stream(filename, mode);
+	if (stream) start_io(mode);
     }
     strcpy(printname, filename);
 
@@ -60,14 +63,175 @@ int unixfile::open(const char *basename, const char *mode)
     strcat(printname, "/");
     strcat(printname, basename);
 
-    stream = fopen(printname, mode);
+    stream = open_stream(printname, mode);
 
     if (stream)
+    {
+	start_io(mode);
 	return 0;
+    }
     else
 	return -1;
 }
 
+// Open a file, keeping the blocks that are already there if we have been
+// asked to restart a copy into it.
+FILE *unixfile::open_stream(const char *name, const char *mode)
+{
+    unsigned int vbn = restart_vbn;
+
+    restart_vbn = 0;
+    have_tail = false;
+    if (vbn && mode[0] == 'w')
+    {
+	FILE *f = fopen(name, "r+");
+	if (f)
+	{
+	    off_t end = (off_t)vbn * BLOCK_SIZE;
+
+	    if (fseeko(f, end - BLOCK_SIZE, SEEK_SET) == 0 &&
+		::fread(tail, 1, BLOCK_SIZE, f) == BLOCK_SIZE &&
+		ftruncate(fileno(f), end) == 0 &&
+		fseeko(f, end, SEEK_SET) == 0)
+	    {
+		have_tail = true;
+		return f;
+	    }
+	    fclose(f);
+	}
+    }
+    return fopen(name, mode);
+}
+
+// Set up for -F on a file we have just opened. Pipes and terminals are
+// left to stdio.
+void unixfile::start_io(const char *mode)
+{
+    struct stat st;
+
+    fast_io = direct = at_eof = preallocated = false;
+    if (!(user_flags & FILE_FLAGS_FAST)) return;
+
+    fd = fileno(stream);
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) return;
+
+    writing = (mode[0] == 'w' || mode[0] == 'a');
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (transfer_mode == MODE_BLOCK)
+    {
+	// The buffer holds a whole number of transfer blocks
+	if (!iobuf && posix_memalign((void **)&iobuf, DIRECT_ALIGN, FAST_BUFSIZE))
+	    iobuf = NULL;
+	if (iobuf && block_size <= (unsigned int)FAST_BUFSIZE)
+	{
+	    io_size = FAST_BUFSIZE - FAST_BUFSIZE % block_size;
+	    io_len = io_ptr = 0;
+	    io_pos = ftello(stream);
+	    fast_io = true;
+
+	    if ((user_flags & FILE_FLAGS_DIRECT) &&
+		io_size % DIRECT_ALIGN == 0 && io_pos % DIRECT_ALIGN == 0)
+		set_direct(true);
+	}
+    }
+    else
+    {
+	// Records still go through stdio, just in bigger lumps
+	setvbuf(stream, NULL, _IOFBF, FAST_BUFSIZE);
+    }
+
+    // Make room for all of it now rather than a bit at a time. This
+    // doesn't change the size of the file; close() gives back anything
+    // we didn't use.
+    off_t start = ftello(stream);
+    if (writing && size_hint > (unsigned long long)start &&
+	fallocate(fd, FALLOC_FL_KEEP_SIZE, start, size_hint - start) == 0)
+	preallocated = true;
+}
+
+void unixfile::set_direct(bool on)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags != -1 &&
+	fcntl(fd, F_SETFL, on ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) == 0)
+	direct = on;
+}
+
+// Read the next lot of the file into iobuf. Returns the number of bytes
+// read, 0 at EOF or -1.
+int unixfile::fill_buffer()
+{
+    ssize_t n;
+
+    io_pos += io_len;
+    io_len = io_ptr = 0;
+    if (at_eof) return 0;
+
+    do
+    {
+	n = pread(fd, iobuf, io_size, io_pos);
+
+	// Not every filesystem can do O_DIRECT
+	if (n < 0 && errno == EINVAL && direct)
+	{
+	    set_direct(false);
+	    errno = EINTR;
+	}
+    }
+    while (n < 0 && errno == EINTR);
+
+    if (n <= 0)
+    {
+	at_eof = (n == 0);
+	return n;
+    }
+    io_len = n;
+
+    // Get the disk going on the next lot while the caller has this one
+    if (!direct)
+	posix_fadvise(fd, io_pos + n, io_size, POSIX_FADV_WILLNEED);
+    return n;
+}
+
+// Write what's in iobuf where it belongs in the file
+int unixfile::write_buffer()
+{
+    int done = 0;
+
+    while (done < io_len)
+    {
+	ssize_t n = pwrite(fd, iobuf + done, io_len - done, io_pos + done);
+	if (n < 0)
+	{
+	    if (errno == EINVAL && direct)
+		set_direct(false);
+	    else if (errno != EINTR)
+		return -1;
+	    continue;
+	}
+	done += n;
+    }
+    return 0;
+}
+
+// Write out iobuf and start a new one after it. Only whole aligned
+// buffers can go with O_DIRECT so a part-filled one (the end of the file)
+// goes without.
+int unixfile::flush_buffer()
+{
+    if (!io_len) return 0;
+
+    if (direct && io_len % DIRECT_ALIGN)
+	set_direct(false);
+    if (write_buffer()) return -1;
+
+    io_pos += io_len;
+    io_len = 0;
+    return 0;
+}
+
 // We honour the transfer mode here mainly for consistancy.
 int unixfile::read(char *buf, int len)
 {
@@ -122,7 +286,24 @@ int unixfile::read(char *buf, int len)
     else // Just read a block
     {
         int reclen;
-	reclen = ::fread(buf, 1, len, stream);
+
+	if (fast_io)
+	{
+	    reclen = 0;
+	    while (reclen < len)
+	    {
+		if (io_ptr == io_len && fill_buffer() <= 0)
+		    break;
+
+		int n = io_len - io_ptr;
+		if (n > len - reclen) n = len - reclen;
+		memcpy(buf + reclen, iobuf + io_ptr, n);
+		io_ptr += n;
+		reclen += n;
+	    }
+	}
+	else
+	    reclen = ::fread(buf, 1, len, stream);
 	if (reclen <= 0)
 	    return -1;
 
@@ -139,11 +320,31 @@ int unixfile::read(char *buf, int len)
 
 int unixfile::write(char *buf, int len)
 {
+    if (fast_io)
+    {
+	int done = 0;
+
+	while (done < len)
+	{
+	    int n = io_size - io_len;
+	    if (n > len - done) n = len - done;
+	    memcpy(iobuf + io_len, buf + done, n);
+	    io_len += n;
+	    done += n;
+
+	    if (io_len == io_size && flush_buffer())
+		return -1;
+	}
+	return len;
+    }
     return ::fwrite(buf, 1, len, stream);
 }
 
 bool unixfile::eof()
 {
+    if (fast_io)
+	return at_eof;
+
 // Don't know why this is necessary
 #if defined(__NetBSD__) || defined(__FreeBSD__)
     return feof(stream);
@@ -154,9 +355,23 @@ bool unixfile::eof()
 
 int unixfile::close()
 {
-    int status;
+    int status = 0;
+
+    if (fast_io && writing && flush_buffer())
+	status = -1;
+
+    // Give back any space we reserved and didn't use
+    if (preallocated)
+    {
+	struct stat st;
+
+	if (fflush(stream) == 0 && fstat(fileno(stream), &st) == 0)
+	    ftruncate(fileno(stream), st.st_size);
+    }
+    fast_io = direct = preallocated = false;
 
-    status =  ::fclose(stream);
+    if (::fclose(stream))
+	status = -1;
     stream = NULL;
 
     return status;
@@ -178,6 +393,7 @@ bool unixfile::isdirectory()
 int unixfile::setup_link(unsigned int bufsize, int rfm, int rat, int xfer_mode, int flags, int timeout)
 {
 // Save these for later
+    user_flags = flags;
     user_rfm = rfm;
     user_rat = rat;
     transfer_mode = xfer_mode;
@@ -199,16 +415,13 @@ int unixfile::next()
 
 char *unixfile::get_printname()
 {
-    static char realname[MAX_PATH];
-
     realpath(printname, realname);
     return realname;
 }
 
 char *unixfile::get_printname(char *filename)
 {
-    static char realname[MAX_PATH];
-    static char tmpname[MAX_PATH];
+    char tmpname[MAX_PATH];
 
     strcpy(tmpname, this->filename);
     strcat(tmpname, "/");
@@ -262,25 +475,123 @@ int unixfile::set_umask(int mask)
     return ::fchmod(fileno(stream), mask);
 }
 
+// With -F, keep block transfers to whole disk blocks so that they fit
+// evenly into our buffer and line up with the VBNs at the other end.
 int unixfile::max_buffersize(int biggest)
 {
+    if ((user_flags & FILE_FLAGS_FAST) && transfer_mode == MODE_BLOCK &&
+	biggest >= BLOCK_SIZE)
+	return biggest - biggest % BLOCK_SIZE;
     return biggest;
 }
 
-unixfile::unixfile()
+int unixfile::restart_at(unsigned int vbn)
+{
+    // Not open yet: open_stream() will do it
+    if (!stream)
+    {
+	restart_vbn = vbn;
+	return 0;
+    }
+    if (fast_io)
+    {
+	io_pos = (off_t)vbn * BLOCK_SIZE;
+	io_len = io_ptr = 0;
+	at_eof = false;
+	if (direct && io_pos % DIRECT_ALIGN)
+	    set_direct(false);
+	return 0;
+    }
+    return fseeko(stream, (off_t)vbn * BLOCK_SIZE, SEEK_SET);
+}
+
+char *unixfile::restart_tail()
+{
+    return have_tail ? tail : NULL;
+}
+
+// Make sure what we have written so far is on the disk
+int unixfile::sync()
+{
+    if (fast_io)
+    {
+	// Write a part-filled buffer without O_DIRECT but keep it, so the
+	// whole thing can still go direct when it is full.
+	if (direct && io_len % DIRECT_ALIGN)
+	{
+	    set_direct(false);
+	    int status = write_buffer();
+	    set_direct(true);
+	    if (status) return -1;
+	}
+	else if (flush_buffer())
+	    return -1;
+	return fsync(fd);
+    }
+    if (fflush(stream)) return -1;
+    return fsync(fileno(stream));
+}
+
+const char *unixfile::get_localname(const char *basename)
+{
+    if (!strcmp(filename, "-"))
+	return NULL;
+    if (!basename)
+	return filename;
+
+    snprintf(localname, sizeof(localname), "%s/%s", filename, basename);
+    return localname;
+}
+
+unsigned long long unixfile::get_size()
+{
+    struct stat st;
+
+    if (stream && fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode))
+	return st.st_size;
+    return 0;
+}
+
+time_t unixfile::get_date()
 {
+    struct stat st;
+
+    if (stream && fstat(fileno(stream), &st) == 0)
+	return st.st_mtime;
+    return 0;
+}
+
+void unixfile::set_size(unsigned long long size)
+{
+    size_hint = size;
+}
+
+void unixfile::init()
+{
+    stream = NULL;
+    restart_vbn = 0;
+    have_tail = false;
     record_buffer = NULL;
     record_ptr = record_buflen = 0;
+    user_flags = 0;
+    fast_io = direct = preallocated = false;
+    iobuf = NULL;
+    size_hint = 0;
+}
+
+unixfile::unixfile()
+{
+    init();
 }
 unixfile::~unixfile()
 {
     if (record_buffer)
 	free(record_buffer);
+    free(iobuf);
 }
 
 unixfile::unixfile(const char *name)
 {
     strcpy(filename, name);
-    record_buffer = NULL;
-    record_ptr = record_buflen = 0;
+    init();
 }
@@ -25,10 +25,18 @@ class unixfile: public file
     virtual bool  isdirectory();
     virtual bool  iswildcard();
     virtual int   max_buffersize(int biggest);
+    virtual int   restart_at(unsigned int vbn);
+    virtual char *restart_tail();
+    virtual int   sync();
+    virtual const char *get_localname(const char *basename);
+    virtual unsigned long long get_size();
+    virtual time_t get_date();
+    virtual void  set_size(unsigned long long size);
 
  protected:
     char   filename[MAX_PATH+1];
     char   printname[MAX_PATH+1];
+    char   realname[MAX_PATH+1];
     FILE  *stream;
     int    user_rfm;
     int    user_rat;
@@ -37,7 +45,38 @@ class unixfile: public file
     int    record_ptr;
     int    record_buflen;
     unsigned int block_size;
+    unsigned int restart_vbn;
+    bool   have_tail;
+    char   tail[BLOCK_SIZE];
+    char   localname[MAX_PATH*2+2];
+
+    int    user_flags;
+
+    // -F: block transfers bypass stdio and use our own buffer, read and
+    // written a whole buffer at a time.
+    bool   fast_io;
+    bool   direct;       // fd has O_DIRECT set
+    bool   writing;
+    bool   at_eof;
+    bool   preallocated;
+    int    fd;
+    char  *iobuf;
+    int    io_size;      // The part of iobuf we use
+    int    io_len;       // Bytes in iobuf
+    int    io_ptr;       // Next byte to read from iobuf
+    off_t  io_pos;       // Where iobuf starts in the file
+    unsigned long long size_hint;
+
+    void   init();
+    FILE  *open_stream(const char *name, const char *mode);
+    void   start_io(const char *mode);
+    void   set_direct(bool on);
+    int    fill_buffer();
+    int    flush_buffer();
+    int    write_buffer();
 
     static const int RECORD_BUFSIZE = 4096;
+    static const int FAST_BUFSIZE   = 1024*1024;
+    static const int DIRECT_ALIGN   = 4096;
 };
 
@@ -28,6 +28,10 @@
 #include "connection.h"
 #include "protocol.h"
 #include "logging.h"
+#include "pipeline.h"
+
+// Number of ERASE requests we keep outstanding in verbose mode
+#define DELETE_WINDOW 16
 
 
 static void usage(void)
@@ -128,6 +132,42 @@ static bool dap_get_delete_ack(dap_connection &c)
     return false;
 }
 
+// Collect replies to pipelined delete requests. If 'all' is false we stop
+// after one request has completed, otherwise we wait for all of them.
+static bool dap_get_pipelined_acks(dap_pipeline &p, bool all)
+{
+    dap_message *m;
+    void *tag;
+    int r;
+
+    while ((r = p.next_reply(&m, &tag)) > 0)
+    {
+	if (r == dap_pipeline::REPLY_DONE)
+	{
+	    if (m->get_type() == dap_message::STATUS)
+	    {
+		dap_status_message *sm = (dap_status_message *)m;
+		fprintf(stderr, "Error deleting %s: %s\n", p.get_filespec(),
+			sm->get_message());
+	    }
+	    else
+	    {
+		printf("Deleted %s\n", p.get_filespec());
+	    }
+	    delete m;
+	    if (!all) return true;
+	    continue;
+	}
+	delete m;
+    }
+    if (r == dap_pipeline::REPLY_ERROR)
+    {
+	fprintf(stderr, "%s\n", p.get_error());
+	return false;
+    }
+    return true;
+}
+
 // Send CONTRAN/SKIP message. We need this if a file in the list is locked.
 static bool dap_send_skip(dap_connection &conn)
 {
@@ -303,6 +343,9 @@ int main(int argc, char *argv[])
 	}
     }
 
+    /* In verbose mode several deletes are kept in flight on del_conn */
+    dap_pipeline del_pipe(del_conn, DELETE_WINDOW);
+
     /* If non-interactive then the next command just deletes the files */
     dap_directory_lookup(dir_conn, name, interactive || (verbose>0) );
 
@@ -327,12 +370,14 @@ int main(int argc, char *argv[])
 	    }
 	    else if (verbose)
 	    {
-		dap_delete_file(del_conn, name);
-		if (dap_get_delete_ack(del_conn))
-		    printf("Deleted %s\n", name);
+		del_pipe.add(dap_access_message::ERASE, 1, 0, name, NULL);
+		if (del_pipe.window_full() &&
+		    !dap_get_pipelined_acks(del_pipe, false))
+		    break;
 	    }
 	}
     }
+    if (verbose && !interactive) dap_get_pipelined_acks(del_pipe, true);
 
     dir_conn.close();
     if (two_links) del_conn.close();
@@ -18,6 +18,8 @@
 #include <sys/socket.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -30,6 +32,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <glob.h>
+#include <dirent.h>
 #include <string.h>
 #include <netdnet/dn.h>
 #include <netdnet/dnetdb.h>
@@ -41,6 +44,7 @@
 #include "params.h"
 #include "task.h"
 #include "server.h"
+#include "wildcard.h"
 #include "directory.h"
 
 fal_directory::fal_directory(dap_connection &c, int v, fal_params &p):
@@ -77,9 +81,6 @@ bool fal_directory::process_message(dap_message *m)
     {
     case dap_message::ACCESS:
         {
-	    glob_t gl;
-	    int    status;
-	    int    pathno = 0;
 	    char   *dirdir = NULL;
 	    bool   double_wildcard = false;
 
@@ -156,75 +157,25 @@ bool fal_directory::process_message(dap_message *m)
 	    // Convert % wildcards to ?
 	    if (vms_format) convert_vms_wildcards(filespec);
 
-	    // Create the list of files
-	    status = glob(filespec, GLOB_MARK | GLOB_NOCHECK, NULL, &gl);
-	    if (status)
-	    {
-		return_error();
-		return false;
-	    }
-
 	    // Enable blocked output for the whole of the transmission.
 	    // the connection will send a buffer full at a time.
 	    conn.set_blocked(true);
 
-	    // Keep a track of the last path so we know when to send
-            // a new directory spec.
-	    char last_path[PATH_MAX] = {'\0'};
-
-	    // Display the file names
-	    while (gl.gl_pathv[pathno])
+	    switch (double_wildcard ? LIST_USE_GLOB :
+		    list_directory(filespec, am->get_display(),
+				   vms_format && dirdir))
 	    {
-		// Ignore metafile directory
-		if (strcmp(gl.gl_pathv[pathno], METAFILE_DIR)==0) continue;
-
-		if (vms_format && double_wildcard)
-		{
-		    char dir_path[PATH_MAX];
-		    strcpy(dir_path, gl.gl_pathv[pathno]);
-		    if (strrchr(dir_path, '/'))
-			*strrchr(dir_path, '/') = '\0';
-
-		    if (strcmp(last_path, dir_path))
-		    {
-			char filespec[PATH_MAX];
-
-			make_vms_filespec(gl.gl_pathv[pathno], filespec, true);
-			split_filespec(volume, directory, filespec);
-
-			name_msg->set_nametype(dap_name_message::VOLUME);
-			name_msg->set_namespec(volume);
-			if (!name_msg->write(conn)) return false;
-
-			name_msg->set_nametype(dap_name_message::DIRECTORY);
-			name_msg->set_namespec(directory);
-			if (!name_msg->write(conn)) return false;
-			strcpy(last_path, dir_path);
-		    }
-		}
+	    case LIST_FAILED:
+		return_error();
+		return false;
 
-		// If the requested filespec has ".DIR" in it then
-		// only send directories.
-		if (vms_format && dirdir)
-		{
-		    if (gl.gl_pathv[pathno][strlen(gl.gl_pathv[pathno])-1] == '/')
-			if (!send_dir_entry(gl.gl_pathv[pathno], am->get_display()))
-			{
-			    return_error();
-			    return false;
-			}
-		}
-		else
-		{
-		    if (!send_dir_entry(gl.gl_pathv[pathno], am->get_display()))
-		    {
-		        return_error();
-			return false;
-		    }
-		}
-		pathno++;
+	    case LIST_USE_GLOB:
+		if (!list_glob(filespec, am->get_display(),
+			       vms_format && dirdir, double_wildcard))
+		    return false;
+		break;
 	    }
-	    globfree(&gl);
+
 	    dap_accomp_message accomp;
 	    accomp.set_cmpfunc(dap_accomp_message::RESPONSE);
 	    if (!accomp.write(conn)) return false;
@@ -240,6 +191,287 @@ bool fal_directory::process_message(dap_message *m)
     return true;
 }
 
+// List the files matching a pattern using glob(). This will do any
+// pattern at all but stats every file it finds.
+bool fal_directory::list_glob(char *filespec, int display, bool dirs_only,
+			      bool double_wildcard)
+{
+    char   volume[PATH_MAX];
+    char   directory[PATH_MAX];
+    glob_t gl;
+    int    status;
+    int    pathno = 0;
+
+    // Create the list of files
+    status = glob(filespec, GLOB_MARK | GLOB_NOCHECK, NULL, &gl);
+    if (status)
+    {
+	return_error();
+	return false;
+    }
+
+    // Keep a track of the last path so we know when to send
+    // a new directory spec.
+    char last_path[PATH_MAX] = {'\0'};
+
+    // Display the file names
+    while (gl.gl_pathv[pathno])
+    {
+	// Ignore metafile directory
+	if (strcmp(gl.gl_pathv[pathno], METAFILE_DIR)==0) continue;
+
+	if (vms_format && double_wildcard)
+	{
+	    char dir_path[PATH_MAX];
+	    strcpy(dir_path, gl.gl_pathv[pathno]);
+	    if (strrchr(dir_path, '/'))
+		*strrchr(dir_path, '/') = '\0';
+
+	    if (strcmp(last_path, dir_path))
+	    {
+		char filespec[PATH_MAX];
+
+		make_vms_filespec(gl.gl_pathv[pathno], filespec, true);
+		split_filespec(volume, directory, filespec);
+
+		name_msg->set_nametype(dap_name_message::VOLUME);
+		name_msg->set_namespec(volume);
+		if (!name_msg->write(conn)) return false;
+
+		name_msg->set_nametype(dap_name_message::DIRECTORY);
+		name_msg->set_namespec(directory);
+		if (!name_msg->write(conn)) return false;
+		strcpy(last_path, dir_path);
+	    }
+	}
+
+	// If the requested filespec has ".DIR" in it then
+	// only send directories.
+	if (dirs_only)
+	{
+	    if (gl.gl_pathv[pathno][strlen(gl.gl_pathv[pathno])-1] == '/')
+		if (!send_dir_entry(gl.gl_pathv[pathno], display))
+		{
+		    return_error();
+		    return false;
+		}
+	}
+	else
+	{
+	    if (!send_dir_entry(gl.gl_pathv[pathno], display))
+	    {
+		return_error();
+		return false;
+	    }
+	}
+	pathno++;
+    }
+    globfree(&gl);
+    return true;
+}
+
+// Does the string have any glob() special characters in it.
+static bool has_wildcards(const char *s, int len)
+{
+    for (int i=0; i<len && s[i]; i++)
+    {
+	if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\')
+	    return true;
+    }
+    return false;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcoll(((fal_directory::dir_name *)a)->name,
+		   ((fal_directory::dir_name *)b)->name);
+}
+
+// Read the names in a directory that match a pattern. The names are
+// stored one after the other in 'names', directories with a slash on
+// the end, and 'list' points to them.
+// Returns the number of names or -1.
+int fal_directory::read_directory(int dirfd, fal_wildcard &pattern,
+				  char **names, dir_name **list)
+{
+    struct linux_dirent64
+    {
+	unsigned long long d_ino;
+	long long          d_off;
+	unsigned short     d_reclen;
+	unsigned char      d_type;
+	char               d_name[];
+    };
+    char   buf[32768];
+    int    num_names = 0;
+    int    list_size = 0;
+    size_t names_len = 0;
+    size_t names_size = 0;
+    int    len;
+
+    *names = NULL;
+    *list  = NULL;
+
+    while ((len = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0)
+    {
+	for (int pos = 0; pos < len; )
+	{
+	    struct linux_dirent64 *d = (struct linux_dirent64 *)(buf+pos);
+	    pos += d->d_reclen;
+
+	    if (strcmp(d->d_name, METAFILE_DIR) == 0 ||
+		!pattern.match(d->d_name))
+		continue;
+
+	    // Like GLOB_MARK, directories (and links to them) get a slash.
+	    // It's part of the name for sorting too.
+	    bool is_dir = d->d_type == DT_DIR;
+	    if (d->d_type == DT_UNKNOWN || d->d_type == DT_LNK)
+	    {
+		struct stat st;
+		is_dir = fstatat(dirfd, d->d_name, &st, 0) == 0 &&
+		    S_ISDIR(st.st_mode);
+	    }
+
+	    size_t namelen = strlen(d->d_name)+1+is_dir;
+	    if (names_len + namelen > names_size)
+	    {
+		names_size = names_size ? names_size*2 : 4096;
+		if (names_size < names_len + namelen)
+		    names_size = names_len + namelen;
+		char *newnames = (char *)realloc(*names, names_size);
+		if (!newnames) return -1;
+		*names = newnames;
+	    }
+	    if (num_names == list_size)
+	    {
+		list_size = list_size ? list_size*2 : 128;
+		dir_name *newlist = (dir_name *)realloc(*list, list_size*sizeof(dir_name));
+		if (!newlist) return -1;
+		*list = newlist;
+	    }
+
+	    // Store the offset for now as 'names' may move
+	    strcpy(*names + names_len, d->d_name);
+	    if (is_dir) strcat(*names + names_len, "/");
+	    (*list)[num_names].name = (char *)names_len;
+	    (*list)[num_names].is_dir = is_dir;
+	    names_len += namelen;
+	    num_names++;
+	}
+    }
+    if (len < 0) return -1;
+
+    for (int i=0; i<num_names; i++)
+	(*list)[i].name = *names + (size_t)(*list)[i].name;
+
+    // Same order as glob() would give
+    qsort(*list, num_names, sizeof(dir_name), compare_names);
+    return num_names;
+}
+
+// Get only the parts of a file's details that the DISPLAY field asks for
+bool fal_directory::stat_entry(int dirfd, const char *name, int display,
+			       bool follow, struct stat *st)
+{
+    int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+#ifdef STATX_BASIC_STATS
+    struct statx stx;
+    unsigned int mask = STATX_TYPE | STATX_MODE;
+
+    if (display & dap_access_message::DISPLAY_MAIN_MASK)
+	mask |= STATX_INO | STATX_SIZE | STATX_BLOCKS | STATX_MTIME;
+    if (display & dap_access_message::DISPLAY_DATE_MASK)
+	mask |= STATX_MTIME | STATX_CTIME;
+    if (display & dap_access_message::DISPLAY_PROT_MASK)
+	mask |= STATX_UID | STATX_GID;
+
+    if (statx(dirfd, name, flags, mask, &stx) == 0)
+    {
+	memset(st, 0, sizeof(*st));
+	st->st_dev    = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	st->st_ino    = stx.stx_ino;
+	st->st_mode   = stx.stx_mode;
+	st->st_nlink  = stx.stx_nlink;
+	st->st_uid    = stx.stx_uid;
+	st->st_gid    = stx.stx_gid;
+	st->st_size   = stx.stx_size;
+	st->st_blocks = stx.stx_blocks;
+	st->st_mtim.tv_sec  = stx.stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec  = stx.stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+	return true;
+    }
+    if (errno != ENOSYS) return false;
+#endif
+    return fstatat(dirfd, name, st, flags) == 0;
+}
+
+// Wildcards in the last part of the name only. Read the directory
+// ourselves rather than have glob() stat every file in it just to
+// see if it's a directory, then stat each one relative to the directory
+// for only the things the client wants to know.
+// Returns LIST_USE_GLOB if the pattern is one we don't do.
+int fal_directory::list_directory(char *filespec, int display, bool dirs_only)
+{
+    char     *slash = strrchr(filespec, '/');
+    char     *pattern = slash ? slash+1 : filespec;
+    int       dirlen = slash ? slash-filespec+1 : 0;
+    char      path[PATH_MAX];
+    char     *names;
+    dir_name *list;
+    int       num_names;
+    int       dirfd;
+    int       status = LIST_DONE;
+
+    if (!has_wildcards(pattern, strlen(pattern)) ||
+	has_wildcards(filespec, dirlen))
+	return LIST_USE_GLOB;
+
+    memcpy(path, filespec, dirlen);
+    path[dirlen] = '\0';
+
+    // If there's anything wrong with the directory leave glob() to
+    // return the same error it always did.
+    dirfd = open(dirlen ? path : ".", O_RDONLY | O_DIRECTORY);
+    if (dirfd == -1) return LIST_USE_GLOB;
+
+    fal_wildcard matcher(pattern);
+    num_names = read_directory(dirfd, matcher, &names, &list);
+    if (num_names == -1)
+    {
+	free(names);
+	free(list);
+	close(dirfd);
+	return LIST_USE_GLOB;
+    }
+
+    // Like GLOB_NOCHECK we send the pattern itself if nothing matched.
+    if (num_names == 0 && !send_dir_entry(filespec, display))
+	status = LIST_FAILED;
+
+    for (int i=0; i<num_names && status == LIST_DONE; i++)
+    {
+	struct stat st;
+	bool   have_stat;
+
+	if (dirs_only && !list[i].is_dir) continue;
+
+	snprintf(path+dirlen, sizeof(path)-dirlen, "%s", list[i].name);
+
+	// lstat() of a name ending in a slash follows a link, so do the same
+	have_stat = stat_entry(dirfd, list[i].name, display, list[i].is_dir, &st);
+	if (!send_dir_entry(path, display, have_stat?&st:NULL))
+	    status = LIST_FAILED;
+    }
+
+    free(names);
+    free(list);
+    close(dirfd);
+    return status;
+}
+
 // We don't use send_file_attributes from fal_task because we need
 // munge the resultant name a bit more than it, also the NAME file
 // is mandatory for directory listings (quite reasonable really!)
@@ -247,6 +479,18 @@ bool fal_directory::send_dir_entry(char *path, int display)
 {
     struct stat st;
 
+    if (lstat(path, &st) == 0)
+	return send_dir_entry(path, display, &st);
+    else
+	return send_dir_entry(path, display, NULL);
+}
+
+// Send the entry for a file. If 'st' is NULL the file could not be
+// stat'ed and errno says why.
+bool fal_directory::send_dir_entry(char *path, int display, struct stat *st)
+{
+    int saved_errno = errno;
+
     if (verbose > 2) DAPLOG((LOG_INFO, "DISPLAY field = 0x%x\n", display));
     conn.set_blocked(true);
 
@@ -300,17 +544,17 @@ bool fal_directory::send_dir_entry(char *path, int display)
     name_msg->set_nametype(dap_name_message::FILENAME);
     if (!name_msg->write(conn)) return false;
 
-    // Stat the file and send the info.
-    if (lstat(path, &st) == 0)
+    // Send the info from stat.
+    if (st)
     {
         // Do an attrib message
 	if (display & dap_access_message::DISPLAY_MAIN_MASK)
 	{
-	    attrib_msg->set_stat(&st, true);
+	    attrib_msg->set_stat(st, true);
 	    if (!params.can_do_stmlf)
                 attrib_msg->set_rfm(dap_attrib_message::FB$VAR);
 
-	    fake_file_type(path, attrib_msg);
+	    fake_file_type(path, st, attrib_msg);
 	    if (!attrib_msg->write(conn)) return false;
 	}
 
@@ -325,12 +569,12 @@ bool fal_directory::send_dir_entry(char *path, int display)
 	{
 // Because Unix has no concept of a "Created" date we use the earliest
 // of the modified and changed dates. Daft or what?
-	    if (st.st_ctime < st.st_mtime)
-		date_msg->set_cdt(st.st_ctime);
+	    if (st->st_ctime < st->st_mtime)
+		date_msg->set_cdt(st->st_ctime);
 	    else
-		date_msg->set_cdt(st.st_mtime);
+		date_msg->set_cdt(st->st_mtime);
 
-	    date_msg->set_rdt(st.st_mtime);
+	    date_msg->set_rdt(st->st_mtime);
 	    date_msg->set_rvn(1);
 	    if (!date_msg->write(conn)) return false;
 	}
@@ -338,8 +582,8 @@ bool fal_directory::send_dir_entry(char *path, int display)
 	// Send the protection
 	if (display & dap_access_message::DISPLAY_PROT_MASK)
 	{
-	    prot_msg->set_protection(st.st_mode);
-	    prot_msg->set_owner(st.st_gid, st.st_uid);
+	    prot_msg->set_protection(st->st_mode);
+	    prot_msg->set_owner(st->st_gid, st->st_uid);
 	    if (!prot_msg->write(conn)) return false;
 	}
 
@@ -348,10 +592,11 @@ bool fal_directory::send_dir_entry(char *path, int display)
     }
     else
     {
-	if (verbose) DAPLOG((LOG_WARNING, "DIR: cannot stat %s: %s\n", path, strerror(errno)));
-        dap_status_message st;
-        st.set_errno();
-        st.write(conn);
+	if (verbose) DAPLOG((LOG_WARNING, "DIR: cannot stat %s: %s\n", path, strerror(saved_errno)));
+        dap_status_message status;
+        errno = saved_errno;
+        status.set_errno();
+        status.write(conn);
     }
     return true;
 }
@@ -5,7 +5,13 @@ class fal_directory: public fal_task
     fal_directory(dap_connection &c, int v, fal_params &p);
     virtual ~fal_directory();
     virtual bool process_message(dap_message *m);
-    
+
+    struct dir_name
+    {
+	char          *name;
+	bool           is_dir;
+    };
+
   private:
     dap_name_message       *name_msg;
     dap_protect_message    *prot_msg;
@@ -15,4 +21,17 @@ class fal_directory: public fal_task
     dap_alloc_message      *alloc_msg;
 
     bool send_dir_entry(char *path, int);
+    bool send_dir_entry(char *path, int, struct stat *);
+    bool list_glob(char *filespec, int display, bool dirs_only,
+		   bool double_wildcard);
+    int  list_directory(char *filespec, int display, bool dirs_only);
+    int  read_directory(int dirfd, fal_wildcard &pattern,
+			char **names, dir_name **list);
+    bool stat_entry(int dirfd, const char *name, int display,
+		    bool follow, struct stat *st);
+
+    // Return codes from list_directory()
+    static const int LIST_DONE     = 0;
+    static const int LIST_FAILED   = 1;
+    static const int LIST_USE_GLOB = 2;
 };
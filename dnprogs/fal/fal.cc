@@ -44,8 +44,8 @@
 #include "params.h"
 #include "task.h"
 #include "server.h"
-
-#define LOCAL_AUTO_FILE ".fal_auto"
+#include "threads.h"
+#include "typecache.h"
 
 void usage(char *prog, FILE *f);
 
@@ -56,6 +56,9 @@ static dap_connection *global_connection = NULL;
 int main(int argc, char *argv[])
 {
     int    dont_fork = 0;
+    int    workers = 0;
+    int    threads = 0;
+    int    typecache_size = fal_typecache::DEFAULT_SIZE;
     bool   allow_user_override = false;
     char   opt;
     char   log_char = 'l'; // Default to syslog(3)
@@ -67,6 +70,7 @@ int main(int argc, char *argv[])
     p.use_file  = false;            // Use built-in defaults
     p.use_metafiles = false;
     p.use_adf   = false;
+    p.threaded  = false;
     p.vroot[0]  = '\0';
     p.vroot_len = 0;
 
@@ -78,7 +82,7 @@ int main(int argc, char *argv[])
     // so we can check the version number and get help without being root.
     opterr = 0;
     optind = 0;
-    while ((opt=getopt(argc,argv,"?vVhdmtul:a:f:r:")) != EOF)
+    while ((opt=getopt(argc,argv,"?vVhdmtul:a:f:r:w:T:c:")) != EOF)
     {
 	switch(opt)
 	{
@@ -146,6 +150,18 @@ int main(int argc, char *argv[])
 	    log_char = optarg[0];
 	    break;
 
+	case 'w':
+	    workers = atoi(optarg);
+	    break;
+
+	case 'T':
+	    threads = atoi(optarg);
+	    break;
+
+	case 'c':
+	    typecache_size = atoi(optarg);
+	    break;
+
 	case 'f':
 	    // Make sure we save the full path name becase we 'chdir' a lot
 	    realpath(optarg, p.auto_file);
@@ -191,6 +207,49 @@ int main(int argc, char *argv[])
 	    DAPLOG((LOG_INFO, "Using virtual root %s\n", p.vroot));
     }
 
+    // The file type cache is shared by everything we fork, so make it now
+    fal_typecache::init(typecache_size);
+
+    // With a pool of workers parse the types file now so they all
+    // start with a copy of it.
+    if (workers)
+    {
+	dnet_set_prefork(workers, 0);
+	if (p.auto_type == fal_params::CHECK_EXT)
+	    fal_task::open_auto_types_file(p, verbose);
+    }
+
+    // Run threaded unless dnetd has already given us our connection
+    if (threads > 0)
+    {
+	struct sockaddr_dn sa;
+	socklen_t namelen = sizeof(sa);
+
+	if (getsockname(STDIN_FILENO, (struct sockaddr *)&sa, &namelen) == 0)
+	    threads = 0;
+    }
+
+    if (threads > 0)
+    {
+	// The types list is shared by all the threads so it must be
+	// read before any of them might want it.
+	if (p.auto_type == fal_params::CHECK_EXT || allow_user_override)
+	    fal_task::open_auto_types_file(p, verbose);
+
+	int listenfd = dnet_daemon_listen(DNOBJECT_FAL,
+					  NULL, verbose, dont_fork?0:1);
+	if (listenfd == -1) exit(3);
+
+	// PRINT and SUBMIT wait for their own children, and one
+	// client going away must not take the rest with it.
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+
+	fal_threads t(listenfd, p, allow_user_override);
+	if (t.run(threads)) exit(0);
+	exit(3);
+    }
+
     // Be a daemon
     int sockfd = dnet_daemon(DNOBJECT_FAL,
 			     NULL, verbose, dont_fork?0:1);
@@ -200,27 +259,7 @@ int main(int argc, char *argv[])
 
 	// Look for a local conversion override
 	if (allow_user_override)
-	{
-	    struct stat st;
-	    if (stat(LOCAL_AUTO_FILE, &st) == 0)
-	    {
-		FILE *f = fopen(LOCAL_AUTO_FILE, "r");
-		if (f)
-		{
-		    char line[132];
-		    fgets(line, sizeof(line), f);
-		    fclose(f);
-		    if (strncasecmp(line, "none", 4) == 0)
-			p.auto_type = fal_params::NONE;
-		    if (strncasecmp(line, "ext", 3) == 0)
-			p.auto_type = fal_params::CHECK_EXT;
-		    if (strncasecmp(line, "guess", 5) == 0)
-			p.auto_type = fal_params::GUESS_TYPE;
-
-		    if (verbose) DAPLOG((LOG_INFO, "Using conversion type '%s' in local file.\n", p.type_name()));
-		}
-	    }
-	}
+	    fal_task::check_local_auto_type(p, verbose);
 
 	dnet_accept(sockfd, 0, NULL, 0);
 	dap_connection *newone = new dap_connection(sockfd, 65535, verbose);
@@ -230,6 +269,8 @@ int main(int argc, char *argv[])
 	f.closedown();
 	newone->set_blocked(false);
 	delete newone;
+
+	if (verbose) fal_typecache::log_stats();
     }
 }
 
@@ -243,6 +284,9 @@ void usage(char *prog, FILE *f)
     fprintf(f," -l<type>  Logging type(s:syslog, e:stderr, m:mono)\n");
     fprintf(f," -r<dir>   base directory for FAL file operations\n");
     fprintf(f," -u        Allow users to override global auto_types\n");
+    fprintf(f," -w<num>   Keep a pool of <num> worker processes\n");
+    fprintf(f," -T<num>   Serve all connections from one process with <num> threads\n");
+    fprintf(f," -c<num>   Cache the file types of <num> files (0 to disable)\n");
     fprintf(f," -v        Verbose (repeat to increase verbosity)\n");
     fprintf(f," -m        Use meta-files to preserve file info\n");
     fprintf(f," -t        Use VMS NFS $ADF$ files (readonly)\n");
@@ -0,0 +1,559 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+// falbench.cc
+// Loopback benchmark for libdap and FAL.
+//
+// A real fal_server runs in a child process on one end of an AF_UNIX
+// SOCK_SEQPACKET socketpair (which keeps record boundaries just like a
+// DECnet link) and we talk DAP to it from the other end. A file is
+// uploaded in record mode and then read back in record and block mode,
+// with and without client CRC calculation, for each block size.
+// Everything that comes back is checked against what was sent and any
+// unexpected message is reported as a conformance failure.
+//
+// This is built with "make falbench" in the fal directory and is not
+// installed.
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <syslog.h>
+#include <limits.h>
+#include <dirent.h>
+#include <regex.h>
+#include <string.h>
+#include <netdnet/dn.h>
+#include <netdnet/dnetdb.h>
+
+#include "logging.h"
+#include "connection.h"
+#include "protocol.h"
+#include "vaxcrc.h"
+#include "params.h"
+#include "task.h"
+#include "server.h"
+
+#define BENCH_FILE "bench.dat"
+
+static int  verbose     = 0;
+static int  num_records = 10000;
+static int  record_size = 80;
+static int  failures    = 0;
+static bool metafiles   = false;
+static char vroot[PATH_MAX];
+
+static void usage(char *prog, FILE *f)
+{
+    fprintf(f,"%s options:\n", prog);
+    fprintf(f," -n<num>   Number of records to transfer (default 10000)\n");
+    fprintf(f," -s<size>  Record size in bytes (default 80)\n");
+    fprintf(f," -b<size>  Only test this DAP block size\n");
+    fprintf(f," -m        Keep record lengths in a metafile\n");
+    fprintf(f," -v        Verbose (repeat to increase verbosity)\n");
+    fprintf(f," -h        Help\n");
+}
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "CONFORMANCE: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    failures++;
+}
+
+static void report(const char *what, int bs, bool crc, int msgs, int bytes,
+		   double secs)
+{
+    if (secs <= 0.0) secs = 0.000001;
+    printf("%-8s %5d  crc %-3s %8d msgs %10.0f msgs/s %8.2f MB/s\n",
+	   what, bs, crc?"on":"off", msgs, msgs/secs,
+	   bytes/secs/(1024.0*1024.0));
+}
+
+// Fill in the contents of record 'num'. No LFs in here so that block
+// mode reads can be checked against the same pattern.
+static void make_record(int num, char *rec)
+{
+    for (int i=0; i<record_size; i++)
+	rec[i] = 'A' + (num+i)%26;
+}
+
+// The byte at 'pos' in the file as FAL stores it
+static char file_byte(int pos)
+{
+    int rec = pos / (record_size+1);
+    int off = pos % (record_size+1);
+
+    if (off == record_size) return '\n';
+    return 'A' + (rec+off)%26;
+}
+
+// Start a FAL server on one end of a socketpair and return the other end.
+static pid_t start_server(int *fd)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1)
+    {
+	perror("socketpair");
+	return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+	perror("fork");
+	return -1;
+    }
+
+    if (pid == 0)
+    {
+	struct fal_params p;
+
+	::close(sv[0]);
+	p.verbosity     = verbose;
+	p.auto_type     = fal_params::NONE;
+	p.use_file      = false;
+	p.use_metafiles = metafiles;
+	p.use_adf       = false;
+	p.threaded      = false;
+	strcpy(p.vroot, vroot);
+	p.vroot_len     = strlen(vroot);
+
+	dap_connection *conn = new dap_connection(sv[1], 65535, verbose);
+	fal_server f(*conn, p);
+	f.run();
+	f.closedown();
+	conn->set_blocked(false);
+	delete conn;
+	_exit(0);
+    }
+
+    ::close(sv[1]);
+    *fd = sv[0];
+    return pid;
+}
+
+// Client side of the CONFIG exchange, offering block size 'bs'
+static bool client_config(dap_connection &c, int bs)
+{
+    dap_config_message cm(bs);
+    if (!cm.write(c))
+    {
+	fprintf(stderr, "Error sending CONFIG: %s\n", c.get_error());
+	return false;
+    }
+
+    dap_message *m = dap_message::read_message(c, true);
+    if (!m)
+    {
+	fprintf(stderr, "Error reading CONFIG: %s\n", c.get_error());
+	return false;
+    }
+    if (m->get_type() != dap_message::CONFIG)
+    {
+	fail("got %s instead of CONFIG", m->type_name());
+	delete m;
+	return false;
+    }
+
+    dap_config_message *rcm = (dap_config_message *)m;
+    int remote_bs = rcm->get_bufsize();
+    if (remote_bs == 0 || remote_bs > bs)
+	remote_bs = bs;
+    c.set_blocksize(remote_bs);
+    delete m;
+    return true;
+}
+
+// Read messages until one of type 'want' arrives. File attribute messages
+// are allowed before it, anything else is a conformance failure.
+static bool expect(dap_connection &c, int want, const char *what)
+{
+    dap_message *m;
+
+    while ( ((m = dap_message::read_message(c, true))) )
+    {
+	int type = m->get_type();
+
+	if (type == want)
+	{
+	    delete m;
+	    return true;
+	}
+	switch (type)
+	{
+	case dap_message::ATTRIB:
+	case dap_message::ALLOC:
+	case dap_message::DATE:
+	case dap_message::PROTECT:
+	case dap_message::NAME:
+	    break;
+
+	case dap_message::STATUS:
+	    fail("%s: got STATUS: %s", what,
+		 ((dap_status_message *)m)->get_message());
+	    delete m;
+	    return false;
+
+	default:
+	    fail("%s: expected %s, got %s", what,
+		 dap_message::type_name(want), m->type_name());
+	    delete m;
+	    return false;
+	}
+	delete m;
+    }
+    fprintf(stderr, "%s: %s\n", what, c.get_error());
+    failures++;
+    return false;
+}
+
+// Create the file in record mode
+static bool upload(dap_connection &c, int bs)
+{
+    char rec[record_size+1];
+    double start = now();
+
+    dap_attrib_message att;
+    att.set_org(dap_attrib_message::FB$SEQ);
+    att.set_rfm(dap_attrib_message::FB$VAR);
+    att.set_rat_bit(dap_attrib_message::FB$CR);
+    att.set_mrs(record_size);
+
+    // Like VMS, say how many blocks the file will need
+    att.set_alq((num_records*(record_size+1)+511)/512);
+
+    dap_access_message acc;
+    acc.set_accfunc(dap_access_message::CREATE);
+    acc.set_fac(1<<dap_access_message::FB$PUT);
+    acc.set_display(dap_access_message::DISPLAY_MAIN_MASK);
+    acc.set_filespec(BENCH_FILE);
+
+    c.set_blocked(true);
+    att.write(c);
+    acc.write(c);
+    if (!c.set_blocked(false)) return false;
+    if (!expect(c, dap_message::ACK, "CREATE")) return false;
+
+    dap_control_message ctl;
+    ctl.set_ctlfunc(dap_control_message::CONNECT);
+    if (!ctl.write(c)) return false;
+    if (!expect(c, dap_message::ACK, "CONNECT")) return false;
+
+    dap_control_message put;
+    put.set_ctlfunc(dap_control_message::PUT);
+    put.set_rac(dap_control_message::SEQFT);
+    if (!put.write(c)) return false;
+
+    c.set_blocked(true);
+    for (int i=0; i<num_records; i++)
+    {
+	dap_data_message data;
+
+	// Like dncopy we send Unix lines, FAL just writes them out
+	make_record(i, rec);
+	rec[record_size] = '\n';
+	data.set_data(rec, record_size+1);
+	if (!data.write_with_len(c))
+	{
+	    fprintf(stderr, "Error sending DATA: %s\n", c.get_error());
+	    failures++;
+	    return false;
+	}
+    }
+
+    dap_accomp_message accomp;
+    accomp.set_cmpfunc(dap_accomp_message::CLOSE);
+    accomp.write(c);
+    if (!c.set_blocked(false)) return false;
+    if (!expect(c, dap_message::ACCOMP, "CLOSE after PUT")) return false;
+
+    report("put", bs, false, num_records, num_records*(record_size+1),
+	   now()-start);
+    return true;
+}
+
+// Read the file back and check it
+static bool download(dap_connection &c, int bs, bool block_mode, bool crc)
+{
+    vaxcrc calc(DAPPOLY, DAPINICRC);
+    char   rec[record_size];
+    int    msgs  = 0;
+    int    bytes = 0;
+    bool   ateof = false;
+    int    file_size = num_records*(record_size+1);
+    double start = now();
+
+    dap_access_message acc;
+    acc.set_accfunc(dap_access_message::OPEN);
+    if (block_mode)
+	acc.set_fac(1<<dap_access_message::FB$GET | 1<<dap_access_message::FB$BRO);
+    else
+	acc.set_fac(1<<dap_access_message::FB$GET);
+    acc.set_display(dap_access_message::DISPLAY_MAIN_MASK);
+    acc.set_filespec(BENCH_FILE);
+    if (!acc.write(c)) return false;
+    if (!expect(c, dap_message::ACK, "OPEN")) return false;
+
+    dap_control_message ctl;
+    ctl.set_ctlfunc(dap_control_message::CONNECT);
+    if (!ctl.write(c)) return false;
+    if (!expect(c, dap_message::ACK, "CONNECT")) return false;
+
+    dap_control_message get;
+    get.set_ctlfunc(dap_control_message::GET);
+    get.set_rac(block_mode?dap_control_message::BLOCKFT:dap_control_message::SEQFT);
+    if (!get.write(c)) return false;
+
+    dap_message *m;
+    while (!ateof && (m = dap_message::read_message(c, true)) )
+    {
+	switch (m->get_type())
+	{
+	case dap_message::DATA:
+	    {
+		dap_data_message *dm = (dap_data_message *)m;
+		int   len = dm->get_datalen();
+		char *ptr = dm->get_dataptr();
+
+		if (crc) calc.calc4shift((unsigned char *)ptr, len);
+
+		if (block_mode)
+		{
+		    // The last block is padded out to 512 bytes
+		    for (int i=0; i<len && bytes+i<file_size; i++)
+		    {
+			if (ptr[i] != file_byte(bytes+i))
+			{
+			    fail("block data differs at byte %d", bytes+i);
+			    break;
+			}
+		    }
+		}
+		else
+		{
+		    make_record(msgs, rec);
+		    if (len != record_size || memcmp(ptr, rec, len))
+			fail("record %d differs (length %d)", msgs, len);
+		}
+		msgs++;
+		bytes += len;
+	    }
+	    break;
+
+	case dap_message::STATUS:
+	    {
+		dap_status_message *sm = (dap_status_message *)m;
+		if ((sm->get_code() & 0xFF) != 047)
+		{
+		    fail("GET: got STATUS: %s", sm->get_message());
+		    delete m;
+		    return false;
+		}
+		ateof = true;
+	    }
+	    break;
+
+	default:
+	    fail("GET: unexpected %s", m->type_name());
+	    delete m;
+	    return false;
+	}
+	delete m;
+    }
+    if (!ateof)
+    {
+	fprintf(stderr, "GET: %s\n", c.get_error());
+	failures++;
+	return false;
+    }
+
+    dap_accomp_message accomp;
+    accomp.set_cmpfunc(dap_accomp_message::CLOSE);
+    if (!accomp.write(c)) return false;
+    if (!expect(c, dap_message::ACCOMP, "CLOSE after GET")) return false;
+
+    // Check we got it all. Files with a metafile are sent in MRS sized
+    // blocks rather than disk blocks.
+    int blk = metafiles?record_size:512;
+    if (block_mode && bytes != (file_size+blk-1)/blk*blk)
+	fail("block mode read %d bytes, expected %d", bytes,
+	     (file_size+blk-1)/blk*blk);
+    if (!block_mode && msgs != num_records)
+	fail("record mode read %d records, expected %d", msgs, num_records);
+
+    report(block_mode?"block":"record", bs, crc, msgs, bytes, now()-start);
+    return true;
+}
+
+// Run all the transfers for one block size on a fresh server
+static void run_blocksize(int bs)
+{
+    int   fd;
+    int   status;
+
+    // A record (plus LF and DATA header) has to fit in one buffer
+    if (record_size+10 > bs)
+    {
+	printf("skipping block size %d, records are too long\n", bs);
+	return;
+    }
+
+    pid_t pid = start_server(&fd);
+    if (pid == -1)
+    {
+	failures++;
+	return;
+    }
+
+    dap_connection c(fd, bs, verbose);
+    if (client_config(c, bs) &&
+	upload(c, bs) &&
+	download(c, bs, false, false) &&
+	download(c, bs, false, true) &&
+	download(c, bs, true, false))
+	download(c, bs, true, true);
+
+    c.close();
+    waitpid(pid, &status, 0);
+}
+
+// Remove the files FAL made
+static void tidy_dir(const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    struct dirent *de;
+
+    if (!dir) return;
+    while ( (de = readdir(dir)) )
+    {
+	char path[PATH_MAX+sizeof(de->d_name)];
+
+	if (de->d_name[0] == '.') continue;
+	sprintf(path, "%s%s", dirname, de->d_name);
+	unlink(path);
+    }
+    closedir(dir);
+    rmdir(dirname);
+}
+
+static void tidy_vroot()
+{
+    char metadir[PATH_MAX+sizeof(METAFILE_DIR)+1];
+
+    sprintf(metadir, "%s%s/", vroot, METAFILE_DIR);
+    tidy_dir(metadir);
+    tidy_dir(vroot);
+}
+
+int main(int argc, char *argv[])
+{
+    // Not 512: a full disk block plus the DAP header doesn't fit in that
+    int  blocksizes[] = {1024, 4096, 16384, 65535, 0};
+    int  one_bs = 0;
+    char opt;
+
+    opterr = 0;
+    optind = 0;
+    while ((opt=getopt(argc,argv,"?hvmn:s:b:")) != EOF)
+    {
+	switch(opt)
+	{
+	case 'h':
+	    usage(argv[0], stdout);
+	    exit(0);
+
+	case '?':
+	    usage(argv[0], stderr);
+	    exit(2);
+
+	case 'v':
+	    verbose++;
+	    break;
+
+	case 'm':
+	    metafiles = true;
+	    break;
+
+	case 'n':
+	    num_records = atoi(optarg);
+	    break;
+
+	case 's':
+	    record_size = atoi(optarg);
+	    break;
+
+	case 'b':
+	    one_bs = atoi(optarg);
+	    break;
+	}
+    }
+
+    if (num_records < 1 || record_size < 1 ||
+	one_bs < 0 || one_bs > 65535)
+    {
+	usage(argv[0], stderr);
+	exit(2);
+    }
+
+    init_logging("falbench", 'e', false);
+    signal(SIGPIPE, SIG_IGN);
+
+    strcpy(vroot, "/tmp/falbenchXXXXXX");
+    if (!mkdtemp(vroot))
+    {
+	perror("mkdtemp");
+	exit(2);
+    }
+    strcat(vroot, "/");
+
+    printf("%d records of %d bytes\n", num_records, record_size);
+    if (one_bs)
+    {
+	run_blocksize(one_bs);
+    }
+    else
+    {
+	for (int i=0; blocksizes[i]; i++)
+	    run_blocksize(blocksizes[i]);
+    }
+
+    tidy_vroot();
+
+    if (failures)
+    {
+	printf("%d conformance failures\n", failures);
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+// namecache.cc
+// LRU cache of file name translations.
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "namecache.h"
+
+fal_namecache::fal_namecache(int sz):
+    size(sz),
+    used(0),
+    newest(-1),
+    oldest(-1)
+{
+    entries = new entry[size];
+    buckets = new int[size];
+    for (int i=0; i<size; i++)
+	buckets[i] = -1;
+    pthread_mutex_init(&lock, NULL);
+}
+
+fal_namecache::~fal_namecache()
+{
+    for (int i=0; i<used; i++)
+    {
+	free(entries[i].key);
+	free(entries[i].value);
+    }
+    delete[] entries;
+    delete[] buckets;
+    pthread_mutex_destroy(&lock);
+}
+
+unsigned int fal_namecache::hash(const char *s)
+{
+    unsigned int h = 5381;
+
+    while (*s)
+	h = h*33 + (unsigned char)*s++;
+    return h;
+}
+
+int fal_namecache::find(const char *key, unsigned int h)
+{
+    for (int i = buckets[h % size]; i != -1; i = entries[i].next_hash)
+    {
+	if (entries[i].hash == h && strcmp(entries[i].key, key) == 0)
+	    return i;
+    }
+    return -1;
+}
+
+// Move an entry to the front of the LRU list
+void fal_namecache::make_newest(int i)
+{
+    if (i == newest) return;
+
+    // Take it out of the list if it's in it
+    if (entries[i].newer != -1)
+	entries[entries[i].newer].older = entries[i].older;
+    if (entries[i].older != -1)
+	entries[entries[i].older].newer = entries[i].newer;
+    if (i == oldest)
+	oldest = entries[i].newer;
+
+    entries[i].newer = -1;
+    entries[i].older = newest;
+    if (newest != -1)
+	entries[newest].newer = i;
+    newest = i;
+    if (oldest == -1)
+	oldest = i;
+}
+
+void fal_namecache::remove_from_bucket(int i)
+{
+    int *p = &buckets[entries[i].hash % size];
+
+    while (*p != i)
+	p = &entries[*p].next_hash;
+    *p = entries[i].next_hash;
+}
+
+// Look up a name, copying its translation into 'value' (which must be
+// PATH_MAX long). If 'st' is given the entry only counts if it is for
+// the same file.
+bool fal_namecache::lookup(const char *key, char *value, struct stat *st)
+{
+    unsigned int h = hash(key);
+    bool found = false;
+
+    pthread_mutex_lock(&lock);
+    int i = find(key, h);
+    if (i != -1 &&
+	(!st || (entries[i].dev == st->st_dev && entries[i].ino == st->st_ino)))
+    {
+	strcpy(value, entries[i].value);
+	make_newest(i);
+	found = true;
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+// Add or replace a translation. When the cache is full the one that has
+// gone longest without being used is thrown out.
+void fal_namecache::store(const char *key, const char *value, struct stat *st)
+{
+    unsigned int h = hash(key);
+    char *newvalue = strdup(value);
+    char *newkey = NULL;
+
+    if (!newvalue) return;
+
+    pthread_mutex_lock(&lock);
+    int i = find(key, h);
+    if (i == -1)
+    {
+	newkey = strdup(key);
+	if (!newkey)
+	{
+	    pthread_mutex_unlock(&lock);
+	    free(newvalue);
+	    return;
+	}
+
+	if (used < size)
+	{
+	    i = used++;
+	    entries[i].newer = entries[i].older = -1;
+	}
+	else
+	{
+	    i = oldest;
+	    remove_from_bucket(i);
+	    free(entries[i].key);
+	    free(entries[i].value);
+	}
+	entries[i].key = newkey;
+	entries[i].hash = h;
+	entries[i].next_hash = buckets[h % size];
+	buckets[h % size] = i;
+    }
+    else
+	free(entries[i].value);
+
+    entries[i].value = newvalue;
+    entries[i].dev = st ? st->st_dev : 0;
+    entries[i].ino = st ? st->st_ino : 0;
+    make_newest(i);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,43 @@
+// namecache.h
+// A small, fixed size, least-recently-used cache of file name
+// translations. It is shared by every connection in the process
+// (threads included) so it does its own locking.
+//
+// An entry can also remember the device & inode of the file that the
+// name referred to so the caller can check it still does.
+
+class fal_namecache
+{
+ public:
+    fal_namecache(int size);
+    ~fal_namecache();
+
+    bool lookup(const char *key, char *value, struct stat *st = NULL);
+    void store(const char *key, const char *value, struct stat *st = NULL);
+
+ private:
+    struct entry
+    {
+	char        *key;
+	char        *value;
+	dev_t        dev;
+	ino_t        ino;
+	unsigned int hash;
+	int          next_hash;   // Chain of entries in the same bucket
+	int          newer;       // LRU list
+	int          older;
+    };
+
+    entry          *entries;
+    int            *buckets;
+    int             size;
+    int             used;
+    int             newest;
+    int             oldest;
+    pthread_mutex_t lock;
+
+    unsigned int hash(const char *);
+    int  find(const char *, unsigned int);
+    void make_newest(int);
+    void remove_from_bucket(int);
+};
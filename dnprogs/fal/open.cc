@@ -17,8 +17,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/mman.h>
 #include <assert.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -55,7 +59,52 @@
 
 // This is the initial allocation and expansion value for
 // the array or record lengths.
-#define RECORD_LENGTHS_SIZE 100
+
+// Size of the piece of file we map at a time for sending
+#define MAP_WINDOW (16*1024*1024)
+
+// How many DAP buffers' worth of file to ask the kernel to read ahead
+#define READAHEAD_BUFFERS 8
+
+// stdio buffer for files we are writing
+#define WRITE_BUFFER (1024*1024)
+
+// Most space we will reserve for a file in one go, whatever the client
+// asks for
+#define MAX_PREALLOCATE ((off_t)1024*1024*1024)
+
+// If someone else truncates a file while we are sending it from the
+// mapping then touching the pages that are no longer there raises
+// SIGBUS. While send_file() is using the mapping the handler jumps back
+// to it so it can carry on with stdio, which just sees the new end of
+// file. A SIGBUS anywhere else is as fatal as it always was.
+static __thread sigjmp_buf *map_fault_jmp;
+static pthread_once_t map_fault_once = PTHREAD_ONCE_INIT;
+
+static void map_fault_handler(int sig)
+{
+    if (map_fault_jmp)
+	siglongjmp(*map_fault_jmp, 1);
+
+    signal(SIGBUS, SIG_DFL);
+}
+
+static void install_map_fault_handler()
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = map_fault_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+// Makes sure the handler doesn't jump to a function that has returned
+class map_fault_guard
+{
+ public:
+    ~map_fault_guard() { map_fault_jmp = NULL; }
+};
 
 fal_open::fal_open(dap_connection &c, int v, fal_params &p,
 		   dap_attrib_message *att,
@@ -72,12 +121,32 @@ fal_open::fal_open(dap_connection &c, int v, fal_params &p,
     create       = false;
     buf          = new char[conn.get_blocksize()];
     protect_msg  = protect;
+    map_base     = NULL;
+    map_len      = 0;
+    use_mmap     = true;
+    alloc_msg    = alloc;
+    write_buf    = NULL;
+    bytes_written = 0;
+    alloc_end    = 0;
+    alloc_extend = 0;
+    gl.gl_pathc  = 0;
+    gl.gl_pathv  = NULL;
     if (att->get_fop_bit(dap_attrib_message::FB$CIF)) create = true;
 }
 
 fal_open::~fal_open()
 {
+    unmap_file();
+    if (stream)
+    {
+	// The client went away without closing the file
+	if (alloc_end && fflush(stream) == 0)
+	    release_preallocation();
+	fclose(stream);
+    }
+    if (gl.gl_pathv) globfree(&gl);
     delete[] buf;
+    delete[] write_buf;
 }
 
 bool fal_open::process_message(dap_message *m)
@@ -151,9 +220,8 @@ bool fal_open::process_message(dap_message *m)
 		    return false;
 		}
 	    }
-  	    num_records   = 0;
+	    clear_record_lengths();
 	    current_record = 0;
-	    if (record_lengths) delete[] record_lengths;
 
 	    // If we have opened an exisiting Linux file then clear the
             // PRN attribute so the records get handled correctly.
@@ -213,21 +281,38 @@ bool fal_open::process_message(dap_message *m)
 		break;
 
 	    case dap_control_message::PUT:
-	        // We have already parsed the messge options
+	        // We have already parsed the messge options.
+		// Block writes can start at a VBN.
+	        {
+		    long key = cm->get_long_key();
+		    if (key && !use_records &&
+			fseeko(stream, (off_t)512 * (key-1), SEEK_SET))
+		    {
+			return_error();
+			return false;
+		    }
+		}
 		break;
 
 	    case dap_control_message::REWIND:
 		fseek(stream, 0L, SEEK_SET);
+		current_record = 0;
 		break;
 
 	    case dap_control_message::FLUSH:
-		fflush(stream);
+		// $FLUSH means on the disk
+		if (fflush(stream) == 0)
+		    fsync(fileno(stream));
 		break;
 
 	    case dap_control_message::FIND:
 	        {
 		    long key = cm->get_long_key();
-		    if (key) fseek(stream, 512 * (key-1), SEEK_SET);
+		    if (key && fseeko(stream, (off_t)512 * (key-1), SEEK_SET))
+		    {
+			return_error();
+			return false;
+		    }
 		}
 		break;
 
@@ -263,15 +348,26 @@ bool fal_open::process_message(dap_message *m)
 	    case dap_accomp_message::CLOSE:
 
 		// This option needs to be done before close
-		if (am->get_fop_bit(dap_attrib_message::FB$TEF) ||
-		    attrib_msg->get_fop_bit(dap_attrib_message::FB$TEF))
-		    truncate_file();
+		if ((am->get_fop_bit(dap_attrib_message::FB$TEF) ||
+		     attrib_msg->get_fop_bit(dap_attrib_message::FB$TEF)) &&
+		    !truncate_file())
+		{
+		    return_error();
+		    return false;
+		}
 
 		// finished task
+		unmap_file();
 		if (stream)
 		{
+		    if ((create || write_access) && !finish_write())
+		    {
+			return_error();
+			return false;
+		    }
 		    fclose(stream);
 		    stream = NULL;
+		    bytes_written = alloc_end = alloc_extend = 0;
 		}
 
 		// Do post-close options
@@ -296,9 +392,8 @@ bool fal_open::process_message(dap_message *m)
 			return_error();
 			return false;
 		    }
-		    num_records    = 0;
+		    clear_record_lengths();
 		    current_record = 0;
-		    if (record_lengths) delete[] record_lengths;
 
 		    if (!send_file_attributes(block_size, use_records, gl.gl_pathv[glob_entry],
 					      display, SEND_DEV))
@@ -360,10 +455,16 @@ bool fal_open::send_file(int rac, long vbn)
     int   buflen;
     int   bs = block_size;
     long  record_pos; // for RFA sending
+    off_t block_pos;
+    char *dataptr;
+    bool  mapped = false;
     unsigned int total=0;
     dap_data_message data_msg;
     bool  ateof(false);
-
+    sigjmp_buf map_fault;
+    volatile off_t start_pos;
+    volatile unsigned int start_record;
+    map_fault_guard guard;
 
     if (verbose > 2) DAPLOG((LOG_DEBUG, "sending file contents. block size is %d. streaming = %d, use_records=%d, vbn=%d\n", bs, streaming, use_records, vbn));
 
@@ -384,16 +485,72 @@ bool fal_open::send_file(int rac, long vbn)
     // Seek to VBN or RFA (VBNs start at one)
     if (vbn || rac == dap_control_message::RB$RFA)
     {
+	off_t rec_offset;
+
 	if (rac == dap_control_message::RB$RFA)
+	{
 	    fseek(stream, vbn, SEEK_SET);
-	else
-	    fseek(stream, 512 * (vbn-1), SEEK_SET);
+
+	    // Keep our place in the metafile record list
+	    if (use_records && record_lengths)
+		find_record_at(vbn, current_record);
+	}
+	else if (rac == dap_control_message::RB$KEY && use_records &&
+		 record_lengths)
+	{
+	    // With a metafile we can go straight to a record number
+	    if (!find_record(vbn-1, rec_offset))
+	    {
+		send_eof();
+		return true;
+	    }
+	    fseeko(stream, rec_offset, SEEK_SET);
+	    current_record = vbn-1;
+	}
+	else if (fseeko(stream, (off_t)512 * (vbn-1), SEEK_SET))
+	{
+	    return_error();
+	    return false;
+	}
     }
 
     record_pos = ftell(stream);
+    block_pos = record_pos;
 
     while (!feof(stream))
     {
+	// Start this record/block again without the mapping if the file
+	// was cut short under it. The signal mask isn't saved, it costs a
+	// system call every time, so SIGBUS is unblocked here instead.
+	start_pos = block_pos;
+	start_record = current_record;
+	if (use_mmap)
+	{
+	    if (sigsetjmp(map_fault, 0) == 0)
+	    {
+		map_fault_jmp = &map_fault;
+	    }
+	    else
+	    {
+		sigset_t ss;
+
+		map_fault_jmp = NULL;
+		sigemptyset(&ss);
+		sigaddset(&ss, SIGBUS);
+		pthread_sigmask(SIG_UNBLOCK, &ss, NULL);
+
+		if (verbose)
+		    DAPLOG((LOG_INFO, "file changed size while it was being sent, using stdio\n"));
+		conn.discard_message();
+		unmap_file();
+		use_mmap = false;
+		mapped = true;
+		block_pos = start_pos;
+		current_record = start_record;
+	    }
+	}
+
+	dataptr = buf;
 	if (use_records)
 	{
 	    // Do we need to use the stored record lengths from the metafile ?
@@ -402,12 +559,26 @@ bool fal_open::send_file(int rac, long vbn)
 	    {
 		if (current_record < num_records)
 		{
-		    if (::fread(buf, 1, record_lengths[current_record], stream) < 1)
-			ateof = true;
+		    int reclen = record_lengths[current_record];
+
+		    if (use_mmap &&
+			map_block(block_pos, reclen, &dataptr) == reclen)
+		    {
+			mapped = true;
+		    }
+		    else
+		    {
+			if (ftello(stream) != block_pos) fseeko(stream, block_pos, SEEK_SET);
+			if (::fread(buf, 1, reclen, stream) < 1)
+			    ateof = true;
+			dataptr = buf;
+		    }
+		    block_pos += reclen;
 
 		    // We read a whole record (including our "compatibility" LF)
 		    // which VMS does not want.
-		    buflen = record_lengths[current_record++]-1;
+		    buflen = reclen-1;
+		    current_record++;
 		}
 		else
 		{
@@ -415,10 +586,31 @@ bool fal_open::send_file(int rac, long vbn)
 		    return true;
 		}
 	    }
+	    else if (use_mmap &&
+		     (buflen = map_block(block_pos, conn.get_blocksize()-10,
+					 &dataptr)) >= 0)
+	    {
+		// Records are sent straight out of the mapped file. The LF,
+		// if there is one within the maximum record size, ends it.
+		mapped = true;
+		if (!buflen) ateof = true;
+		char *lf = (char *)memchr(dataptr, '\n', buflen);
+		if (lf)
+		{
+		    /* Remove the trailing LF for non STMLF capable OSs */
+		    buflen = lf - dataptr;
+		    block_pos += buflen+1;
+		}
+		else
+		{
+		    block_pos += buflen;
+		}
+	    }
 	    else
 	    {
 		// Read up to the next LF or EOF
 		int newchar;
+		if (ftello(stream) != block_pos) fseeko(stream, block_pos, SEEK_SET);
 		buflen = 0;
 		do
 		{
@@ -428,16 +620,36 @@ bool fal_open::send_file(int rac, long vbn)
 			buf[buflen++] = (char) newchar;
 		    }
 		} while (newchar != EOF && newchar != '\n' && buflen < conn.get_blocksize()-10);
-		ateof = feof(stream);
+		// A last line with no LF is still a record
+		ateof = feof(stream) && buflen == 0;
 		/* Remove the trailing LF for non STMLF capable OSs */
 		if (newchar == '\n')
 			buflen--;
+		block_pos = ftello(stream);
 	    }
 	}
+	else if (use_mmap && (buflen = map_block(block_pos, bs, &dataptr)) >= 0)
+	{
+	    mapped = true;
+	    if (!buflen) ateof = true;
+
+	    // Always send a full block or VMS complains.
+	    if (buflen && buflen < bs)
+	    {
+		memcpy(buf, dataptr, buflen);
+		memset(buf+buflen, 0, bs-buflen);
+		dataptr = buf;
+	    }
+	    block_pos += bs;
+	    buflen=bs;
+	}
 	else // Block read
 	{
+	    // Pick up where the mapping left off if that failed
+	    if (ftello(stream) != block_pos) fseeko(stream, block_pos, SEEK_SET);
 	    buflen = ::fread(buf, 1, bs, stream);
 	    if (!buflen) ateof = true;
+	    block_pos += buflen;
 
 	    // Always send a full block or VMS complains.
 	    buflen=bs;
@@ -446,8 +658,7 @@ bool fal_open::send_file(int rac, long vbn)
 	// We got some data
 	if (!ateof)
 	{
-	    data_msg.set_data(buf, buflen);
-	    if (!data_msg.write_with_len(conn)) return false;
+	    if (!data_msg.write_with_len(conn, dataptr, buflen)) return false;
 
 	    if (verbose > 2) DAPLOG((LOG_DEBUG, "sent %d bytes of data\n", buflen));
 	    total += buflen;
@@ -497,6 +708,9 @@ bool fal_open::send_file(int rac, long vbn)
 	if (!streaming) break;
     }
 
+    // Keep stdio in step with what we sent from the mapping
+    if (mapped) fseeko(stream, block_pos, SEEK_SET);
+
     if (streaming)
     {
 	if (verbose > 1) DAPLOG((LOG_DEBUG, "sent file contents: %d bytes\n", total));
@@ -516,6 +730,75 @@ bool fal_open::send_file(int rac, long vbn)
     return true;
 }
 
+// Return a pointer to up to 'len' bytes of the file at 'pos' in *ptr.
+// Returns the number of bytes available, 0 at EOF or -1 if the file
+// can't be mapped, in which case the caller should use stdio instead.
+int fal_open::map_block(off_t pos, int len, char **ptr)
+{
+    int fd = fileno(stream);
+
+    if (!map_base)
+    {
+	struct stat st;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+	{
+	    use_mmap = false;
+	    return -1;
+	}
+	pthread_once(&map_fault_once, install_map_fault_handler);
+	map_file_size = st.st_size;
+	readahead_pos = pos;
+	if (streaming) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (pos >= map_file_size) return 0;
+    if (len > map_file_size-pos) len = map_file_size-pos;
+
+    // Move the window if this block isn't in it
+    if (!map_base || pos < map_offset ||
+	pos+len > map_offset+(off_t)map_len)
+    {
+	unmap_file();
+	map_offset = pos & ~((off_t)MAP_WINDOW-1);
+	map_len = MAP_WINDOW + len;
+	if ((off_t)map_len > map_file_size-map_offset)
+	    map_len = map_file_size-map_offset;
+
+	void *m = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, map_offset);
+	if (m == MAP_FAILED)
+	{
+	    if (verbose > 1)
+		DAPLOG((LOG_DEBUG, "mmap failed, using stdio: %s\n", strerror(errno)));
+	    map_base = NULL;
+	    use_mmap = false;
+	    return -1;
+	}
+	map_base = (char *)m;
+	madvise(map_base, map_len, MADV_SEQUENTIAL);
+    }
+
+    // Keep the kernel reading ahead of us by a few DAP buffers
+    if (pos >= readahead_pos)
+    {
+	off_t ahead = (off_t)conn.get_blocksize() * READAHEAD_BUFFERS;
+	posix_fadvise(fd, pos, ahead, POSIX_FADV_WILLNEED);
+	readahead_pos = pos + ahead/2;
+    }
+
+    *ptr = map_base + (pos-map_offset);
+    return len;
+}
+
+void fal_open::unmap_file()
+{
+    if (map_base)
+    {
+	munmap(map_base, map_len);
+	map_base = NULL;
+    }
+}
+
 // Write some data to the file
 bool fal_open::put_record(dap_data_message *dm)
 {
@@ -548,7 +831,8 @@ bool fal_open::put_record(dap_data_message *dm)
 
 	    case '0': // Two new lines
 		dataptr[0] = '\n';
-		if (!fwrite("\n", 1, 1, stream)) return false;
+		if (putc('\n', stream) == EOF) return false;
+		bytes_written++;
 		break;
 
 
@@ -563,28 +847,17 @@ bool fal_open::put_record(dap_data_message *dm)
     // Write the data
     if (!fwrite(dataptr, datalen, 1, stream)) return false;
 
+    // Reserve the next lot of space as we get near the end of the last
+    bytes_written += datalen;
+    if (alloc_extend && bytes_written > alloc_end)
+	preallocate(bytes_written + alloc_extend);
+
     // If we are writing variable-length records then keep a list of
     // their lengths in the metadata.
     if (attrib_msg->get_rfm() == dap_attrib_message::FB$VAR && use_records &&
 	params.use_metafiles)
     {
-	if (!record_lengths)
-	{
-	    record_lengths = new unsigned short[RECORD_LENGTHS_SIZE];
-	    num_records = RECORD_LENGTHS_SIZE;
-	}
-
-	// See if we need to expand the array.
-	if (current_record >= num_records)
-	{
-	    num_records += RECORD_LENGTHS_SIZE;
-	    unsigned short *temp = new unsigned short[num_records];
-	    memcpy(temp, record_lengths, sizeof(unsigned short)*current_record);
-	    delete[] record_lengths;
-	    record_lengths = temp;
-	    if (verbose) DAPLOG((LOG_INFO, "Expanding records array to %d entries\n", num_records));
-	}
-	record_lengths[current_record++] = datalen;
+	add_record_length(datalen);
     }
 
     // Send STATUS message if in stop/go mode
@@ -606,7 +879,7 @@ void fal_open::print_file()
 
     sprintf(cmd, PRINT_COMMAND, gl.gl_pathv[glob_entry]);
 
-    int status = system(cmd);
+    int status = run_command(cmd);
 
     if (verbose > 1) DAPLOG((LOG_INFO, "Print file status = %d\n", status));
 }
@@ -620,9 +893,14 @@ void fal_open::delete_file()
 }
 
 // truncate the file a its current length
-void fal_open::truncate_file()
+bool fal_open::truncate_file()
 {
-    ftruncate(fileno(stream), ftell(stream));
+    if (ftruncate(fileno(stream), ftello(stream)))
+    {
+	DAPLOG((LOG_ERR, "Can't truncate %s: %m\n", gl.gl_pathv[glob_entry]));
+	return false;
+    }
+    return true;
 }
 
 // Set variables and options according the the contents of a
@@ -633,12 +911,14 @@ void fal_open::set_control_options(dap_control_message *cm)
         DAPLOG((LOG_DEBUG, "fal_open: CONTROL: type %d, rac=%x\n",
 		cm->get_ctlfunc(), cm->get_rac() ));
 
-  // Determine whether to enable streaming or not
+  // Determine whether to enable streaming or not. Each GET says which
+  // it wants, so a client can go back to record at a time afterwards.
     int access_mode = cm->get_rac();
-    if (access_mode == dap_control_message::SEQFT ||
-	access_mode == dap_control_message::BLOCKFT)
+    if (cm->get_ctlfunc() == dap_control_message::GET ||
+	cm->get_ctlfunc() == dap_control_message::PUT)
     {
-        streaming = true;
+        streaming = (access_mode == dap_control_message::SEQFT ||
+		     access_mode == dap_control_message::BLOCKFT);
     }
 
   // Block transfer ??
@@ -708,5 +988,85 @@ bool fal_open::create_file(char *filespec)
 	return false;
     }
 
+    // Records are usually small, so collect them into big writes
+    write_buf = new char[WRITE_BUFFER];
+    setvbuf(stream, write_buf, _IOFBF, WRITE_BUFFER);
+
+    // Reserve the space the client says the file will need so it isn't
+    // built up from lots of little pieces. ALQ and DEQ are in blocks.
+    int alq = 0;
+    int deq = 0;
+    if (attrib_msg->get_menu_bit(dap_attrib_message::MENU_ALQ))
+	alq = attrib_msg->get_alq();
+    if (attrib_msg->get_menu_bit(dap_attrib_message::MENU_DEQ))
+	deq = attrib_msg->get_deq();
+    if (alloc_msg)
+    {
+	if (alloc_msg->get_alq()) alq = alloc_msg->get_alq();
+	if (alloc_msg->get_deq()) deq = alloc_msg->get_deq();
+    }
+    alloc_extend = (off_t)deq * 512;
+    preallocate((off_t)alq * 512);
+
+    return true;
+}
+
+// Make sure the file has space up to 'end'. This doesn't change its
+// size, any space we don't use is given back by finish_write().
+void fal_open::preallocate(off_t end)
+{
+    struct statvfs sv;
+
+    // Don't let the client take all the disk
+    if (end - alloc_end > MAX_PREALLOCATE)
+	end = alloc_end + MAX_PREALLOCATE;
+    if (fstatvfs(fileno(stream), &sv) == 0 &&
+	end - alloc_end > (off_t)sv.f_bavail * (off_t)sv.f_frsize)
+	end = alloc_end + (off_t)sv.f_bavail * (off_t)sv.f_frsize;
+
+    if (end <= alloc_end) return;
+
+    if (fallocate(fileno(stream), FALLOC_FL_KEEP_SIZE,
+		  alloc_end, end - alloc_end) == -1)
+    {
+	// Not every filesystem can do this, so don't keep asking
+	if (verbose > 1)
+	    DAPLOG((LOG_INFO, "Can't preallocate %s: %m\n",
+		    gl.gl_pathv[glob_entry]));
+	alloc_extend = 0;
+	return;
+    }
+    if (verbose > 2)
+	DAPLOG((LOG_DEBUG, "preallocated %lld bytes\n", (long long)end));
+    alloc_end = end;
+}
+
+// Write out anything we are still holding, give back any preallocated
+// space beyond the end of the file and make sure it's all on disk
+// before we tell the client the file is closed.
+bool fal_open::finish_write()
+{
+    if (fflush(stream)) return false;
+    if (!release_preallocation()) return false;
+
+    return fsync(fileno(stream)) == 0;
+}
+
+// Give back any space preallocate() reserved past the end of the file.
+// The file must have been flushed first.
+bool fal_open::release_preallocation()
+{
+    struct stat st;
+
+    if (!alloc_end) return true;
+
+    if (fstat(fileno(stream), &st) ||
+	(st.st_size < alloc_end && ftruncate(fileno(stream), st.st_size)))
+    {
+	DAPLOG((LOG_ERR, "Can't release space reserved for %s: %m\n",
+		gl.gl_pathv[glob_entry]));
+	return false;
+    }
+    alloc_end = 0;
     return true;
 }
@@ -24,17 +24,37 @@ class fal_open: public fal_task
     bool          create;
     unsigned int  block_size;
 
+    // Blocks and records are sent straight from a window mapped onto the file
+    char         *map_base;
+    off_t         map_offset;
+    size_t        map_len;
+    off_t         map_file_size;
+    off_t         readahead_pos;
+    bool          use_mmap;
+
+    // Records we receive are collected into big writes and the space for
+    // a new file is reserved as the client asks for it
+    char         *write_buf;
+    off_t         bytes_written;
+    off_t         alloc_end;
+    off_t         alloc_extend;
+
     dap_attrib_message  *attrib_msg;
     dap_alloc_message   *alloc_msg;
     dap_protect_message *protect_msg;
 
     bool send_file(int, long);
+    int  map_block(off_t, int, char **);
+    void unmap_file();
     void print_file();
     void delete_file();
-    void truncate_file();
+    bool truncate_file();
     bool put_record(dap_data_message *);
     void set_control_options(dap_control_message *);
     bool create_file(char *);
+    void preallocate(off_t);
+    bool finish_write();
+    bool release_preallocation();
     void send_eof();
 
 };
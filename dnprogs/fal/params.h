@@ -15,6 +15,13 @@ class fal_params
     bool  can_do_stmlf;
     int   remote_os;
 
+    // Only used by the threaded server (-T): who the connection runs as.
+    bool  threaded;
+    uid_t uid;
+    gid_t gid;
+    int   ngroups;
+    gid_t *groups;
+
     const char *type_name()
     {
 	switch(auto_type)
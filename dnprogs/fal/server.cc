@@ -40,6 +40,7 @@
 #include "params.h"
 #include "task.h"
 #include "server.h"
+#include "wildcard.h"
 #include "directory.h"
 #include "open.h"
 #include "create.h"
@@ -55,9 +56,14 @@
 // We DON'T delete the connection here because it belongs to fal.cc and not us.
 void fal_server::closedown()
 {
+    if (current_task) delete current_task;
     if (attrib_msg)  delete attrib_msg;
     if (alloc_msg)   delete alloc_msg;
     if (protect_msg) delete protect_msg;
+    current_task = NULL;
+    attrib_msg   = NULL;
+    alloc_msg    = NULL;
+    protect_msg  = NULL;
 }
 
 // Main loop for FAL server process
@@ -69,131 +75,24 @@ bool fal_server::run()
 // This makes it easier for me to debug child processes
     if (getenv("FAL_CHILD_DEBUG")) sleep(100000);
 
-    attrib_msg  = NULL;
-    alloc_msg   = NULL;
-    protect_msg = NULL;
-
     if (!exchange_config())
     {
 	DAPLOG((LOG_ERR, "Did not get CONFIG message\n"));
 	return false;
     }
-    current_task = NULL;
 
     do
     {
 	m = dap_message::read_message(conn, true);
 	if (m)
 	{
-	    if (verbose > 2)
-		DAPLOG((LOG_ERR ,"Next message: %s\n", m->type_name()));
-
-	    // All actions are initiated by ACCESS messages.
-	    // If we get an ACCESS message before a task has completed then
-	    // we just abandon it and start a new one.
-	    if (m->get_type() == dap_message::ACCESS)
-	    {
-		if (current_task) delete current_task;
-		create_access_task(m);
-		
-		if (!current_task) // Wot??
-		{
-		    dap_status_message st;
-		    
-		    st.set_code(020342); // Operation unsupported
-		    st.write(conn);
-		    return false;
-		}
-	    }
-
-	    // Deal with messages where we don't have a current task
-	    if (!current_task)
-	    {
-		switch (m->get_type())
-		{
-		case dap_message::ACCESS:
-		    // dealt with above
-		    break;
-
-		    // These three are all to do with file attributes. We save
-		    // these messages and pass them on to the task if asked.
-		case dap_message::ATTRIB:
-		    {
-			if (attrib_msg) delete attrib_msg;
-			attrib_msg = (dap_attrib_message *)m;
-			m = NULL; // Do not delete it
-		    }
-		    break;
-
-		case dap_message::ALLOC:
-		    {
-			if (alloc_msg) delete alloc_msg;
-			alloc_msg = (dap_alloc_message *)m;
-			m = NULL; // Do not delete it
-		    }
-		    break;
-
-		case dap_message::PROTECT:
-		    {
-			if (protect_msg) delete protect_msg;
-			protect_msg = (dap_protect_message *)m;
-			m = NULL; // Do not delete it
-		    }
-		    break;
-		    
-		    // These we just discard 'cos there's no point to them
-		case dap_message::DATE:
-		    break;
-
-		    // We get these when the remote end starts a new task
-		case dap_message::CONFIG:
-		    {
-			dap_config_message cfg;
-			cfg.write(conn);
-		    }
-		    break;
-
-		    // Just reply to any ACCOMP messages. Our state machine
-                    // obviously is different to DEC's FAL.
-		case dap_message::ACCOMP:
-		    {
-			dap_accomp_message reply;
-			reply.set_cmpfunc(dap_accomp_message::RESPONSE);
-			reply.write(conn);
-		    } 
-		    break;
-
-		default:
-		    {
-			DAPLOG((LOG_ERR, "task type %d not supported\n",
-				m->get_type()));
-			dap_status_message st;
-
-			st.set_code(020342); // Operation unsupported
-			st.write(conn);
-
-			return false;
-		    }
-		}
-	    }
-
-	    // Tell the task to do its work.
-	    if (current_task && !current_task->process_message(m))
-	    {
-		// Task completed
-		delete current_task;
-		current_task = NULL;
-	    }
+	    if (!process_message(m)) return false;
 	}
 	else
 	{
 	    finished = true; // Error on reading. Probably the remote task
                              // closed the connection.
 	}
-
-	// Delete the message
-	if (m) delete m;
-
     } while (!finished);
 
     // If we ended because of a comms error then say so.
@@ -205,14 +104,162 @@ bool fal_server::run()
     return true;
 }
 
+// Start a connection for the threaded server. All we can do is send our
+// CONFIG message, the reply is read by step() when it arrives.
+bool fal_server::start()
+{
+    return send_config();
+}
+
+// Called by the threaded server when the connection is readable.
+// Handles all the messages we have been sent and returns false when the
+// connection is finished with. A task that is sending a file keeps
+// the thread until it has done so.
+bool fal_server::step()
+{
+    do
+    {
+	dap_message *m = dap_message::read_message(conn, true);
+	if (!m)
+	{
+	    if (verbose && conn.get_error())
+		DAPLOG((LOG_ERR, "%s\n", conn.get_error()));
+	    return false;
+	}
+
+	if (!configured)
+	{
+	    if (!read_config(m))
+	    {
+		DAPLOG((LOG_ERR, "Did not get CONFIG message\n"));
+		return false;
+	    }
+	    configured = true;
+	}
+	else
+	{
+	    if (!process_message(m)) return false;
+	}
+    } while (conn.have_input());
+
+    return true;
+}
+
+// Deal with one message from the client. The message is deleted.
+// Returns false if we should close the connection.
+bool fal_server::process_message(dap_message *m)
+{
+    if (verbose > 2)
+	DAPLOG((LOG_ERR ,"Next message: %s\n", m->type_name()));
+
+    // All actions are initiated by ACCESS messages.
+    // If we get an ACCESS message before a task has completed then
+    // we just abandon it and start a new one.
+    if (m->get_type() == dap_message::ACCESS)
+    {
+	if (current_task) delete current_task;
+	create_access_task(m);
+
+	if (!current_task) // Wot??
+	{
+	    dap_status_message st;
+
+	    st.set_code(020342); // Operation unsupported
+	    st.write(conn);
+	    delete m;
+	    return false;
+	}
+    }
+
+    // Deal with messages where we don't have a current task
+    if (!current_task)
+    {
+	switch (m->get_type())
+	{
+	case dap_message::ACCESS:
+	    // dealt with above
+	    break;
+
+	    // These three are all to do with file attributes. We save
+	    // these messages and pass them on to the task if asked.
+	case dap_message::ATTRIB:
+	    {
+		if (attrib_msg) delete attrib_msg;
+		attrib_msg = (dap_attrib_message *)m;
+		m = NULL; // Do not delete it
+	    }
+	    break;
+
+	case dap_message::ALLOC:
+	    {
+		if (alloc_msg) delete alloc_msg;
+		alloc_msg = (dap_alloc_message *)m;
+		m = NULL; // Do not delete it
+	    }
+	    break;
+
+	case dap_message::PROTECT:
+	    {
+		if (protect_msg) delete protect_msg;
+		protect_msg = (dap_protect_message *)m;
+		m = NULL; // Do not delete it
+	    }
+	    break;
+
+	    // These we just discard 'cos there's no point to them
+	case dap_message::DATE:
+	    break;
+
+	    // We get these when the remote end starts a new task
+	case dap_message::CONFIG:
+	    {
+		dap_config_message cfg;
+		cfg.write(conn);
+	    }
+	    break;
+
+	    // Just reply to any ACCOMP messages. Our state machine
+	    // obviously is different to DEC's FAL.
+	case dap_message::ACCOMP:
+	    {
+		dap_accomp_message reply;
+		reply.set_cmpfunc(dap_accomp_message::RESPONSE);
+		reply.write(conn);
+	    }
+	    break;
+
+	default:
+	    {
+		DAPLOG((LOG_ERR, "task type %d not supported\n",
+			m->get_type()));
+		dap_status_message st;
+
+		st.set_code(020342); // Operation unsupported
+		st.write(conn);
+
+		delete m;
+		return false;
+	    }
+	}
+    }
+
+    // Tell the task to do its work.
+    if (current_task && !current_task->process_message(m))
+    {
+	// Task completed
+	delete current_task;
+	current_task = NULL;
+    }
+
+    // Delete the message
+    if (m) delete m;
+    return true;
+}
+
 // Exchange config message
 bool fal_server::exchange_config()
 {
-
-// Send our config message
-    dap_config_message *newcm = new dap_config_message(MAX_BUFSIZE);
-    if (!newcm->write(conn)) return false;
-    delete newcm;
+    if (!send_config()) return false;
 
 // Read the client's config message
     dap_message *m=dap_message::read_message(conn, true);
@@ -221,8 +268,22 @@ bool fal_server::exchange_config()
 	DAPLOG((LOG_ERR, "%s\n", conn.get_error()));
 	return false;
     }
+    return read_config(m);
+}
 
-// Check it's OK and set the connection buffer size
+// Send our config message
+bool fal_server::send_config()
+{
+    dap_config_message *newcm = new dap_config_message(MAX_BUFSIZE);
+    bool status = newcm->write(conn);
+    delete newcm;
+    return status;
+}
+
+// Check the client's config message is OK and set the connection buffer
+// size from it. The message is deleted.
+bool fal_server::read_config(dap_message *m)
+{
     dap_config_message *cm = (dap_config_message *)m;
     if (m->get_type() == dap_message::CONFIG)
     {
@@ -253,6 +314,7 @@ bool fal_server::exchange_config()
     else
     {
 	DAPLOG((LOG_ERR, "Got %s instead of CONFIG\n", m->type_name()));
+	delete m;
 	return false;
     }
     delete m;
@@ -307,7 +369,7 @@ void fal_server::create_access_task(dap_message *m)
 // Return the DAP ACCESS function name
 const char *fal_server::func_name(int number)
 {
-    static char num[32];
+    static __thread char num[32];
 
     switch (number)
     {
@@ -5,22 +5,35 @@
 //
 // The only DAP message handled by the server is the mandatory CONFIG message,
 // all others are passed down to dap_task classes.
+//
+// run() handles the whole connection. The threaded server calls start()
+// and then step() whenever there is something to read instead.
 
 class fal_server
 {
   public:
     fal_server(dap_connection &c, fal_params &p):
 	conn(c),
+	current_task(NULL),
 	verbose(p.verbosity),
-	params(p)
+	params(p),
+	configured(false),
+	attrib_msg(NULL),
+	alloc_msg(NULL),
+	protect_msg(NULL)
 	{}
     ~fal_server() {};
     bool run();
+    bool start();
+    bool step();
     void closedown();
     
  private:
     void create_access_task(dap_message *m);
+    bool process_message(dap_message *m);
     bool exchange_config();
+    bool send_config();
+    bool read_config(dap_message *m);
     const char *func_name(int);
     
     dap_connection    &conn;
@@ -28,6 +41,7 @@ class fal_server
     int                verbose;
     bool               need_crcs;
     struct fal_params  params;
+    bool               configured;
 
     dap_attrib_message  *attrib_msg;
     dap_alloc_message   *alloc_msg;
@@ -129,7 +129,7 @@ bool fal_submit::process_message(dap_message *m)
 	        char cmd[PATH_MAX + strlen(SUBMIT_COMMAND)+1];
 
 		sprintf(cmd, SUBMIT_COMMAND, gl.gl_pathv[pathno]);
-		status = system(cmd);
+		status = run_command(cmd);
 
 		if (verbose > 1)
 		    DAPLOG((LOG_DEBUG, "in fal_submit: '%s', result = %d\n", gl.gl_pathv[pathno], status));
@@ -21,9 +21,12 @@
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
 #include <assert.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -44,6 +47,21 @@
 #include "params.h"
 #include "task.h"
 #include "server.h"
+#include "typecache.h"
+#include "namecache.h"
+
+#define LOCAL_AUTO_FILE ".fal_auto"
+
+// Initial size of the record lengths array
+#define RECORD_LENGTHS_SIZE 100
+
+// Number of names kept by each of the name caches
+#define NAMECACHE_SIZE 512
+
+// VMS file names we have converted, and where directories really are.
+// See make_unix_filespec() and resolve_name().
+static fal_namecache unix_names(NAMECACHE_SIZE);
+static fal_namecache real_dirs(NAMECACHE_SIZE);
 
 // Send and error packet based on errno
 void fal_task::return_error()
@@ -209,9 +227,10 @@ void fal_task::make_vms_filespec(const char *unixname, char *vmsname, bool full)
     int         i;
     char       *lastslash;
     struct stat st;
+    int         status;
 
     // Resolve all relative bits and symbolic links
-    realpath(unixname, fullname);
+    status = resolve_name(unixname, fullname, &st);
 
     // Remove the vroot, but leave a leading slash
     remove_vroot(fullname);
@@ -226,7 +245,7 @@ void fal_task::make_vms_filespec(const char *unixname, char *vmsname, bool full)
         strcat(fullname, ".");
 
     // If it's a directory then add .DIR;1
-    if (lstat(unixname, &st)==0 && S_ISDIR(st.st_mode))
+    if (status==0 && S_ISDIR(st.st_mode))
     {
         // Take care of dots embedded in directory names (/etc/rc.d)
         if (fullname[strlen(fullname)-1] != '.')
@@ -320,6 +339,74 @@ void fal_task::make_vms_filespec(const char *unixname, char *vmsname, bool full)
     strcat(vmsname, lastslash+1);
 }
 
+// realpath() for names we are going to show the client. realpath()
+// looks at every directory in the name every time but all the names in a
+// directory listing are in the same directory, so remember where that
+// really is. A stat() of the directory makes sure it still is.
+// Returns the result of lstat(unixname), which it leaves in 'st'.
+int fal_task::resolve_name(const char *unixname, char *fullname,
+			   struct stat *st)
+{
+    char name[PATH_MAX];
+    char dir[PATH_MAX];
+    int  len = strlen(unixname);
+    int  status;
+
+    // realpath() ignores trailing slashes (GLOB_MARK adds them)
+    while (len > 1 && unixname[len-1] == '/') len--;
+    if (len == 0 || len >= PATH_MAX)
+	return resolve_name_slowly(unixname, fullname, st);
+    memcpy(name, unixname, len);
+    name[len] = '\0';
+
+    // Links need realpath() to follow them
+    status = lstat(name, st);
+    if ((status == -1 && errno != ENOENT) ||
+	(status == 0 && (S_ISLNK(st->st_mode) ||
+			 (unixname[len] == '/' && !S_ISDIR(st->st_mode)))))
+	return resolve_name_slowly(unixname, fullname, st);
+
+    char *slash = strrchr(name, '/');
+    char *base = slash ? slash+1 : name;
+    if (*base == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0)
+	return resolve_name_slowly(unixname, fullname, st);
+
+    if (!slash)
+	strcpy(dir, ".");
+    else if (slash == name)
+	strcpy(dir, "/");
+    else
+    {
+	memcpy(dir, name, slash-name);
+	dir[slash-name] = '\0';
+    }
+
+    struct stat dirst;
+    if (stat(dir, &dirst) == -1)
+	return resolve_name_slowly(unixname, fullname, st);
+
+    if (!real_dirs.lookup(dir, fullname, &dirst))
+    {
+	if (!realpath(dir, fullname))
+	    return resolve_name_slowly(unixname, fullname, st);
+	real_dirs.store(dir, fullname, &dirst);
+    }
+
+    if (strlen(fullname) + strlen(base) + 2 > PATH_MAX)
+	return resolve_name_slowly(unixname, fullname, st);
+    if (strcmp(fullname, "/") != 0)
+	strcat(fullname, "/");
+    strcat(fullname, base);
+    return status;
+}
+
+int fal_task::resolve_name_slowly(const char *unixname, char *fullname,
+				  struct stat *st)
+{
+    realpath(unixname, fullname);
+    return lstat(unixname, st);
+}
+
 // Split out the volume, directory and file portions of a VMS file spec
 // We assume that the VMS name is (quite) well formed.
 void fal_task::parse_vms_filespec(char *volume, char *directory, char *file)
@@ -366,6 +453,37 @@ void fal_task::parse_vms_filespec(char *volume, char *directory, char *file)
 // volume names are turned into directories in the root directory
 // (unless they are SYSDISK which is our pseudo name)
 void fal_task::make_unix_filespec(char *unixname, char *vmsname)
+{
+    // The conversion only depends on the name so keep the answers.
+    // The vroot is added afterwards.
+    if (!unix_names.lookup(vmsname, unixname))
+    {
+	translate_vms_filespec(unixname, vmsname);
+	unix_names.store(vmsname, unixname);
+    }
+
+    // If the name ends in .dir and there is a directory of that name without
+    // the .dir then remove it (the .dir, not the directory!)
+    if (strstr(unixname, ".dir") == unixname+strlen(unixname)-4)
+    {
+	char dirname[strlen(unixname)+1];
+	struct stat st;
+
+	strcpy(dirname, unixname);
+	char *ext = strstr(dirname, ".dir");
+	if (ext) *ext = '\0';
+	if (stat(dirname, &st) == 0 &&
+	    S_ISDIR(st.st_mode))
+	{
+	    char *ext = strstr(unixname, ".dir");
+	    if (ext) *ext = '\0';
+	}
+    }
+    add_vroot(unixname);
+}
+
+// The text part of make_unix_filespec()
+void fal_task::translate_vms_filespec(char *unixname, char *vmsname)
 {
     char volume[PATH_MAX];
     char dir[PATH_MAX];
@@ -467,25 +585,6 @@ void fal_task::make_unix_filespec(char *unixname, char *vmsname)
     // can't really distinguish case. I know samba does fancy stuff with
     // matching various combinations of case but I really can't be bothered.
     dap_connection::makelower(unixname);
-
-    // If the name ends in .dir and there is a directory of that name without
-    // the .dir then remove it (the .dir, not the directory!)
-    if (strstr(unixname, ".dir") == unixname+strlen(unixname)-4)
-    {
-	char dirname[strlen(unixname)+1];
-	struct stat st;
-
-	strcpy(dirname, unixname);
-	char *ext = strstr(dirname, ".dir");
-	if (ext) *ext = '\0';
-	if (stat(dirname, &st) == 0 &&
-	    S_ISDIR(st.st_mode))
-	{
-	    char *ext = strstr(unixname, ".dir");
-	    if (ext) *ext = '\0';
-	}
-    }
-    add_vroot(unixname);
 }
 
 // Convert VMS wildcards to Unix wildcards
@@ -542,7 +641,8 @@ bool fal_task::send_file_attributes(unsigned int &block_size,
 	    attrib_msg.set_stat(&st, send_dev);
 	    if (!params.can_do_stmlf)
 		attrib_msg.set_rfm(dap_attrib_message::FB$VAR);
-	    fake_file_type(block_size, use_records, filename, &attrib_msg);
+	    fake_file_type(block_size, use_records, filename, &st,
+			   &attrib_msg, true);
 
 	    if (show_dev == DEV_DEPENDS_ON_TYPE)
 	    {
@@ -636,6 +736,96 @@ bool fal_task::fake_file_type(const char *name,
     return fake_file_type(blocksize, records, name, attrib_msg);
 }
 
+// fake_file_type() for when we already have the (lstat) details of the
+// file, as in a directory listing.
+bool fal_task::fake_file_type(const char *name, struct stat *st,
+			      dap_attrib_message *attrib_msg)
+{
+    unsigned int blocksize;
+    bool records;
+
+    // These need the target's details
+    if (S_ISLNK(st->st_mode))
+	return fake_file_type(name, attrib_msg);
+
+    return fake_file_type(blocksize, records, name, st, attrib_msg, false);
+}
+
+// The answer is cached against the file's inode and mtime so we only
+// open the file the first time anyone asks. The cache is shared with
+// all the other FAL processes started by the same listener.
+// When opening the file (for_open) a type that came from a metafile is
+// not good enough, we need the record lengths in it too.
+bool fal_task::fake_file_type(unsigned int &blocksize, bool &send_records,
+			      const char *name, struct stat *st,
+			      dap_attrib_message *attrib_msg, bool for_open)
+{
+    fal_filetype type;
+    unsigned int new_blocksize;
+    bool records;
+    int  flags;
+
+    if (S_ISDIR(st->st_mode))
+    {
+	attrib_msg->set_fop_bit(dap_attrib_message::FB$DIR);
+	return false;
+    }
+
+    // Everything that changes the answer, other than the file itself
+    flags = 0x100 | params.auto_type |
+	(params.use_adf ? 0x10 : 0) |
+	(params.use_metafiles ? 0x20 : 0) |
+	(params.can_do_stmlf ? 0x40 : 0);
+
+    // The cache is shared by every user, so only use it for files this
+    // user can read. Otherwise we would tell them how a file they can't
+    // open was classified by someone who could.
+    if (faccessat(AT_FDCWD, name, R_OK, AT_EACCESS) != 0)
+	return fake_file_type(blocksize, send_records, name, attrib_msg);
+
+    if (fal_typecache::lookup(st, flags, type) &&
+	!(for_open && type.from_metafile))
+    {
+	if (type.found)
+	{
+	    attrib_msg->set_rfm(type.rfm);
+	    attrib_msg->set_rat(type.rat);
+	    if (type.have_mrs) attrib_msg->set_mrs(type.mrs);
+	    if (type.have_lrl) attrib_msg->set_lrl(type.lrl);
+	    if (type.have_block_size) blocksize = type.block_size;
+	    send_records = type.send_records;
+	}
+	return type.found;
+    }
+
+    // Not all the guessers set the block size, this tells us if it was
+    new_blocksize = UINT_MAX;
+    records = send_records;
+    type_read_failed = false;
+    type.found = fake_file_type(new_blocksize, records, name, attrib_msg);
+    type.from_metafile = type_from_metafile;
+    type.have_block_size = (new_blocksize != UINT_MAX);
+    type.block_size   = new_blocksize;
+    type.send_records = records;
+    type.rfm      = attrib_msg->get_rfm();
+    type.rat      = attrib_msg->get_rat();
+    type.have_mrs = attrib_msg->get_menu_bit(dap_attrib_message::MENU_MRS);
+    type.mrs      = attrib_msg->get_mrs();
+    type.have_lrl = attrib_msg->get_menu_bit(dap_attrib_message::MENU_LRL);
+    type.lrl      = attrib_msg->get_lrl();
+    // Don't remember an answer that was only a guess because we couldn't
+    // read the file, its ADF or its metafile.
+    if (!type_read_failed)
+	fal_typecache::store(st, flags, type);
+
+    if (type.found)
+    {
+	if (type.have_block_size) blocksize = new_blocksize;
+	send_records = records;
+    }
+    return type.found;
+}
+
 bool fal_task::fake_file_type(unsigned int &blocksize, bool &send_records,
 			      const char *name, dap_attrib_message *attrib_msg)
 {
@@ -653,9 +843,13 @@ bool fal_task::fake_file_type(unsigned int &blocksize, bool &send_records,
 	return true;
 
     // Use metafile data if it exists
+    type_from_metafile = false;
     if (params.use_metafiles &&
 	read_metafile(blocksize, send_records, name, attrib_msg))
+    {
+	type_from_metafile = true;
 	return true;
+    }
 
     // Guess file type
     if (params.auto_type == fal_params::GUESS_TYPE)
@@ -675,7 +869,11 @@ bool fal_task::guess_file_type(unsigned int &block_size, bool &send_records,
     FILE  *stream;
 
     stream = fopen(name, "r");
-    if (!stream) return false; // Preserve attributes passed to us.
+    if (!stream)
+    {
+	type_read_failed = true;
+	return false; // Preserve attributes passed to us.
+    }
 
     if (::fread(buf, sizeof(buf), 1, stream))
     {
@@ -730,7 +928,7 @@ bool fal_task::guess_file_type(unsigned int &block_size, bool &send_records,
 bool fal_task::check_file_type(unsigned int &blocksize, bool &send_records,
 			       const char *name, dap_attrib_message *attrib_msg)
 {
-    if (!auto_types_list) open_auto_types_file();
+    if (!auto_types_list) open_auto_types_file(params, verbose);
     if (!auto_types_list) return false;
 
     if (verbose > 2) DAPLOG((LOG_INFO, "Checking %s against types list\n", name));
@@ -763,10 +961,39 @@ bool fal_task::check_file_type(unsigned int &blocksize, bool &send_records,
     return finished;
 }
 
+//
+// Let the user override the global conversion type with a file in
+// their home directory (-u). Must be called from there.
+//
+void fal_task::check_local_auto_type(fal_params &params, int verbose)
+{
+    struct stat st;
+    if (stat(LOCAL_AUTO_FILE, &st) == 0)
+    {
+	FILE *f = fopen(LOCAL_AUTO_FILE, "r");
+	if (f)
+	{
+	    char line[132];
+	    fgets(line, sizeof(line), f);
+	    fclose(f);
+	    if (strncasecmp(line, "none", 4) == 0)
+		params.auto_type = fal_params::NONE;
+	    if (strncasecmp(line, "ext", 3) == 0)
+		params.auto_type = fal_params::CHECK_EXT;
+	    if (strncasecmp(line, "guess", 5) == 0)
+		params.auto_type = fal_params::GUESS_TYPE;
+
+	    if (verbose) DAPLOG((LOG_INFO, "Using conversion type '%s' in local file.\n", params.type_name()));
+	}
+    }
+}
+
 //
 // Open the auto_types file and parse it into a list of structures
+// This is static so that the list can be built before we start taking
+// connections.
 //
-void fal_task::open_auto_types_file()
+void fal_task::open_auto_types_file(fal_params &params, int verbose)
 {
     int           auto_file_fd = -1;
     size_t        file_size;
@@ -963,34 +1190,50 @@ bool fal_task::read_metafile(unsigned int &block_size, bool &send_records,
 	if (mf)
 	{
 	    if (verbose>1) DAPLOG((LOG_INFO, "opened %s\n", metafile));
-	    metafile_data metadata;
+	    metafile_header metadata;
 
-	    if (::fread(&metadata, sizeof(metadata), 1, mf) != 1)
+	    // The V3 header starts with all the V2 fields except the
+	    // pointer, so it will do for reading both.
+	    if (::fread(&metadata, sizeof(metadata), 1, mf) != 1 &&
+		(metadata.version > 2 || !feof(mf)))
 	    {
 		fclose(mf);
 		return false;
 	    }
 
-	    // V2 metafiles can have a list of record pointers
-	    if (metadata.version > 1 && metadata.num_records > 0)
+	    // Check the version.
+	    if (metadata.version > metafile_header::METAFILE_VERSION)
 	    {
-		if (verbose > 1) DAPLOG((LOG_INFO, "Read metafile with %d records\n", metadata.num_records));
-		metadata.records = new unsigned short[metadata.num_records];
-		::fread(metadata.records, sizeof(short), metadata.num_records,
-			mf);
+		fclose(mf);
+		DAPLOG((LOG_INFO, "metadata for file %s, has wrong version %d. It will be ignored\n", name, metadata.version));
+		return false;
 	    }
-	    fclose(mf);
 
+	    clear_record_lengths();
 	    current_record = 0;
-	    record_lengths = metadata.records;
-	    num_records    = metadata.num_records;
 
-	    // Check the version.
-	    if (metadata.version > metafile_data::METAFILE_VERSION)
+	    if (metadata.version > 2)
 	    {
-		DAPLOG((LOG_INFO, "metadata for file %s, has wrong version %d. It will be ignored\n", name, metadata.version));
-		return false;
+		if (!map_metafile(fileno(mf), metadata))
+		{
+		    fclose(mf);
+		    DAPLOG((LOG_INFO, "metadata for file %s is corrupt. It will be ignored\n", name));
+		    return false;
+		}
+	    }
+	    // V2 metafiles can have a list of record pointers
+	    else if (metadata.version > 1 && metadata.num_records > 0)
+	    {
+		if (verbose > 1) DAPLOG((LOG_INFO, "Read metafile with %d records\n", metadata.num_records));
+		record_lengths = new unsigned short[metadata.num_records];
+		fseek(mf, sizeof(metafile_data), SEEK_SET);
+		num_records = ::fread(record_lengths, sizeof(short),
+				      metadata.num_records, mf);
+		record_lengths_size = metadata.num_records;
+		build_record_index();
 	    }
+	    fclose(mf);
+
 	    attrib_msg->set_rfm(metadata.rfm);
 	    attrib_msg->set_mrs(metadata.mrs);
 	    attrib_msg->set_rat(metadata.rat);
@@ -1022,11 +1265,188 @@ bool fal_task::read_metafile(unsigned int &block_size, bool &send_records,
 	else
 	{
 	    if (verbose) DAPLOG((LOG_INFO, "Can't open existing metafile %s\n", metafile));
+	    type_read_failed = true;
 	}
     }
     return false;
 }
 
+// Map the record index and lengths of a V3 metafile. Nothing is read
+// until send_file() gets to it.
+bool fal_task::map_metafile(int fd, metafile_header &metadata)
+{
+    struct stat st;
+
+    if (metadata.num_records == 0)
+	return true;
+
+    if (metadata.index_interval == 0 ||
+	metadata.num_checkpoints !=
+	(metadata.num_records+metadata.index_interval-1)/metadata.index_interval)
+	return false;
+
+    size_t len = sizeof(metafile_header) +
+	metadata.num_checkpoints * sizeof(unsigned long long) +
+	metadata.num_records * sizeof(unsigned short);
+
+    if (fstat(fd, &st) || (size_t)st.st_size < len)
+	return false;
+
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+	return false;
+
+    if (verbose > 1) DAPLOG((LOG_INFO, "Mapped metafile with %d records\n", metadata.num_records));
+
+    metafile_map        = map;
+    metafile_map_len    = len;
+    record_offsets      = (unsigned long long *)((char *)map + sizeof(metafile_header));
+    record_offsets_owned = false;
+    record_lengths      = (unsigned short *)(record_offsets + metadata.num_checkpoints);
+    num_records         = metadata.num_records;
+    num_checkpoints     = metadata.num_checkpoints;
+    record_lengths_size = num_records;
+    return true;
+}
+
+// Forget any record lengths we have, whether read, mapped or written.
+void fal_task::clear_record_lengths()
+{
+    free_record_offsets();
+    if (metafile_map)
+    {
+	munmap(metafile_map, metafile_map_len);
+	metafile_map = NULL;
+    }
+    else if (record_lengths)
+    {
+	delete[] record_lengths;
+    }
+    record_lengths      = NULL;
+    num_records         = 0;
+    record_lengths_size = 0;
+}
+
+// The index may be in the metafile mapping or one we built ourselves,
+// even when the record lengths are mapped.
+void fal_task::free_record_offsets()
+{
+    if (record_offsets_owned)
+	delete[] record_offsets;
+    record_offsets       = NULL;
+    record_offsets_owned = false;
+    num_checkpoints      = 0;
+}
+
+// Add a record length to the list. The array is doubled when it fills
+// so that writing a big file doesn't keep copying it.
+void fal_task::add_record_length(unsigned short len)
+{
+    if (current_record >= record_lengths_size || metafile_map)
+    {
+	unsigned int newsize = record_lengths_size*2;
+	if (newsize < RECORD_LENGTHS_SIZE) newsize = RECORD_LENGTHS_SIZE;
+
+	unsigned short *temp = new unsigned short[newsize];
+	if (record_lengths)
+	    memcpy(temp, record_lengths, sizeof(unsigned short)*current_record);
+
+	if (metafile_map)
+	{
+	    free_record_offsets();
+	    munmap(metafile_map, metafile_map_len);
+	    metafile_map = NULL;
+	}
+	else if (record_lengths)
+	    delete[] record_lengths;
+
+	record_lengths = temp;
+	record_lengths_size = newsize;
+	if (verbose > 1) DAPLOG((LOG_INFO, "Expanding records array to %d entries\n", newsize));
+    }
+    record_lengths[current_record++] = len;
+    num_records = current_record;
+
+    // The index is rebuilt when it's needed
+    if (record_offsets)
+	free_record_offsets();
+}
+
+// Calculate the checkpoint offsets for the record lengths we have.
+void fal_task::build_record_index()
+{
+    unsigned long long offset = 0;
+
+    free_record_offsets();
+
+    num_checkpoints = (num_records+METAFILE_INDEX_INTERVAL-1)/METAFILE_INDEX_INTERVAL;
+    record_offsets = new unsigned long long[num_checkpoints];
+    record_offsets_owned = true;
+
+    for (unsigned int i=0; i<num_records; i++)
+    {
+	if (i % METAFILE_INDEX_INTERVAL == 0)
+	    record_offsets[i/METAFILE_INDEX_INTERVAL] = offset;
+	offset += record_lengths[i];
+    }
+}
+
+// Mapped metafiles may have been written with a different interval
+unsigned int fal_task::record_index_interval()
+{
+    if (metafile_map && !record_offsets_owned)
+	return ((metafile_header *)metafile_map)->index_interval;
+    else
+	return METAFILE_INDEX_INTERVAL;
+}
+
+// Return the byte offset in the file of record number rec (from 0).
+// This never adds up more than one interval's worth of lengths.
+bool fal_task::find_record(unsigned int rec, off_t &offset)
+{
+    if (rec >= num_records || !record_offsets) return false;
+
+    unsigned int interval = record_index_interval();
+    unsigned int cp = rec/interval;
+    unsigned long long pos = record_offsets[cp];
+    for (unsigned int i=cp*interval; i<rec; i++)
+	pos += record_lengths[i];
+
+    offset = pos;
+    return true;
+}
+
+// Return the number of the record that starts at offset, for RFA access.
+bool fal_task::find_record_at(off_t offset, unsigned int &rec)
+{
+    if (!record_offsets || !num_checkpoints) return false;
+
+    unsigned int interval = record_index_interval();
+
+    // Find the last checkpoint at or before the offset
+    unsigned int lo = 0, hi = num_checkpoints;
+    while (hi - lo > 1)
+    {
+	unsigned int mid = (lo+hi)/2;
+	if (record_offsets[mid] <= (unsigned long long)offset)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    unsigned long long pos = record_offsets[lo];
+    for (unsigned int i=lo*interval; i<num_records && i<(lo+1)*interval; i++)
+    {
+	if (pos == (unsigned long long)offset)
+	{
+	    rec = i;
+	    return true;
+	}
+	pos += record_lengths[i];
+    }
+    return false;
+}
+
 // Create new metafile
 void fal_task::create_metafile(char *name, dap_attrib_message *attrib_msg)
 {
@@ -1034,16 +1454,24 @@ void fal_task::create_metafile(char *name, dap_attrib_message *attrib_msg)
 
     meta_filename(name, metafile);
 
+    // Write a new file and rename it over the old one, another FAL
+    // process may have the old one mapped.
+    char tmpfile[PATH_MAX+8];
+    sprintf(tmpfile, "%s.XXXXXX", metafile);
+
     if (verbose > 1) DAPLOG((LOG_INFO, "Creating metafile %s\n", metafile));
-    FILE *mf = fopen(metafile, "w+");
+    int fd = mkstemp(tmpfile);
+    FILE *mf = (fd == -1) ? NULL : fdopen(fd, "w+");
     if (mf)
     {
-	metafile_data metadata;
+	metafile_header metadata;
+	memset(&metadata, 0, sizeof(metadata));
 	metadata.rfm = attrib_msg->get_rfm();
 	metadata.rat = attrib_msg->get_rat();
 	metadata.mrs = attrib_msg->get_mrs();
-	metadata.version = metafile_data::METAFILE_VERSION;
+	metadata.version = metafile_header::METAFILE_VERSION;
 	metadata.num_records = current_record;
+	metadata.index_interval = METAFILE_INDEX_INTERVAL;
 
 	// Calculate Longest Record Length.
 	unsigned int lrl = 0;
@@ -1055,16 +1483,24 @@ void fal_task::create_metafile(char *name, dap_attrib_message *attrib_msg)
         // If there are no records then put MRS in there.
 	metadata.lrl = (lrl?(lrl - 1):metadata.mrs);
 
+	num_records = current_record;
+	if (record_lengths && current_record > 0)
+	{
+	    build_record_index();
+	    metadata.num_checkpoints = num_checkpoints;
+	}
+
 	// Write it out.
 	if (::fwrite(&metadata, sizeof(metadata), 1, mf) != 1)
 	{
 	    if (verbose) DAPLOG((LOG_ERR, "Error writing metadata file %s\n", metafile));
 	}
 
-	// Save record lengths
+	// Save the index and the record lengths
 	if (record_lengths && current_record > 0)
 	{
 	    if (verbose > 1) DAPLOG((LOG_INFO, "Writing metafile with %d records\n", current_record));
+	    ::fwrite(record_offsets, sizeof(unsigned long long), num_checkpoints, mf);
 	    ::fwrite(record_lengths, sizeof(short), current_record, mf);
 	}
 
@@ -1076,7 +1512,15 @@ void fal_task::create_metafile(char *name, dap_attrib_message *attrib_msg)
 	    fchown(fileno(mf), st.st_uid, st.st_gid);
 	    fchmod(fileno(mf), st.st_mode & 0777);
 	}
-	fclose(mf);
+	if (fclose(mf) == 0)
+	    ::rename(tmpfile, metafile);
+	else
+	    ::unlink(tmpfile);
+    }
+    else
+    {
+	if (fd != -1) close(fd);
+	if (verbose) DAPLOG((LOG_ERR, "Can't create metafile %s: %m\n", metafile));
     }
 }
 
@@ -1119,6 +1563,10 @@ bool fal_task::read_adf(unsigned int &block_size, bool &send_records,
 	}
 	return true;
     }
+    else if (errno != ENOENT)
+    {
+	type_read_failed = true;
+    }
 
     return false;
 }
@@ -1165,6 +1613,40 @@ int fal_task::unlink(char *file)
     return status;
 }
 
+// Run a PRINT or SUBMIT command. A forked FAL is already the user so
+// system() will do but a threaded one (-T) has only changed its
+// filesystem ids, so the command gets a process of its own that really
+// is the user.
+int fal_task::run_command(const char *cmd)
+{
+    pid_t pid;
+    int   status;
+
+    if (!params.threaded) return system(cmd);
+
+    switch (pid = fork())
+    {
+    case -1:
+	return -1;
+
+    case 0:
+	if (setgroups(params.ngroups, params.groups) ||
+	    setgid(params.gid) || setuid(params.uid))
+	    _exit(127);
+
+	// Everything else open in here belongs to other sessions
+	closefrom(3);
+	execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+	_exit(127);
+    }
+
+    while (waitpid(pid, &status, 0) == -1)
+    {
+	if (errno != EINTR) return -1;
+    }
+    return status;
+}
+
 
 fal_task::auto_types *fal_task::auto_types_list = NULL;
 
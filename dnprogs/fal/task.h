@@ -15,16 +15,26 @@ class fal_task
 	verbose(v),
 	crc(DAPPOLY, DAPINICRC),
 	params(p),
-	record_lengths(NULL)
+	record_lengths(NULL),
+	num_records(0),
+	record_lengths_size(0),
+	record_offsets(NULL),
+	record_offsets_owned(false),
+	num_checkpoints(0),
+	metafile_map(NULL),
+	metafile_map_len(0),
+	type_from_metafile(false),
+	type_read_failed(false)
 	{}
     virtual bool process_message(dap_message *m)=0;
     virtual ~fal_task()
 	{
-	    if (record_lengths)
-		delete[] record_lengths;
+	    clear_record_lengths();
 	}
     void set_crc(bool);
     void calculate_crc(unsigned char *, int);
+    static void open_auto_types_file(fal_params &params, int verbose);
+    static void check_local_auto_type(fal_params &params, int verbose);
 
   protected:
     dap_connection &conn;
@@ -39,6 +49,34 @@ class fal_task
     unsigned short *record_lengths;
     unsigned int    num_records;
 
+    // Capacity of record_lengths while we are writing a file
+    unsigned int    record_lengths_size;
+
+    // Byte offset of every METAFILE_INDEX_INTERVAL'th record so we
+    // can find any record without adding up all the ones before it.
+    unsigned long long *record_offsets;
+    bool            record_offsets_owned; // Not part of the metafile mapping
+    unsigned int    num_checkpoints;
+
+    // Set if record_lengths & record_offsets point into a mapped metafile
+    void           *metafile_map;
+    size_t          metafile_map_len;
+
+    // Set by fake_file_type() if the type came from a metafile
+    bool            type_from_metafile;
+
+    // Set by fake_file_type() if the file or its ADF/metafile was
+    // there but couldn't be read, so the answer mustn't be cached.
+    bool            type_read_failed;
+
+    void clear_record_lengths();
+    void free_record_offsets();
+    void add_record_length(unsigned short len);
+    void build_record_index();
+    bool find_record(unsigned int rec, off_t &offset);
+    bool find_record_at(off_t offset, unsigned int &rec);
+    unsigned int record_index_interval();
+
     // Whether we send the DEV part of the attributes message
     typedef enum { SEND_DEV, DONT_SEND_DEV, DEV_DEPENDS_ON_TYPE} dev_option;
 
@@ -52,15 +90,18 @@ class fal_task
     void make_vms_filespec(const char *, char *, bool);
     void parse_vms_filespec(char *, char *, char *);
     void make_unix_filespec(char *, char *);
+    void translate_vms_filespec(char *, char *);
+    int  resolve_name(const char *, char *, struct stat *);
+    int  resolve_name_slowly(const char *, char *, struct stat *);
     void convert_vms_wildcards(char *);
     void add_vroot(char *);
     void remove_vroot(char *);
     bool is_vms_name(char *);
     bool send_ack_and_unblock();
 
-    void open_auto_types_file();
     int  unlink(char *);
     int rename(char *, char *);
+    int  run_command(const char *);
     bool check_file_type(unsigned int &block_size, bool &send_records,
 			 const char *name,
 			 dap_attrib_message *attrib_msg);
@@ -77,6 +118,11 @@ class fal_task
 		  const char *name,
 		  dap_attrib_message *attrib_msg);
     bool fake_file_type(const char *name, dap_attrib_message *attrib_msg);
+    bool fake_file_type(const char *name, struct stat *st,
+			dap_attrib_message *attrib_msg);
+    bool fake_file_type(unsigned int &block_size, bool &send_records,
+			const char *name, struct stat *st,
+			dap_attrib_message *attrib_msg, bool for_open);
     void create_metafile(char *name, dap_attrib_message *attrib_msg);
 
     // The pseudo device name we use
@@ -106,7 +152,8 @@ class fal_task
 	auto_types *next;
     };
 
-    // Structure of the metafile
+    // Structure of a V1 or V2 metafile. V2 files have num_records
+    // record lengths written after the structure (pointer and all).
     class metafile_data
     {
     public:
@@ -119,9 +166,30 @@ class fal_task
 	// For variable-length records with no carriage control:
 	unsigned int  num_records;
 	unsigned short *records; // This is really written after the structure
+    };
 
-	static const int METAFILE_VERSION = 2;
+    // Header of a V3 metafile. The first fields are laid out as in V2 so
+    // old versions of FAL see the version number and ignore the file.
+    // It is followed by num_checkpoints 64 bit offsets (the start of
+    // record 0, index_interval, 2*index_interval...) then num_records
+    // record lengths. The file is mapped rather than read in.
+    class metafile_header
+    {
+    public:
+	unsigned short version;
+	unsigned short rfm;
+	unsigned int   rat;
+	unsigned short mrs;
+	unsigned short lrl;
+	unsigned int   num_records;
+	unsigned int   index_interval;
+	unsigned int   num_checkpoints;
+
+	static const int METAFILE_VERSION = 3;
     };
+    static const unsigned int METAFILE_INDEX_INTERVAL = 64;
+
+    bool map_metafile(int fd, metafile_header &metadata);
 
     // This is reverse-engineered so there's loads missing.
     class adf_struct
@@ -0,0 +1,300 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+// threads.cc
+// Single-process, multi-threaded FAL server.
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/fsuid.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <syslog.h>
+#include <limits.h>
+#include <regex.h>
+#include <grp.h>
+#include <string.h>
+#include <netdnet/dn.h>
+#include <netdnet/dnetdb.h>
+
+#include "logging.h"
+#include "connection.h"
+#include "protocol.h"
+#include "vaxcrc.h"
+#include "params.h"
+#include "task.h"
+#include "server.h"
+#include "threads.h"
+#include "typecache.h"
+
+// glibc's setgroups() changes every thread in the process, we only want
+// to change the one we are running on.
+#ifdef SYS_setgroups32
+#define thread_setgroups(n, g) syscall(SYS_setgroups32, n, g)
+#else
+#define thread_setgroups(n, g) syscall(SYS_setgroups, n, g)
+#endif
+
+fal_threads::fal_threads(int fd, fal_params &p, bool user_override):
+    listenfd(fd),
+    epollfd(-1),
+    wakefd(-1),
+    verbose(p.verbosity),
+    allow_user_override(user_override),
+    params(p)
+{
+}
+
+fal_threads::~fal_threads()
+{
+    if (epollfd != -1) close(epollfd);
+    if (wakefd != -1) close(wakefd);
+}
+
+// Start the threads and wait for them. Returns true if we were told to
+// shut down, false if it all went wrong.
+bool fal_threads::run(int num_threads)
+{
+    pthread_t *threads = new pthread_t[num_threads];
+    int        started = 0;
+    sigset_t   ss;
+
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1)
+    {
+	DAPLOG((LOG_ERR, "Can't create epoll set: %m\n"));
+	return false;
+    }
+
+    // The listening socket has no connection attached
+    if (!wait_for(listenfd, NULL, EPOLL_CTL_ADD))
+	return false;
+
+    // Written to at shutdown. It is left readable so every thread
+    // waiting in epoll_wait() sees it, not just the first.
+    struct epoll_event ev;
+    wakefd = eventfd(0, EFD_CLOEXEC);
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &wakefd;
+    if (wakefd == -1 || epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &ev))
+    {
+	DAPLOG((LOG_ERR, "Can't create shutdown event: %m\n"));
+	return false;
+    }
+
+    // Root's groups are not wanted by anybody
+    setgroups(0, NULL);
+
+    for (int i=0; i<num_threads; i++)
+    {
+	if (pthread_create(&threads[i], NULL, thread_start, this))
+	{
+	    DAPLOG((LOG_ERR, "Can't start thread: %m\n"));
+	    break;
+	}
+	started++;
+    }
+    if (verbose) DAPLOG((LOG_INFO, "Started %d threads\n", started));
+
+    // SIGTERM must interrupt a worker, pthread_join() would just carry on
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+    for (int i=0; i<started; i++)
+	pthread_join(threads[i], NULL);
+
+    close(listenfd);
+    delete[] threads;
+    return dnet_daemon_shutdown();
+}
+
+void *fal_threads::thread_start(void *arg)
+{
+    ((fal_threads *)arg)->worker();
+    return NULL;
+}
+
+// Main loop of a thread
+void fal_threads::worker()
+{
+    struct epoll_event ev;
+
+    // Each thread has its own current directory and umask
+    if (unshare(CLONE_FS))
+    {
+	DAPLOG((LOG_ERR, "Can't unshare filesystem context: %m\n"));
+	return;
+    }
+
+    for (;;)
+    {
+	// Like the forking server we stop taking connections on SIGTERM.
+	// Wake up the other threads so they stop too.
+	if (dnet_daemon_shutdown())
+	{
+	    uint64_t one = 1;
+	    if (write(wakefd, &one, sizeof(one)) != sizeof(one))
+		DAPLOG((LOG_ERR, "Can't wake threads for shutdown: %m\n"));
+	    return;
+	}
+
+	if (epoll_wait(epollfd, &ev, 1, -1) == -1)
+	{
+	    if (errno == EINTR) continue;
+	    DAPLOG((LOG_ERR, "epoll_wait failed: %m\n"));
+	    return;
+	}
+
+	// Another thread is shutting down
+	if (ev.data.ptr == &wakefd)
+	    return;
+
+	connection *c = (connection *)ev.data.ptr;
+	if (!c)
+	{
+	    accept_connection();
+	    wait_for(listenfd, NULL, EPOLL_CTL_MOD);
+	    continue;
+	}
+
+	bool more = false;
+	if (become_user(c))
+	    more = c->server->step();
+	become_root();
+
+	if (!more || !wait_for(c->conn->get_fd(), c, EPOLL_CTL_MOD))
+	    finish(c);
+    }
+}
+
+// (Re)arm a socket in the epoll set. EPOLLONESHOT makes sure only one
+// thread gets it until it is put back.
+bool fal_threads::wait_for(int fd, connection *c, int op)
+{
+    struct epoll_event ev;
+
+    ev.events   = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epollfd, op, fd, &ev))
+    {
+	DAPLOG((LOG_ERR, "epoll_ctl failed: %m\n"));
+	return false;
+    }
+    return true;
+}
+
+// Accept a new connection and send it our CONFIG message. Its messages
+// are then handled by whichever thread is free when they arrive.
+void fal_threads::accept_connection()
+{
+    struct dnet_session session;
+    int    sockfd;
+
+    sockfd = dnet_daemon_accept(listenfd, &session);
+    if (sockfd == -1) return;
+
+    connection *c = new connection;
+    c->conn = NULL;
+    c->server = NULL;
+    c->params = params;
+    c->params.threaded = true;
+    c->params.uid = session.uid;
+    c->params.gid = session.gid;
+    c->params.groups = c->groups;
+    c->params.ngroups = MAX_GROUPS;
+    if (getgrouplist(session.user, session.gid,
+		     c->groups, &c->params.ngroups) == -1)
+    {
+	DAPLOG((LOG_WARNING, "%s is in too many groups, only using %d\n",
+		session.user, MAX_GROUPS));
+	c->params.ngroups = MAX_GROUPS;
+    }
+    strcpy(c->home, session.home);
+
+    // Look for a local conversion override
+    if (allow_user_override && become_user(c))
+	fal_task::check_local_auto_type(c->params, verbose);
+    become_root();
+
+    dnet_accept(sockfd, 0, NULL, 0);
+    c->conn = new dap_connection(sockfd, 65535, verbose);
+    c->server = new fal_server(*c->conn, c->params);
+
+    if (!c->server->start() ||
+	!wait_for(sockfd, c, EPOLL_CTL_ADD))
+	finish(c);
+}
+
+// Make this thread's file accesses those of the connection's user and
+// go to their home directory.
+bool fal_threads::become_user(connection *c)
+{
+    setfsgid(c->params.gid);
+    if (thread_setgroups(c->params.ngroups, c->groups) == -1)
+    {
+	DAPLOG((LOG_ERR, "setgroups failed: %m\n"));
+	return false;
+    }
+
+    // setfsuid() returns the old fsuid, even on failure, so ask again
+    setfsuid(c->params.uid);
+    if ((uid_t)setfsuid(c->params.uid) != c->params.uid)
+    {
+	DAPLOG((LOG_ERR, "setfsuid failed\n"));
+	return false;
+    }
+
+    if (chdir(c->home))
+    {
+	DAPLOG((LOG_WARNING, "Cannot chdir to %s : %m\n", c->home));
+	chdir("/");
+    }
+    return true;
+}
+
+// Back to root so we can accept the next connection
+void fal_threads::become_root()
+{
+    setfsuid(0);
+    setfsgid(0);
+    thread_setgroups(0, NULL);
+}
+
+// Tidy up a connection that has finished. Closing the socket takes it
+// out of the epoll set.
+void fal_threads::finish(connection *c)
+{
+    if (c->server)
+    {
+	c->server->closedown();
+	delete c->server;
+    }
+    if (c->conn)
+    {
+	c->conn->set_blocked(false);
+	delete c->conn;
+    }
+    delete c;
+
+    if (verbose) fal_typecache::log_stats();
+}
@@ -0,0 +1,46 @@
+// Threaded FAL server (-T).
+//
+// Rather than fork a process for each connection, one process holds all
+// of them and a fixed number of threads runs their fal_servers. The
+// connections (and the listening socket) are kept in an epoll set and a
+// thread takes whichever one is ready, handles the messages that have
+// arrived on it and puts it back.
+//
+// Each thread has its own current directory and switches its filesystem
+// uid, gid and groups to the connection's user while working on it, so
+// files are created and checked as that user just as in a forked FAL.
+
+class fal_threads
+{
+ public:
+    fal_threads(int listenfd, fal_params &p, bool user_override);
+    ~fal_threads();
+    bool run(int num_threads);
+
+ private:
+    static const int MAX_GROUPS = 256;
+
+    struct connection
+    {
+	dap_connection *conn;
+	fal_server     *server;
+	fal_params      params;
+	char            home[PATH_MAX];
+	gid_t           groups[MAX_GROUPS];
+    };
+
+    static void *thread_start(void *);
+    void worker();
+    void accept_connection();
+    bool wait_for(int fd, connection *c, int op);
+    bool become_user(connection *c);
+    void become_root();
+    void finish(connection *c);
+
+    int          listenfd;
+    int          epollfd;
+    int          wakefd;
+    int          verbose;
+    bool         allow_user_override;
+    fal_params  &params;
+};
@@ -0,0 +1,142 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+// typecache.cc
+// Cache of file type classifications, shared between FAL processes.
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "logging.h"
+#include "typecache.h"
+
+fal_typecache::header *fal_typecache::table    = NULL;
+fal_typecache::entry  *fal_typecache::entries  = NULL;
+bool                   fal_typecache::disabled = false;
+
+// Create the table. Call this before forking so that the children all
+// share it. A size of zero turns the cache off.
+bool fal_typecache::init(unsigned int num_entries)
+{
+    if (num_entries == 0)
+    {
+	disabled = true;
+	return true;
+    }
+    if (num_entries > MAX_SIZE) num_entries = MAX_SIZE;
+
+    size_t len = sizeof(header) + num_entries*sizeof(entry);
+    void *mem = mmap(NULL, len, PROT_READ|PROT_WRITE,
+		     MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+	DAPLOG((LOG_WARNING, "Can't create file type cache: %m\n"));
+	disabled = true;
+	return false;
+    }
+
+    // mmap gives us zeros, which is an empty table
+    table = (header *)mem;
+    table->num_entries = num_entries;
+    entries = (entry *)(table+1);
+    return true;
+}
+
+// It's a direct-mapped table: each key has one place it can go and a
+// new entry simply replaces whatever was there.
+fal_typecache::entry *fal_typecache::slot(struct stat *st, int flags)
+{
+    unsigned long h;
+
+    if (disabled) return NULL;
+    if (!table && !init(DEFAULT_SIZE)) return NULL;
+
+    h = (unsigned long)st->st_ino * 2654435761UL;
+    h ^= (unsigned long)st->st_dev + (unsigned long)st->st_mtime + flags;
+    h ^= h >> 15;
+    return &entries[h % table->num_entries];
+}
+
+// 'flags' must not be zero
+bool fal_typecache::lookup(struct stat *st, int flags, fal_filetype &type)
+{
+    entry *e = slot(st, flags);
+    entry  copy;
+    unsigned int seq;
+
+    if (!e) return false;
+
+    // Take a copy and make sure nobody was writing it while we did
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    memcpy(&copy, e, sizeof(copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if ((seq & 1) || seq != __atomic_load_n(&e->seq, __ATOMIC_RELAXED) ||
+	copy.flags      != flags ||
+	copy.ino        != st->st_ino ||
+	copy.dev        != st->st_dev ||
+	copy.size       != st->st_size ||
+	copy.mtime      != st->st_mtim.tv_sec ||
+	copy.mtime_nsec != st->st_mtim.tv_nsec)
+    {
+	__atomic_fetch_add(&table->misses, 1, __ATOMIC_RELAXED);
+	return false;
+    }
+
+    __atomic_fetch_add(&table->hits, 1, __ATOMIC_RELAXED);
+    type = copy.type;
+    return true;
+}
+
+// If someone else is writing the slot just forget it, it's only a cache.
+void fal_typecache::store(struct stat *st, int flags, fal_filetype &type)
+{
+    entry *e = slot(st, flags);
+    unsigned int seq;
+
+    if (!e) return;
+
+    seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) ||
+	!__atomic_compare_exchange_n(&e->seq, &seq, seq+1, false,
+				     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	return;
+
+    e->flags      = flags;
+    e->dev        = st->st_dev;
+    e->ino        = st->st_ino;
+    e->size       = st->st_size;
+    e->mtime      = st->st_mtim.tv_sec;
+    e->mtime_nsec = st->st_mtim.tv_nsec;
+    e->type       = type;
+
+    __atomic_store_n(&e->seq, seq+2, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&table->stores, 1, __ATOMIC_RELAXED);
+}
+
+void fal_typecache::log_stats()
+{
+    if (!table) return;
+
+    unsigned long hits   = table->hits;
+    unsigned long misses = table->misses;
+
+    DAPLOG((LOG_INFO, "File type cache: %lu hits, %lu misses (%lu%% hit rate), %lu stored, %u entries\n",
+	    hits, misses, (hits+misses) ? hits*100/(hits+misses) : 0,
+	    table->stores, table->num_entries));
+}
@@ -0,0 +1,69 @@
+// typecache.h
+// Remembers how fake_file_type() classified a file so that listing a
+// directory or opening a file again doesn't mean reading it again.
+//
+// Entries are keyed on the file's device, inode, size and modification
+// time, plus the FAL options that change the answer, so a file that has
+// been modified is just looked up under a new key and the old entry is
+// eventually overwritten.
+//
+// The table is in shared memory created by the listener with init(), so
+// every process it forks (and every thread) uses the same one. Each
+// entry has its own sequence number which makes it safe to read while
+// another process is writing it, and a process that dies half way
+// through writing can never leave a lock held.
+
+// The parts of an ATTRIB message that fake_file_type() can change
+struct fal_filetype
+{
+    unsigned char  found;         // fake_file_type() returned true
+    unsigned char  send_records;
+    unsigned char  rfm;
+    unsigned char  have_mrs;
+    unsigned char  have_lrl;
+    unsigned char  have_block_size;
+    unsigned char  from_metafile;
+    unsigned int   rat;
+    unsigned short mrs;
+    unsigned short lrl;
+    unsigned int   block_size;
+};
+
+class fal_typecache
+{
+ public:
+    static bool init(unsigned int num_entries);
+    static bool lookup(struct stat *st, int flags, fal_filetype &type);
+    static void store(struct stat *st, int flags, fal_filetype &type);
+    static void log_stats();
+
+    static const unsigned int DEFAULT_SIZE = 4096;
+    static const unsigned int MAX_SIZE     = 1024*1024;
+
+ private:
+    struct header
+    {
+	unsigned int  num_entries;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long stores;
+    };
+
+    struct entry
+    {
+	unsigned int   seq;       // Odd while the entry is being written
+	int            flags;     // 0 means the slot is empty
+	dev_t          dev;
+	ino_t          ino;
+	off_t          size;
+	time_t         mtime;
+	long           mtime_nsec;
+	fal_filetype   type;
+    };
+
+    static header *table;
+    static entry  *entries;
+    static bool    disabled;
+
+    static entry *slot(struct stat *st, int flags);
+};
@@ -0,0 +1,117 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ ******************************************************************************
+ */
+// wildcard.cc
+// Compiled file name patterns.
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include "wildcard.h"
+
+// Split the pattern up at the '*'s. VMS wildcards have already been
+// converted so all we ever see from VMS is '*' and '?'.
+fal_wildcard::fal_wildcard(const char *p):
+    segments(NULL),
+    num_segments(0),
+    use_fnmatch(false),
+    has_star(false),
+    min_len(0)
+{
+    pattern = strdup(p);
+    literal_dot = (p[0] == '.');
+
+    if (strpbrk(p, "[\\"))
+    {
+	use_fnmatch = true;
+	return;
+    }
+
+    segments = new segment[strlen(p)+1];
+
+    const char *s = pattern;
+    for (;;)
+    {
+	const char *star = strchr(s, '*');
+	int len = star ? star-s : strlen(s);
+
+	segments[num_segments].text = s;
+	segments[num_segments].len  = len;
+	num_segments++;
+	min_len += len;
+
+	if (!star) break;
+	has_star = true;
+
+	// Several stars together are the same as one
+	while (*star == '*') star++;
+	s = star;
+    }
+}
+
+fal_wildcard::~fal_wildcard()
+{
+    free(pattern);
+    delete[] segments;
+}
+
+bool fal_wildcard::match_segment(const segment &seg, const char *name)
+{
+    for (int i=0; i<seg.len; i++)
+    {
+	if (seg.text[i] != '?' && seg.text[i] != name[i])
+	    return false;
+    }
+    return true;
+}
+
+bool fal_wildcard::match(const char *name)
+{
+    if (use_fnmatch)
+	return fnmatch(pattern, name, FNM_PERIOD) == 0;
+
+    // A leading dot must be matched by a dot
+    if (name[0] == '.' && !literal_dot)
+	return false;
+
+    int len = strlen(name);
+    if (len < min_len)
+	return false;
+
+    if (!has_star)
+	return len == segments[0].len && match_segment(segments[0], name);
+
+    // The first bit must be at the start and the last bit at the end...
+    segment &first = segments[0];
+    segment &last  = segments[num_segments-1];
+    if (!match_segment(first, name) ||
+	!match_segment(last, name + len - last.len))
+	return false;
+
+    // ...and everything in between anywhere between them, in order.
+    // Taking the first place each one fits leaves the most room for
+    // the rest.
+    const char *pos = name + first.len;
+    const char *end = name + len - last.len;
+    for (int i=1; i<num_segments-1; i++)
+    {
+	while (pos + segments[i].len <= end &&
+	       !match_segment(segments[i], pos))
+	    pos++;
+	if (pos + segments[i].len > end)
+	    return false;
+	pos += segments[i].len;
+    }
+    return true;
+}
@@ -0,0 +1,32 @@
+// wildcard.h
+// A file name pattern that has been taken apart once so that it can be
+// matched against every name in a directory without parsing it again.
+// It behaves like fnmatch(pattern, name, FNM_PERIOD) and, for patterns
+// with [sets] or escapes in them, actually is.
+
+class fal_wildcard
+{
+ public:
+    fal_wildcard(const char *pattern);
+    ~fal_wildcard();
+
+    bool match(const char *name);
+
+ private:
+    // The bits of the pattern between the stars
+    struct segment
+    {
+	const char *text;
+	int         len;
+    };
+
+    char    *pattern;
+    segment *segments;
+    int      num_segments;
+    bool     use_fnmatch;
+    bool     has_star;
+    bool     literal_dot;    // Pattern starts with '.'
+    int      min_len;
+
+    bool match_segment(const segment &, const char *);
+};
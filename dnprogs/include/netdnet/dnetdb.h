@@ -2,6 +2,8 @@
 #ifndef NETDNET_DNLIB_H
 #define NETDNET_DNLIB_H
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -10,6 +12,14 @@ extern "C"
 // forward declaration. This is in <netdnet/dn.h>.
 struct sockaddr_dn;
 
+/* Who an incoming connection runs as, filled in by dnet_daemon_accept() */
+struct dnet_session {
+	uid_t	uid;
+	gid_t	gid;
+	char	user[65];
+	char	home[4096];
+};
+
 struct	nodeent	{
 	char	*n_name;		/* name of node */
 	unsigned short n_addrtype;	/* node address type */
@@ -19,17 +29,39 @@ struct	nodeent	{
 	unsigned char	n_reserved[16];	/* reserved */
 };
 
+/* A connection for dnet_conn_many() to make */
+struct dnet_conn_target {
+	char		*node;		/* As for dnet_conn() */
+	char		*object;
+	int		fd;		/* Connected socket or -1 */
+	int		error;		/* errno if it failed */
+	int		reason;		/* DNSTAT_ code if rejected, or -1 */
+};
+
 /* DECnet database & utility functions on libdnet */
 extern  struct  dn_naddr *dnet_addr(char *cp);
 extern  int               dnet_conn(char *node, char *object, int type, 
                                 unsigned char *opt_out, int opt_outl, 
                                 unsigned char *opt_in, int *opt_inl);
+extern  int               dnet_conn_start(char *node, char *object, int type,
+                                unsigned char *opt_out, int opt_outl, int *reason);
+extern  int               dnet_conn_finish(int s, unsigned char *opt_in,
+                                int *opt_inl, int *reason);
+extern  int               dnet_conn_many(struct dnet_conn_target *targets, int num,
+                                int type, int max_parallel, int timeout_ms);
 extern  char             *dnet_htoa(struct dn_naddr *add);
 extern  char             *dnet_ntoa(struct dn_naddr *add);
 extern  struct  dn_naddr *getnodeadd(void);
 extern  struct  nodeent  *getnodebyaddr(const char *addr, int len, int type);
 extern  struct  nodeent  *getnodebyname(const char *name);
 
+/* Reentrant versions, results are put in the caller's buffer */
+extern  char             *dnet_htoa_r(struct dn_naddr *add, char *buf, size_t buflen);
+extern  struct  nodeent  *getnodebyaddr_r(const char *addr, int len, int type,
+                                struct nodeent *ne, char *buf, size_t buflen);
+extern  struct  nodeent  *getnodebyname_r(const char *name,
+                                struct nodeent *ne, char *buf, size_t buflen);
+
 extern  int               dnet_setobjhinum_handling(int handling, int min);
 extern  int               getobjectbyname(const char * name);
 extern  int               getobjectbynumber(int number, char * name, size_t name_len);
@@ -50,6 +82,11 @@ extern int   dnet_daemon(int object, char *named_object,
 extern void  dnet_accept(int sockfd, short status, char *data, int len);
 extern void  dnet_reject(int sockfd, short status, char *data, int len);
 extern void  dnet_set_optdata(char *data, int len);
+extern void  dnet_set_prefork(int workers, int sessions);
+extern int   dnet_daemon_listen(int object, char *named_object,
+				int verbosity, int do_fork);
+extern int   dnet_daemon_accept(int listenfd, struct dnet_session *session);
+extern int   dnet_daemon_shutdown(void);
 extern char *dnet_daemon_name(void);
 extern int   getnodename(char *, size_t);
 extern int   setnodename(char *, size_t);
@@ -49,6 +49,7 @@
 #define FALSE 0
 #endif
 #define MAX_FORKS 10
+#define WORKER_SESSIONS 100
 typedef int bool;
 
 #define NODE_LENGTH 20
@@ -57,6 +58,13 @@ typedef int bool;
 #define ALLOW_FILE      SYSCONF_PREFIX "/etc/nodes.allow"
 #define DENY_FILE       SYSCONF_PREFIX "/etc/nodes.deny"
 
+#define PROXY_HASH_SIZE 256
+
+// How a node or user field of a proxy entry is matched
+#define PROXY_REGEX 0 // A real regular expression
+#define PROXY_EXACT 1 // ^name$, compared as a (case blind) string
+#define PROXY_ANY   2 // .* matches anything
+
 // Structure of an item in the DECnet proxy database
 // These lengths are generous to allow for regular expressions
 struct proxy
@@ -65,10 +73,19 @@ struct proxy
     char remuser[USERNAME_LENGTH];
     char localuser[USERNAME_LENGTH];
 
+    // For PROXY_EXACT fields, the name without the anchors
+    char node_lit[NODE_LENGTH];
+    char remuser_lit[USERNAME_LENGTH];
+
+    int  node_type;
+    int  remuser_type;
+    int  index; // Position in the file
+
     regex_t node_r;
     regex_t remuser_r;
 
-    struct proxy *next;
+    struct proxy *next;         // All entries in file order
+    struct proxy *search_next;  // Next in the same hash chain or pattern list
 };
 
 // Object definition from dnetd.conf
@@ -85,6 +102,12 @@ struct object
 };
 
 static struct proxy  *proxy_db  = NULL;
+static struct proxy  *proxy_hash[PROXY_HASH_SIZE]; // Entries with an exact node
+static struct proxy  *proxy_patterns = NULL;       // All the others
+static regex_t        proxy_combined;  // All node regexps in proxy_patterns
+static bool           have_combined = FALSE;
+static bool           proxy_loaded  = FALSE;
+static struct stat    proxy_stat;
 static struct object *object_db = NULL;
 static struct object *thisobj   = NULL;
 static const char *proxy_filename = SYSCONF_PREFIX "/etc/decnet.proxy";
@@ -96,16 +119,39 @@ static struct optdata_dn optdata;
 static bool have_optdata = FALSE;
 static char *lasterror="";
 
+// Pre-forked worker pool. The workers stay root and take accepted
+// sockets from the listener over pool_sock so that the password checks
+// happen in parallel with the next accept().
+static int   pool_workers  = 0;
+static int   pool_sessions = WORKER_SESSIONS;
+static pid_t *worker_pids  = NULL;
+static int   pool_sock[2]  = {-1, -1};
+static bool  is_worker     = FALSE;
+static bool volatile worker_died = FALSE;
+
 // Catch child process shutdown
 static void sigchild(int s)
 {
-    int status, pid;
+    int status, pid, i;
 
     // Make sure we reap all children
     do
     {
 	pid = waitpid(-1, &status, WNOHANG);
 	if (pid > 0 && verbose) DNETLOG((LOG_INFO, "Reaped child process %d\n", pid));
+
+	// Note any workers that need replacing
+	if (pid > 0 && worker_pids && !is_worker)
+	{
+	    for (i=0; i<pool_workers; i++)
+	    {
+		if (worker_pids[i] == pid)
+		{
+		    worker_pids[i] = 0;
+		    worker_died = TRUE;
+		}
+	    }
+	}
     }
     while (pid > 0);
 }
@@ -126,6 +172,82 @@ static void makelower(char *s)
 }
 
 
+// Work out how a proxy field needs to be matched. Most entries are
+// anchored names (as the documentation tells people to write them) or
+// ".*" and don't need a regexp at all.
+static int pattern_type(const char *re, char *literal)
+{
+    int len = strlen(re);
+
+    if (len == 0 || !strcmp(re, ".*") || !strcmp(re, "^.*$") ||
+	!strcmp(re, "^.*") || !strcmp(re, ".*$"))
+	return PROXY_ANY;
+
+    if (len > 2 && re[0] == '^' && re[len-1] == '$')
+    {
+	int i;
+
+	for (i=1; i<len-1; i++)
+	{
+	    if (strchr(".[]\\*^$", re[i]))
+		return PROXY_REGEX;
+	}
+	memcpy(literal, re+1, len-2);
+	literal[len-2] = '\0';
+	makelower(literal);
+	return PROXY_EXACT;
+    }
+    return PROXY_REGEX;
+}
+
+// Hash a (lower case) node name
+static unsigned int proxy_hash_name(const char *name)
+{
+    unsigned int h = 0;
+
+    while (*name)
+	h = h*31 + (unsigned char)*name++;
+    return h % PROXY_HASH_SIZE;
+}
+
+// Build one regexp out of all the node regexps in the pattern list so
+// that we can tell with a single regexec() when none of them can match.
+// POSIX can't tell us which one matched so we still need the list after
+// that. Patterns with back references can't be joined together.
+static void compile_combined(void)
+{
+    struct proxy *p;
+    char *combined;
+    int   len = 1;
+
+    for (p = proxy_patterns; p; p = p->search_next)
+    {
+	char *bs;
+
+	if (p->node_type != PROXY_REGEX) continue;
+	for (bs = strchr(p->node, '\\'); bs; bs = strchr(bs+2, '\\'))
+	{
+	    if (isdigit(bs[1])) return;
+	    if (!bs[1]) break;
+	}
+	len += strlen(p->node) + 2;
+    }
+    if (len == 1) return;
+
+    combined = malloc(len);
+    combined[0] = '\0';
+    for (p = proxy_patterns; p; p = p->search_next)
+    {
+	if (p->node_type != PROXY_REGEX) continue;
+	if (combined[0]) strcat(combined, "\\|");
+	strcat(combined, p->node);
+    }
+
+    if (regcomp(&proxy_combined, combined, REG_ICASE | REG_NOSUB) == 0)
+	have_combined = TRUE;
+    free(combined);
+}
+
 // Read the proxy database into memory
 static void load_proxy_database(void)
 {
@@ -134,6 +256,8 @@ static void load_proxy_database(void)
     int           line;
     struct proxy *new_proxy;
     struct proxy *last_proxy = NULL;
+    struct proxy *last_pattern = NULL;
+    struct proxy **searchp;
 
     f = fopen(proxy_filename, "r");
     if (!f)
@@ -214,17 +338,27 @@ static void load_proxy_database(void)
 	    strcpy(new_proxy->node, bufp);
 	    strcpy(new_proxy->remuser, colons+2);
 	    strcpy(new_proxy->localuser, local);
+	    new_proxy->index = line;
+
+	    // Compile the regular expressions, if they really are
+	    new_proxy->node_type = pattern_type(new_proxy->node,
+						new_proxy->node_lit);
+	    new_proxy->remuser_type = pattern_type(new_proxy->remuser,
+						   new_proxy->remuser_lit);
 
-	    // Compile the regular expressions
-	    if (regcomp(&new_proxy->node_r, new_proxy->node, REG_ICASE))
+	    if (new_proxy->node_type == PROXY_REGEX &&
+		regcomp(&new_proxy->node_r, new_proxy->node, REG_ICASE))
 	    {
 		DNETLOG((LOG_ERR, "Error on line %d of proxy file: node regexp is invalid\n", line));
 		free(new_proxy);
 		continue;
 	    }
-	    if (regcomp(&new_proxy->remuser_r, new_proxy->remuser, REG_ICASE))
+	    if (new_proxy->remuser_type == PROXY_REGEX &&
+		regcomp(&new_proxy->remuser_r, new_proxy->remuser, REG_ICASE))
 	    {
 		DNETLOG((LOG_ERR, "Error on line %d of proxy file: remote user regexp is invalid\n", line));
+		if (new_proxy->node_type == PROXY_REGEX)
+		    regfree(&new_proxy->node_r);
 		free(new_proxy);
 		continue;
 	    }
@@ -239,6 +373,22 @@ static void load_proxy_database(void)
 		proxy_db = new_proxy;
 	    }
 	    last_proxy = new_proxy;
+
+	    // ...and to the hash chain or pattern list, keeping file order
+	    if (new_proxy->node_type == PROXY_EXACT)
+	    {
+		searchp = &proxy_hash[proxy_hash_name(new_proxy->node_lit)];
+		while (*searchp) searchp = &(*searchp)->search_next;
+		*searchp = new_proxy;
+	    }
+	    else
+	    {
+		if (last_pattern)
+		    last_pattern->search_next = new_proxy;
+		else
+		    proxy_patterns = new_proxy;
+		last_pattern = new_proxy;
+	    }
 	}
 	else
 	{
@@ -247,6 +397,8 @@ static void load_proxy_database(void)
 	}
     }
     fclose(f);
+
+    compile_combined();
 }
 
 
@@ -258,13 +410,18 @@ static void free_proxy(void)
 
     while (p)
     {
-	regfree(&p->node_r);
-	regfree(&p->remuser_r);
+	if (p->node_type == PROXY_REGEX) regfree(&p->node_r);
+	if (p->remuser_type == PROXY_REGEX) regfree(&p->remuser_r);
 	next_p=p->next;
 	free(p);
 	p=next_p;
     }
     proxy_db = NULL;
+    proxy_patterns = NULL;
+    memset(proxy_hash, 0, sizeof(proxy_hash));
+
+    if (have_combined) regfree(&proxy_combined);
+    have_combined = FALSE;
 }
 
 // Always returns false. Sets the error string to strerror(errno)
@@ -276,73 +433,114 @@ static bool error_return(char *txt)
 }
 
 
+// Re-read the proxy database if it has changed since we last read it.
+static void refresh_proxy_database(void)
+{
+    struct stat st;
+
+    if (stat(proxy_filename, &st) == 0 && proxy_loaded &&
+	st.st_dev   == proxy_stat.st_dev &&
+	st.st_ino   == proxy_stat.st_ino &&
+	st.st_size  == proxy_stat.st_size &&
+	st.st_mtime == proxy_stat.st_mtime &&
+	st.st_ctime == proxy_stat.st_ctime)
+	return;
+
+    if (verbose > 1 && proxy_loaded) DNETLOG((LOG_INFO, "Proxy database has changed, re-reading it\n"));
+
+    free_proxy();
+    load_proxy_database();
+
+    // If we can't stat it then try again next time
+    proxy_loaded = (stat(proxy_filename, &proxy_stat) == 0);
+}
+
+// Does the remote user match this proxy entry ?
+static bool proxy_user_matches(struct proxy *p, char *remoteuser)
+{
+    switch (p->remuser_type)
+    {
+    case PROXY_ANY:
+	return TRUE;
+    case PROXY_EXACT:
+	return strcasecmp(p->remuser_lit, remoteuser) == 0;
+    default:
+	return regexec(&p->remuser_r, remoteuser, 0, NULL, 0) == 0;
+    }
+}
+
 // Check the proxy database for authentication
 static bool check_proxy_database(char *nodename,
 				 char *remoteuser,
 				 char *localuser)
 {
-    bool found = FALSE;
+    struct proxy *found = NULL;
     struct proxy *p;
+    char          lnode[NODE_LENGTH];
+    bool          try_regex;
 
-// Re-read the proxy database 'cos it has changed.
-    free_proxy();
-    load_proxy_database();
+    refresh_proxy_database();
 
-    // Look for the user and nodename in the list
-    p = proxy_db;
+    // Entries for this exact node name. These are in file order so the
+    // first one that matches is the one we want, unless there's an
+    // earlier pattern that matches too.
+    strcpy(lnode, nodename);
+    makelower(lnode);
+    for (p = proxy_hash[proxy_hash_name(lnode)]; p; p = p->search_next)
+    {
+	if (!strcmp(p->node_lit, lnode) && proxy_user_matches(p, remoteuser))
+	{
+	    found = p;
+	    break;
+	}
+    }
 
-    while (p && !found)
+    // Look for the user and nodename in the other entries
+    try_regex = !have_combined ||
+	regexec(&proxy_combined, nodename, 0, NULL, 0) == 0;
+
+    for (p = proxy_patterns; p && (!found || p->index < found->index);
+	 p = p->search_next)
     {
-	if (regexec(&p->node_r, nodename, 0, NULL, 0) == 0 &&
-	    regexec(&p->remuser_r, remoteuser, 0, NULL, 0) == 0)
+	if (p->node_type == PROXY_REGEX &&
+	    (!try_regex || regexec(&p->node_r, nodename, 0, NULL, 0) != 0))
+	    continue;
+
+	if (proxy_user_matches(p, remoteuser))
 	{
-	    found = TRUE;
-	    if (p->localuser[0] == '*')
-	    {
-		strcpy(localuser, remoteuser);
-	    }
-	    else
-	    {
-		strcpy(localuser, p->localuser);
-	    }
-	    if (verbose > 1) DNETLOG((LOG_INFO, "Using proxy name %s\n", localuser));
+	    found = p;
+	    break;
 	}
-	p = p->next;
     }
-    return found;
+
+    if (found)
+    {
+	if (found->localuser[0] == '*')
+	{
+	    strcpy(localuser, remoteuser);
+	}
+	else
+	{
+	    strcpy(localuser, found->localuser);
+	}
+	if (verbose > 1) DNETLOG((LOG_INFO, "Using proxy name %s\n", localuser));
+    }
+    return found != NULL;
 }
 
 //
-// Wait for an incoming connection
+// Wait for an incoming connection. flags are as for accept4().
 // Returns a new fd or -1
-static int waitfor(int sockfd)
+static int waitfor(int sockfd, int flags)
 {
-    int                  status;
     int                  newsock;
     unsigned int         len;
     struct sockaddr_dn	 sockaddr;
-    static bool listening = FALSE;
-
-    memset(&sockaddr, 0, sizeof(sockaddr));
-
-    // Set up the listing context
-    if (!listening)
-    {
-	status = listen(sockfd, 5);
-	if (status)
-	{
-	    snprintf(errstring, sizeof(errstring),
-		     "listen failed: %s", strerror(errno));
-	    lasterror = errstring;
-	    return -1;
-	}
-	listening = TRUE;
-    }
 
     // Wait for a connection
     memset(&sockaddr, 0, sizeof(sockaddr));
     len = sizeof(sockaddr);
-    newsock = accept(sockfd, (struct sockaddr *)&sockaddr, &len);
+    newsock = accept4(sockfd, (struct sockaddr *)&sockaddr, &len, flags);
     if (newsock < 0 && errno != EINTR)
     {
         snprintf(errstring, sizeof(errstring),
@@ -359,10 +557,10 @@ static int waitfor(int sockfd)
 }
 
 
-// No prizes for guessing what this does.
-// Returns are as for the syscall fork().
-// Actually, it also sets the current directory too.
-static int fork_and_setuid(int sockfd)
+// Check the username & password or proxy of an incoming connection and
+// work out who it should run as. The connection is rejected if it fails.
+// Returns 0 if all is well or -1.
+static int check_access(int sockfd, struct dnet_session *session)
 {
     struct  accessdata_dn accessdata;
     char   *cryptpass;
@@ -374,9 +572,6 @@ static int fork_and_setuid(int sockfd)
     unsigned int len = sizeof(accessdata);
     int      er;
     unsigned int namlen = sizeof(sockaddr);
-    pid_t   newpid;
-    uid_t   newuid;
-    gid_t   newgid;
     bool    use_proxy;
     struct  passwd *pw;
     int     have_shadow = -1;
@@ -428,6 +623,7 @@ static int fork_and_setuid(int sockfd)
         snprintf(errstring, sizeof(errstring),
 		 "getsockopt failed: %s", strerror(errno));
 	lasterror = errstring;
+	dnet_reject(sockfd, DNSTAT_FAILED, NULL, 0);
 	return -1;
     }
     memcpy(username, accessdata.acc_user, accessdata.acc_userl);
@@ -509,8 +705,10 @@ static int fork_and_setuid(int sockfd)
 	dnet_reject(sockfd, DNSTAT_ACCCONTROL, NULL, 0);
 	return -1;
     }
-    newuid = pw->pw_uid;
-    newgid = pw->pw_gid;
+    session->uid = pw->pw_uid;
+    session->gid = pw->pw_gid;
+    strcpy(session->user, username);
+    snprintf(session->home, sizeof(session->home), "%s", pw->pw_dir);
 
 // If we are using a proxy then we don't need to verify the password
     if (!use_proxy)
@@ -580,6 +778,19 @@ static int fork_and_setuid(int sockfd)
 	    }
 	}
     }
+    return 0;
+}
+
+// No prizes for guessing what this does.
+// Returns are as for the syscall fork().
+// Actually, it also sets the current directory too.
+static int fork_and_setuid(int sockfd)
+{
+    struct dnet_session session;
+    pid_t  newpid;
+
+    if (check_access(sockfd, &session) == -1)
+	return -1;
 
 // NO_FORK is just for testing. It creates a single-shot server that is
 // easier to debug.
@@ -599,25 +810,25 @@ static int fork_and_setuid(int sockfd)
 
     case 0: // Child
 #ifndef NO_FORK
-        if (initgroups(username, newgid) < 0)
+        if (initgroups(session.user, session.gid) < 0)
 	{
 	    error_return("init groups failed");
 	    return -1;
 	}
-	if (setgid(newgid) < 0)
+	if (setgid(session.gid) < 0)
 	{
 	    error_return("setgid failed");
 	    return -1;
 	}
-	if (setuid(newuid) < 0)
+	if (setuid(session.uid) < 0)
 	{
 	    error_return("setuid failed");
 	    return -1;
 	}
 #endif
-	if (chdir(pw->pw_dir))
+	if (chdir(session.home))
 	{
-	    DNETLOG((LOG_WARNING, "Cannot chdir to %s : %m\n", pw->pw_dir));
+	    DNETLOG((LOG_WARNING, "Cannot chdir to %s : %m\n", session.home));
 	    chdir("/");
 	}
 	break;
@@ -828,42 +1039,259 @@ bool bind_wild(int sockfd)
 }
 
 
-// Called by DECnet daemons. If stdin is already a DECnet socket then
-// just return 0 (stdin's file descriptor). otherwise we
-// bind to the object and wait. When we get a connection we fork
-// and (optionally) setuid, and return. The parent then loops back (ie it
-// never returns).
-//
-// This is the keystone of all DECnet daemons that can be called from dnetd
-//
-int dnet_daemon(int object, char *named_object,
-		int verbosity, bool do_fork)
+// Check an incoming connection against nodes.allow/deny.
+// Returns FALSE if it has been rejected.
+static bool check_nodes(int newone)
 {
     struct sockaddr_dn  sa, remotesa;
-    unsigned int        namelen = sizeof(struct sockaddr_dn);
-    bool                bind_status  = FALSE;
-    pid_t               pid;
-    int                 sockfd;
-    int                 acceptmode;
-    int                 i;
-    struct              sigaction siga;
-    sigset_t            ss;
+    unsigned int        namelen;
     const char        * proc = NULL;
 
-    memset(&sa, 0, sizeof(sa));
+    // check /etc/nodes.{allow,deny} if connection is allowed
+    namelen = sizeof(remotesa);
 
-// Are we the execed child of dnetd?
-    if (getsockname(STDIN_FILENO, (struct sockaddr *)&sa, &namelen) == 0)
+    if (getsockname(newone, (struct sockaddr *)&sa, &namelen) == -1) {
+	dnet_reject(newone, DNSTAT_FAILED, NULL, 0);
+	DNETLOG((LOG_ALERT, "Can not read local sockname\n"));
+    }
+
+    namelen = sizeof(remotesa);
+
+    if ( getpeername(newone, (struct sockaddr *) &remotesa, &namelen) == -1 ) {
+	dnet_reject(newone, DNSTAT_FAILED, NULL, 0);
+	DNETLOG((LOG_ALERT, "Can not read peers sockname\n"));
+	return FALSE;
+    }
+
+    // first we check if we do not have a allow match, if we have we can continue.
+    // if we don't have one we need to check the deny list.
+    if ( dnet_priv_check(ALLOW_FILE, proc, &sa, &remotesa) != 1 ) {
+	// check deny list.
+	// if we have a nodes.deny file we continue, if we don't we ignore it.
+	// we check for file existance not readability here to avoid
+	// errors by wrong file permittions and such.
+	if ( access(DENY_FILE, F_OK) == 0 ) {
+	    // check the file itself. We do not reject in case of no match (0).
+	    // in case of match (1) or error (-1) we reject.
+	    if ( dnet_priv_check(DENY_FILE, proc, &sa, &remotesa) != 0 ) {
+		dnet_reject(newone, DNSTAT_ACCCONTROL, NULL, 0);
+		return FALSE;
+	    }
+	}
+    }
+    return TRUE;
+}
+
+// Check an incoming connection against nodes.allow/deny and the
+// password or proxy database then fork a process for it.
+// Returns 0 in the child, -1 if the connection was refused or the
+// child's pid in the parent. The socket is closed in the parent.
+static int start_session(int newone)
+{
+    int fork_fail = 0;
+    int ret;
+
+    if (!check_nodes(newone)) return -1;
+
+    // load dnetd's object databse if we don't have it already loaded.
+    if (!object_db) load_dnetd_conf();
+
+    ret = fork_and_setuid(newone);
+
+    switch (ret)
     {
-	if (sa.sdn_family != AF_DECnet)
+    case -1:
+	if (++fork_fail > MAX_FORKS)
 	{
-	    // Argh, a socket but not a DECnet one!!!!!
-	    DNETLOG((LOG_ERR, "Got connection from socket of type %d. This is a bad configuration error\n", sa.sdn_family));
+	    DNETLOG((LOG_ALERT, "fork failed too often. giving up\n"));
+	    exit(100);
+	}
+
+	// Oh no, it all went horribly wrong.
+	DNETLOG((LOG_ERR, "Fork_and_setuid failed: %s\n", lasterror));
+	close(newone);
+	break;
+
+    case 0: // child
+	if (object_db && thisobj != NULL) {
+	    // check if we are going to do auto accept or reject.
+	    switch (thisobj->auto_accept) {
+		case  1:
+		    dnet_accept(newone, 0, NULL, 0);
+		    break;
+		case -1:
+		    dnet_reject(newone, DNSTAT_REJECTED, NULL, 0);
+		    exit(101);
+		    break;
+	    }
+	}
+	break;
+
+    default: // parent, just tidy up
+	close(newone);
+	break;
+    }
+    return ret;
+}
+
+// Pass an accepted socket to whichever worker is waiting for one.
+static bool send_to_worker(int newone)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    char            cbuf[CMSG_SPACE(sizeof(int))];
+    char            c = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = &c;
+    iov.iov_len        = 1;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &newone, sizeof(int));
+
+    while (sendmsg(pool_sock[0], &msg, 0) < 0)
+    {
+	if (errno != EINTR) return FALSE;
+    }
+    return TRUE;
+}
+
+// Wait for the listener to pass us a socket.
+// Returns the socket, -1 on EINTR or -2 if the listener has gone away.
+static int receive_from_listener(void)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    char            cbuf[CMSG_SPACE(sizeof(int))];
+    char            c;
+    int             newone = -1;
+    int             status;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = &c;
+    iov.iov_len        = 1;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    status = recvmsg(pool_sock[1], &msg, 0);
+    if (status < 0 && errno == EINTR) return -1;
+    if (status <= 0) return -2;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	cmsg->cmsg_type == SCM_RIGHTS)
+	memcpy(&newone, CMSG_DATA(cmsg), sizeof(int));
+
+    return newone;
+}
+
+// A worker process. We sit here (as root) handing out sessions until
+// we've done pool_sessions of them and then exit so the listener can
+// start a fresh one. Returns the socket in a session's child process.
+static int worker_main(void)
+{
+    int sessions = 0;
+
+    is_worker = TRUE;
+    close(pool_sock[0]);
+
+    while (sessions < pool_sessions && !do_shutdown)
+    {
+	int newone = receive_from_listener();
+
+	if (newone == -1) continue;
+	if (newone == -2) break;
+
+	if (start_session(newone) == 0)
+	{
+	    close(pool_sock[1]);
+	    return newone;
+	}
+	sessions++;
+    }
+    if (verbose > 1) DNETLOG((LOG_INFO, "Worker %d exiting after %d sessions\n", getpid(), sessions));
+    exit(0);
+}
+
+// Start any workers that are not running. Returns -1 in the listener and
+// a connected socket in a session process forked from one of the workers.
+static int start_workers(int sockfd)
+{
+    int i;
+
+    if (!worker_pids)
+    {
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pool_sock) == -1)
+	{
+	    DNETLOG((LOG_ERR, "Can't create worker socket, not using a pool: %m\n"));
+	    pool_workers = 0;
 	    return -1;
 	}
-	if (verbosity) DNETLOG((LOG_INFO, "starting child process\n"));
-	return STDIN_FILENO;
+	worker_pids = calloc(pool_workers, sizeof(pid_t));
     }
+    worker_died = FALSE;
+
+    for (i=0; i<pool_workers; i++)
+    {
+	pid_t pid;
+
+	if (worker_pids[i]) continue;
+
+	switch ( pid=fork() )
+	{
+	case -1:
+	    DNETLOG((LOG_ERR, "Can't fork worker process: %m\n"));
+	    return -1;
+
+	case 0:
+	    close(sockfd);
+	    return worker_main();
+
+	default:
+	    worker_pids[i] = pid;
+	    if (verbose > 1) DNETLOG((LOG_INFO, "Started worker process %d\n", pid));
+	    break;
+	}
+    }
+    return -1;
+}
+
+// Ask dnet_daemon() to keep a pool of workers waiting for connections
+// rather than forking a new process from the listener for each one.
+// Each worker handles 'sessions' connections before it is replaced.
+void dnet_set_prefork(int workers, int sessions)
+{
+#ifndef NO_FORK
+    pool_workers  = workers>0?workers:0;
+    pool_sessions = sessions>0?sessions:WORKER_SESSIONS;
+#endif
+}
+
+// Start a standalone server: become a daemon (if do_fork is set), bind
+// to the object and listen on it. Returns the listening socket or -1.
+// dnet_daemon() does this for you, it's only needed by daemons that
+// call dnet_daemon_accept() to handle connections themselves.
+int dnet_daemon_listen(int object, char *named_object,
+		       int verbosity, bool do_fork)
+{
+    bool                bind_status  = FALSE;
+    pid_t               pid;
+    int                 sockfd;
+    int                 acceptmode;
+    int                 i;
+    struct              sigaction siga;
+    sigset_t            ss;
 
     // We need to start a server.
     if (getuid() != 0)
@@ -917,7 +1345,7 @@ int dnet_daemon(int object, char *named_object,
     verbose = verbosity;
 
     // Create the socket
-    if ((sockfd=socket(AF_DECnet,SOCK_SEQPACKET,DNPROTO_NSP)) == -1)
+    if ((sockfd=socket(AF_DECnet,SOCK_SEQPACKET|SOCK_CLOEXEC,DNPROTO_NSP)) == -1)
     {
         snprintf(errstring, sizeof(errstring), "socket failed: %s", strerror(errno));
 	lasterror = errstring;
@@ -953,92 +1381,126 @@ int dnet_daemon(int object, char *named_object,
 	return -1; // Can't bind
     }
 
+    if (listen(sockfd, 5))
+    {
+	snprintf(errstring, sizeof(errstring),
+		 "listen failed: %s", strerror(errno));
+	lasterror = errstring;
+	DNETLOG((LOG_ERR, "Can't listen: %m\n"));
+	return -1;
+    }
+
     if (verbose) DNETLOG((LOG_INFO, "Ready\n"));
+    return sockfd;
+}
 
-    // Main loop.
-    do
+// Wait for a connection on a socket from dnet_daemon_listen() and check
+// it as dnet_daemon() would, but don't fork or change user. 'session'
+// says who the connection should run as, it is up to the caller to
+// act on it. Returns the new socket or -1 if the connection was refused
+// (or we were interrupted). Not reentrant: only call it from one thread.
+int dnet_daemon_accept(int listenfd, struct dnet_session *session)
+{
+    int newone;
+
+    // Nothing a session runs should get hold of another one's link
+    newone = waitfor(listenfd, SOCK_CLOEXEC);
+    if (newone < 0) return -1;
+
+    if (!check_nodes(newone)) return -1;
+
+    if (!object_db) load_dnetd_conf();
+
+    // A refused connection has already been closed by dnet_reject()
+    if (check_access(newone, session) == -1)
     {
-	int fork_fail = 0;
-	int newone;
-	int ret;
+	DNETLOG((LOG_ERR, "Connection refused: %s\n", lasterror));
+	return -1;
+    }
 
-	// Wait for a new connection.
-	newone = waitfor(sockfd);
-	if (newone > -1)
+    if (object_db && thisobj != NULL)
+    {
+	switch (thisobj->auto_accept)
 	{
-	    // check /etc/nodes.{allow,deny} if connection is allowed
-	    namelen = sizeof(remotesa);
+	case  1:
+	    dnet_accept(newone, 0, NULL, 0);
+	    break;
+	case -1:
+	    dnet_reject(newone, DNSTAT_REJECTED, NULL, 0);
+	    return -1;
+	}
+    }
+    return newone;
+}
 
-	    if (getsockname(newone, (struct sockaddr *)&sa, &namelen) == -1) {
-		dnet_reject(newone, DNSTAT_FAILED, NULL, 0);
-		DNETLOG((LOG_ALERT, "Can not read local sockname\n"));
-	    }
 
-	    namelen = sizeof(remotesa);
+// Called by DECnet daemons. If stdin is already a DECnet socket then
+// just return 0 (stdin's file descriptor). otherwise we
+// bind to the object and wait. When we get a connection we fork
+// and (optionally) setuid, and return. The parent then loops back (ie it
+// never returns).
+//
+// This is the keystone of all DECnet daemons that can be called from dnetd
+//
+int dnet_daemon(int object, char *named_object,
+		int verbosity, bool do_fork)
+{
+    struct sockaddr_dn  sa;
+    unsigned int        namelen = sizeof(struct sockaddr_dn);
+    int                 sockfd;
 
-	    if ( getpeername(newone, (struct sockaddr *) &remotesa, &namelen) == -1 ) {
-		dnet_reject(newone, DNSTAT_FAILED, NULL, 0);
-		DNETLOG((LOG_ALERT, "Can not read peers sockname\n"));
-		continue;
-	    }
+    memset(&sa, 0, sizeof(sa));
 
-	    // first we check if we do not have a allow match, if we have we can continue.
-	    // if we don't have one we need to check the deny list.
-	    if ( dnet_priv_check(ALLOW_FILE, proc, &sa, &remotesa) != 1 ) {
-		// check deny list.
-		// if we have a nodes.deny file we continue, if we don't we ignore it.
-		// we check for file existance not readability here to avoid
-		// errors by wrong file permittions and such.
-		if ( access(DENY_FILE, F_OK) == 0 ) {
-		    // check the file itself. We do not reject in case of no match (0).
-		    // in case of match (1) or error (-1) we reject.
-		    if ( dnet_priv_check(DENY_FILE, proc, &sa, &remotesa) != 0 ) {
-			dnet_reject(newone, DNSTAT_ACCCONTROL, NULL, 0);
-			continue;
-		    }
-		}
-	    }
+// Are we the execed child of dnetd?
+    if (getsockname(STDIN_FILENO, (struct sockaddr *)&sa, &namelen) == 0)
+    {
+	if (sa.sdn_family != AF_DECnet)
+	{
+	    // Argh, a socket but not a DECnet one!!!!!
+	    DNETLOG((LOG_ERR, "Got connection from socket of type %d. This is a bad configuration error\n", sa.sdn_family));
+	    return -1;
+	}
+	if (verbosity) DNETLOG((LOG_INFO, "starting child process\n"));
+	return STDIN_FILENO;
+    }
 
-	    // load dnetd's object databse if we don't have it already loaded.
-	    if (!object_db) load_dnetd_conf();
+    sockfd = dnet_daemon_listen(object, named_object, verbosity, do_fork);
+    if (sockfd == -1) return -1;
 
-	    ret = fork_and_setuid(newone);
+    // load dnetd's object database now so the workers all have a copy
+    if (pool_workers && !object_db) load_dnetd_conf();
 
-	    switch (ret)
+    // Main loop.
+    do
+    {
+	int newone;
+	int ret;
+
+	// Replace any workers that have finished
+	if (pool_workers && (worker_died || !worker_pids))
+	{
+	    ret = start_workers(sockfd);
+	    if (ret > -1) return ret;
+	}
+
+	// Wait for a new connection.
+	newone = waitfor(sockfd, 0);
+	if (newone > -1)
+	{
+	    if (pool_workers)
 	    {
-	    case -1:
-		if (++fork_fail > MAX_FORKS)
+		if (!send_to_worker(newone))
 		{
-		    DNETLOG((LOG_ALERT, "fork failed too often. giving up\n"));
-		    exit(100);
+		    DNETLOG((LOG_ERR, "Can't pass connection to worker: %m\n"));
+		    dnet_reject(newone, DNSTAT_RESOURCES, NULL, 0);
+		    continue;
 		}
-
-		// Oh no, it all went horribly wrong.
-		DNETLOG((LOG_ERR, "Fork_and_setuid failed: %s\n", lasterror));
 		close(newone);
 		continue;
-
-	    case 0: // child
-		if (object_db && thisobj != NULL) {
-		    // check if we are going to do auto accept or reject.
-		    switch (thisobj->auto_accept) {
-			case  1:
-			    dnet_accept(newone, 0, NULL, 0);
-			    break;
-			case -1:
-			    dnet_reject(newone, DNSTAT_REJECTED, NULL, 0);
-			    exit(101);
-			    break;
-		    }
-		}
-		return newone;
-		break;
-
-	    default: // parent, just tidy up and loop back
-		fork_fail = 0;
-		close(newone);
-		break;
 	    }
+
+	    ret = start_session(newone);
+	    if (ret == 0) return newone;
 	}
     }
     while (!do_shutdown);
@@ -1081,6 +1543,14 @@ void dnet_reject(int sockfd, short status, char *data, int len)
     close(sockfd);
 }
 
+// True once SIGTERM has been caught by a server started with
+// dnet_daemon_listen(), so that daemons running their own accept loop
+// know to stop.
+int dnet_daemon_shutdown(void)
+{
+    return do_shutdown;
+}
+
 char *dnet_daemon_name(void)
 {
     if (thisobj)
@@ -70,7 +70,12 @@ dap_connection::dap_connection(int socket, int bs, int verbosity)
 // Generic initialisation process
 void dap_connection::initialise(int verbosity)
 {
-    buf       = new char[MAX_READ_SIZE];
+    memset(rx_refs, 0, sizeof(rx_refs));
+    rx_buf[0]   = new char[MAX_READ_SIZE];
+    num_rx_bufs = 1;
+    cur_buf     = 0;
+
+    buf       = rx_buf[0];
     bufptr    = 0;
     buflen    = 0;
 
@@ -113,7 +118,8 @@ void dap_connection::close()
         if (outbufptr && blocked) set_blocked(false);
         if (sockfd) ::close(sockfd);
 
-        delete[] buf;
+        for (int i=0; i<num_rx_bufs; i++)
+            delete[] rx_buf[i];
         delete[] outbuf;
         closed = true;
     }
@@ -340,6 +346,10 @@ int dap_connection::read(bool block)
     int flags=0;
     int saved_errno;
 
+    // Don't overwrite data that someone is still looking at
+    if (rx_refs[cur_buf] && !switch_buffer(0))
+	return false;
+
     if (!block)
     {
 	flags = fcntl(sockfd, F_GETFL, 0);
@@ -529,14 +539,24 @@ int  dap_connection::check_length(int needed)
 
     if (buflen < bufptr+needed)
     {
-	// The required buffer size
-	int reqd_length = needed;
 	int left = buflen - bufptr; /* what's left unread */
 
-	/* Move what we have to the start of the buffer */
-	memmove(buf, buf+bufptr, left);
+	if (rx_refs[cur_buf])
+	{
+	    /* Data in this buffer is held, start the message in another one */
+	    if (!switch_buffer(left)) return false;
+	}
+	else if (bufptr+needed > (int)MAX_READ_SIZE)
+	{
+	    /* Move what we have to the start of the buffer */
+	    memmove(buf, buf+bufptr, left);
+	    buflen = left;
+	    bufptr = 0;
+	}
+	/* otherwise the rest of the message fits where it is */
 
-	buflen = left;
+	// The required buffer size
+	int reqd_length = bufptr+needed;
 	while (buflen < reqd_length)
         {
 	  if (verbose > 2)
@@ -554,7 +574,6 @@ int  dap_connection::check_length(int needed)
 	   if (verbose > 2) DAPLOG((LOG_DEBUG, "check_length(): read %d bytes\n", readlen));
 	   buflen += readlen;
         }
-	bufptr=0;
     }
 
     // Use this to mark the end of the current DAP message.
@@ -564,6 +583,49 @@ int  dap_connection::check_length(int needed)
     return true;
 }
 
+// Move on to a receive buffer that nobody is holding, taking the last
+// 'keep' unread bytes of the current one with us.
+bool dap_connection::switch_buffer(int keep)
+{
+    int i;
+
+    for (i=0; i<num_rx_bufs; i++)
+    {
+	if (i != cur_buf && !rx_refs[i]) break;
+    }
+    if (i == num_rx_bufs)
+    {
+	if (num_rx_bufs == MAX_RX_BUFS)
+	{
+	    lasterror = (char *)"All receive buffers are held";
+	    return false;
+	}
+	rx_buf[num_rx_bufs++] = new char[MAX_READ_SIZE];
+	if (verbose > 2)
+	    DAPLOG((LOG_DEBUG, "Now using %d receive buffers\n", num_rx_bufs));
+    }
+
+    memcpy(rx_buf[i], buf+bufptr, keep);
+    cur_buf = i;
+    buf     = rx_buf[i];
+    bufptr  = 0;
+    buflen  = keep;
+    return true;
+}
+
+// Stop receive buffer 'n' from being re-used until release_buffer() is
+// called. Must be done before the next message is read.
+int dap_connection::hold_buffer(int n)
+{
+    rx_refs[n]++;
+    return n;
+}
+
+void dap_connection::release_buffer(int n)
+{
+    if (!closed && rx_refs[n] > 0) rx_refs[n]--;
+}
+
 // Set the maximum number of bytes to be read per block.
 // usually called after a CONFIG negotiation.
 void dap_connection::set_blocksize(int bs)
@@ -723,6 +785,13 @@ void dap_connection::clear_output_buffer()
     last_msg_start = 0;
 }
 
+// Throw away a message that has been started but not written; anything
+// before it in the buffer is kept.
+void dap_connection::discard_message()
+{
+    outbufptr = last_msg_start;
+}
+
 
 // Enable/disable blocked requests.
 // If blocking is being switched off we may also flush the buffer if there
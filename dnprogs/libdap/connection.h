@@ -31,6 +31,7 @@ class dap_connection
     int   get_length();
     int   read(bool);
     int   read_if_necessary(bool);
+    bool  have_input() { return bufptr < buflen; }
     int   write();
     int   send_crc(unsigned short);
     char *get_error();
@@ -47,7 +48,11 @@ class dap_connection
     int  get_remote_os() { return remote_os; };
     bool exchange_config();
     void clear_output_buffer();
+    void discard_message();
     void set_connect_timeout(int seconds);
+    int  current_buffer() { return cur_buf; }
+    int  hold_buffer(int);
+    void release_buffer(int);
     
 // Static utility functions
     static void makelower(char *s);
@@ -79,6 +84,16 @@ class dap_connection
 
     static const unsigned int MAX_READ_SIZE = 65535;
 
+    // Receive buffers. 'buf' is always rx_buf[cur_buf]. A DATA message can
+    // hold its buffer so the data is still there after more reads, in which
+    // case we move on to another one rather than overwrite it.
+    static const int MAX_RX_BUFS = 8;
+    char  *rx_buf[MAX_RX_BUFS];
+    int    rx_refs[MAX_RX_BUFS];
+    int    num_rx_bufs;
+    int    cur_buf;
+    bool   switch_buffer(int keep);
+
     void create_socket();
     void initialise(int);
     bool set_socket_buffer_size();
@@ -0,0 +1,213 @@
+/******************************************************************************
+    pipeline.cc from libdap
+
+    Copyright (C) 2026 The dnprogs contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+// pipeline.cc
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdnet/dn.h>
+#include <netdnet/dnetdb.h>
+
+#include "logging.h"
+#include "connection.h"
+#include "protocol.h"
+#include "pipeline.h"
+
+// The connection must already have exchanged CONFIG messages as we take
+// the remote buffer size and blocking capability from it.
+dap_pipeline::dap_pipeline(dap_connection &c, int w):
+    conn(c)
+{
+    window          = w<1?1:w;
+    num_sent        = 0;
+    num_queued      = 0;
+    bytes_in_flight = 0;
+    head = unsent = tail = finished = NULL;
+    lasterror       = errstring;
+    errstring[0]    = '\0';
+}
+
+// Any replies not read by the caller are simply forgotten. The connection
+// is probably not much use after that.
+dap_pipeline::~dap_pipeline()
+{
+    if (finished) free_request(finished);
+    while (head)
+    {
+	request *r = head;
+	head = head->next;
+	free_request(r);
+    }
+}
+
+// Add a request to the end of the queue. Nothing is sent until flush()
+// or next_reply() is called so that several requests can go in one block.
+bool dap_pipeline::add(int accfunc, int accopt, int display,
+		       const char *filespec, void *tag)
+{
+    if (accfunc == dap_access_message::OPEN ||
+	accfunc == dap_access_message::CREATE)
+    {
+	sprintf(errstring, "access function %d cannot be pipelined", accfunc);
+	lasterror = errstring;
+	return false;
+    }
+
+    request *r  = new request;
+    r->accfunc  = accfunc;
+    r->accopt   = accopt;
+    r->display  = display;
+    r->filespec = strdup(filespec);
+    r->length   = strlen(filespec) + ACCESS_OVERHEAD;
+    r->tag      = tag;
+    r->next     = NULL;
+
+    if (tail)
+	tail->next = r;
+    else
+	head = r;
+    tail = r;
+    if (!unsent) unsent = r;
+    num_queued++;
+
+    return true;
+}
+
+// Returns true if the caller should read some replies before adding
+// any more requests.
+bool dap_pipeline::window_full()
+{
+    return (num_sent + num_queued >= window);
+}
+
+// Send as many queued requests as the window allows. We never have more
+// outstanding than will fit in the remote end's buffer (from its CONFIG
+// message), though a single request is always allowed. If the remote end
+// accepts blocked messages then they all go in as few writes as possible,
+// otherwise set_blocked() does nothing and each goes on its own.
+bool dap_pipeline::flush()
+{
+    if (!unsent) return true;
+
+    if (!conn.set_blocked(true))
+    {
+	lasterror = conn.get_error();
+	return false;
+    }
+
+    int sent = 0;
+    while (unsent && num_sent < window)
+    {
+	if (num_sent &&
+	    bytes_in_flight + unsent->length > conn.get_blocksize())
+	    break;
+
+	if (!send_request(unsent))
+	{
+	    lasterror = conn.get_error();
+	    conn.set_blocked(false);
+	    return false;
+	}
+	num_sent++;
+	num_queued--;
+	bytes_in_flight += unsent->length;
+	unsent = unsent->next;
+	sent++;
+    }
+
+    if (!conn.set_blocked(false))
+    {
+	lasterror = conn.get_error();
+	return false;
+    }
+
+    if (conn.verbosity() > 2)
+	DAPLOG((LOG_DEBUG, "pipeline: sent %d requests, %d outstanding, %d queued\n",
+		sent, num_sent, num_queued));
+    return true;
+}
+
+// Read the next message from the remote end. *tag is set to the tag of the
+// request that it belongs to. The caller must delete the message.
+// When REPLY_DONE is returned get_filespec() will give the name that was
+// sent with the request until next_reply() is called again.
+int dap_pipeline::next_reply(dap_message **m, void **tag)
+{
+    if (finished)
+    {
+	free_request(finished);
+	finished = NULL;
+    }
+
+    if (!flush()) return REPLY_ERROR;
+    if (!num_sent) return REPLY_NONE;
+
+    dap_message *msg = dap_message::read_message(conn, true);
+    if (!msg)
+    {
+	lasterror = conn.get_error();
+	return REPLY_ERROR;
+    }
+
+    *m   = msg;
+    *tag = head->tag;
+
+    if (msg->get_type() != dap_message::ACCOMP &&
+	msg->get_type() != dap_message::STATUS)
+	return REPLY_MORE;
+
+    // That's the end of this request.
+    finished = head;
+    head = head->next;
+    if (!head) tail = NULL;
+    num_sent--;
+    bytes_in_flight -= finished->length;
+
+    return REPLY_DONE;
+}
+
+// Returns the filespec of the request that was last completed
+const char *dap_pipeline::get_filespec()
+{
+    if (finished)
+	return finished->filespec;
+    else
+	return NULL;
+}
+
+bool dap_pipeline::send_request(request *r)
+{
+    dap_access_message acc;
+    acc.set_accfunc(r->accfunc);
+    acc.set_accopt(r->accopt);
+    acc.set_filespec(r->filespec);
+    acc.set_display(r->display);
+    return acc.write(conn);
+}
+
+void dap_pipeline::free_request(request *r)
+{
+    free(r->filespec);
+    delete r;
+}
@@ -0,0 +1,71 @@
+#ifndef LIBDAP_PIPELINE_H
+#define LIBDAP_PIPELINE_H
+// pipeline.h
+//
+// Keeps several independent ACCESS requests (DIRECTORY, ERASE, RENAME...)
+// outstanding on one dap_connection so that a list of files costs
+// bandwidth rather than one round trip each.
+//
+// Requests are sent in the order they were added and FAL answers them in
+// the same order so replies are simply matched against the head of the
+// queue. A request is finished when its ACCOMP or STATUS message arrives.
+//
+// Only use this for requests that do not need any further conversation
+// with the remote end. OPEN and CREATE are refused, and wildcard
+// DIRECTORY requests should not be pipelined because a locked file needs
+// a CONTRAN/SKIP sent back in the middle of the reply.
+
+class dap_pipeline
+{
+ public:
+    dap_pipeline(dap_connection &c, int window);
+    ~dap_pipeline();
+
+    bool add(int accfunc, int accopt, int display,
+	     const char *filespec, void *tag);
+    int  next_reply(dap_message **m, void **tag);
+    bool flush();
+
+    int  outstanding() { return num_sent; }
+    int  pending()     { return num_queued; }
+    bool window_full();
+    const char *get_filespec();
+    char *get_error()  { return lasterror; }
+
+    // Return codes from next_reply()
+    static const int REPLY_ERROR = -1;
+    static const int REPLY_NONE  = 0;  // Nothing outstanding
+    static const int REPLY_MORE  = 1;  // Part of a reply, more to come
+    static const int REPLY_DONE  = 2;  // Last message of a reply
+
+ private:
+    struct request
+    {
+	int      accfunc;
+	int      accopt;
+	int      display;
+	int      length;
+	char    *filespec;
+	void    *tag;
+	request *next;
+    };
+
+    dap_connection &conn;
+    int      window;
+    int      num_sent;
+    int      num_queued;
+    int      bytes_in_flight;
+    request *head;      // Oldest request, the one being answered
+    request *unsent;    // First request not yet written
+    request *tail;
+    request *finished;  // Kept until the next reply for get_filespec()
+    char    *lasterror;
+    char     errstring[256];
+
+    bool send_request(request *r);
+    void free_request(request *r);
+
+    // Approximate size of an ACCESS message without its filespec.
+    static const int ACCESS_OVERHEAD = 24;
+};
+#endif
@@ -518,7 +518,7 @@ const char *dap_message::type_name()
 // Return the message type by name
 const char *dap_message::type_name(int msg_type)
 {
-    static char name[32];
+    static __thread char name[32];
 
     switch (msg_type)
     {
@@ -888,8 +888,10 @@ void dap_access_message::set_display(int d)
 
     if (second) first |= 0x80;
 
+    // A second byte that the first doesn't say is there would be read
+    // as the start of the next field.
     display.set_byte(0, first);
-    display.set_byte(1, second);
+    if (second) display.set_byte(1, second);
 }
 
 
@@ -1054,8 +1056,10 @@ void dap_control_message::set_display(int d)
 
     if (second) first |= 0x80;
 
+    // A second byte that the first doesn't say is there would be read
+    // as the start of the next field.
     display.set_byte(0, first);
-    display.set_byte(1, second);
+    if (second) display.set_byte(1, second);
 
     ctlmenu.set_bit(5);
 }
@@ -1177,6 +1181,7 @@ void dap_accomp_message::set_check(int c)
 
 dap_data_message::~dap_data_message()
 {
+    release_data();
     if (local_data) delete[] data;
 }
 
@@ -1201,6 +1206,18 @@ bool dap_data_message::write_with_len(dap_connection &c)
     return c.write();
 }
 
+// Send 'len' bytes at 'd' without copying them into the message first;
+// they go straight into the connection's output buffer behind the header.
+bool dap_data_message::write_with_len(dap_connection &c, const char *d, int len)
+{
+    release_data();
+    if (data && local_data) delete[] data;
+    data = (char *)d;
+    length = len;
+    local_data = false;
+    return write_with_len(c);
+}
+
 // Only call this if you know what you're doing. (ie you know EXACTLY
 // the length of the recnum field)
 bool dap_data_message::write_with_len256(dap_connection &c)
@@ -1224,6 +1241,8 @@ bool dap_data_message::read(dap_connection &c)
     // Just keep a pointer to the transfer buffer for speed
     data = b;
     local_data = false;
+    source = &c;
+    source_buf = c.current_buffer();
     return true;
 }
 
@@ -1244,8 +1263,29 @@ void dap_data_message::get_data(char *d, int *len)
     memcpy(d, data, length);
 }
 
+// Keep the received data where it is, in the connection's buffer, until
+// release_data() is called or the message is deleted. This must be called
+// before the next message is read and the message must go before the
+// connection does. Saves copying records we can't deal with just yet.
+char *dap_data_message::hold_data()
+{
+    if (!local_data && source && held_buf == -1)
+	held_buf = source->hold_buffer(source_buf);
+    return data;
+}
+
+void dap_data_message::release_data()
+{
+    if (held_buf != -1)
+    {
+	source->release_buffer(held_buf);
+	held_buf = -1;
+    }
+}
+
 void dap_data_message::set_data(const char *d, int len)
 {
+    release_data();
     if (data && local_data) delete[] data;
     data = new char[len];
     memcpy(data, d, len);
@@ -2030,8 +2070,9 @@ void dap_date_message::set_rvn(int r)
 
 char *dap_date_message::time_to_string(time_t t)
 {
-    static char d[25];
-    struct tm tm = *localtime(&t);
+    static __thread char d[25];
+    struct tm tm;
+    localtime_r(&t, &tm);
 
 // This causes a warning because of the 2-digit year but
 // it's what DAP requires!
@@ -2078,7 +2119,7 @@ time_t dap_date_message::string_to_time_t(const char *d)
 // Make a two-digit date into a 4-digit one. using 1970 as the pivot date
 char *dap_date_message::make_y2k(char *dt)
 {
-    static char y2kdate[25];
+    static __thread char y2kdate[25];
     int year;
     int timepos;
 
@@ -2159,6 +2200,18 @@ bool dap_alloc_message::write(dap_connection &c)
     return c.write();
 }
 
+int dap_alloc_message::get_alq()
+{
+    if (allmenu.get_bit(5)) return alq.get_int();
+    return 0;
+}
+
+int dap_alloc_message::get_deq()
+{
+    if (allmenu.get_bit(8)) return deq.get_int();
+    return 0;
+}
+
 //------------------------ dap_protect_message() ------------------------------
 
 bool dap_protect_message::read(dap_connection &c)
@@ -2220,7 +2273,7 @@ mode_t dap_protect_message::get_mode()
 
 const char *dap_protect_message::get_protection()
 {
-    static char protstring[60];
+    static __thread char protstring[60];
     int p = 0;
     int ptr = 0;
     int i;
@@ -757,7 +757,9 @@ class dap_data_message: public dap_message
     dap_data_message():
 	recnum(5),
 	data(NULL),
-        local_data(false)
+        local_data(false),
+	source(NULL),
+	held_buf(-1)
 	{msg_type = DATA;}
 
     ~dap_data_message();
@@ -766,6 +768,7 @@ class dap_data_message: public dap_message
     virtual bool write(dap_connection&);
     virtual bool write_with_len(dap_connection&);
     virtual bool write_with_len256(dap_connection&);
+    bool  write_with_len(dap_connection&, const char *, int);
 
     int   get_recnum();
     int   get_datalen();
@@ -773,11 +776,16 @@ class dap_data_message: public dap_message
     void  set_recnum(int r);
     void  get_data(char *, int *);
     void  set_data(const char *, int);
+    char *hold_data();
+    void  release_data();
 
  private:
     dap_image  recnum;
     char      *data;
     bool       local_data; // data pointer is allocated
+    dap_connection *source; // Connection whose buffer 'data' points into
+    int        source_buf;
+    int        held_buf;   // Buffer we are holding, or -1
 };
 
 
@@ -905,6 +913,9 @@ class dap_alloc_message: public dap_message
     virtual bool read(dap_connection&);
     virtual bool write(dap_connection&);
 
+    int get_alq();
+    int get_deq();
+
  private:
     dap_ex    allmenu;
     dap_bytes vol;
@@ -25,61 +25,37 @@
 #include <netdnet/dn.h>
 #include <netdnet/dnetdb.h>
 
-static char             nodetag[80],nametag[80],nodeadr[80],nodename[80];
+#include "nodeindex.h"
+
 static struct dn_naddr	binadr = {0x0002,{0x00,0x00}};
 
 
 struct	dn_naddr	*dnet_addr(char *name)
 {
+	struct nodeidx_entry e;
 
-	FILE		*dnhosts;
-	char		nodeln[80];
-        char            **endptr;
-	char		*aux;
-	long		area,node;
-
-
-	if ((dnhosts = fopen(SYSCONF_PREFIX "/etc/decnet.conf","r")) == NULL)
+	switch (dnet_nodeidx_byname(name, &e))
 	{
-		printf("dnet_addr: Can not open " SYSCONF_PREFIX "/etc/decnet.conf\n");
-		errno = ENOENT;
-		return NULL;
-	}
-	while (fgets(nodeln,80,dnhosts) != NULL)
-	{
-		sscanf(nodeln,"%s%s%s%s\n",nodetag,nodeadr,nametag,nodename);
-		if (strncmp(nodetag,"#",1) != 0)
+	case NODEIDX_FOUND:
+		if ((e.area < 0) || (e.area > 63) ||
+		    (e.node < 0) || (e.node > 1023))
 		{
-		   if (((strcmp(nodetag,"executor") != 0) &&
-	    	       (strcmp(nodetag,"node")     != 0)) ||
-		       (strcmp(nametag,"name")     != 0))
-		   {
-		       printf("dnet_addr: Invalid decnet.conf syntax\n");
-		       errno = ENOENT;
-		       return 0;
-		   }
-		   if (strcmp(nodename,name) == 0)
-		   {
-			aux=nodeadr;
-			endptr=&aux;
-			area=strtol(nodeadr,endptr,0);
-			node=strtol(*endptr+1,endptr,0);
-			if ((area < 0) || (area > 63) ||
-			    (node < 0) || (node > 1023))
-			{
-				printf("dnet_addr: Invalid address %d.%d\n",
-							(int)area,(int)node);
-				fclose(dnhosts);
-				return 0;
-			}
-			binadr.a_addr[0] = node & 0xFF;
-			binadr.a_addr[1] = (area << 2) | ((node & 0x300) >> 8);
-			fclose(dnhosts);
-			return &binadr;
-		   }
+			printf("dnet_addr: Invalid address %d.%d\n",
+			       e.area, e.node);
+			return 0;
 		}
+		binadr.a_addr[0] = e.node & 0xFF;
+		binadr.a_addr[1] = (e.area << 2) | ((e.node & 0x300) >> 8);
+		return &binadr;
+
+	case NODEIDX_NO_CONF:
+		printf("dnet_addr: Can not open " SYSCONF_PREFIX "/etc/decnet.conf\n");
+		break;
+
+	case NODEIDX_BAD_SYNTAX:
+		printf("dnet_addr: Invalid decnet.conf syntax\n");
+		break;
 	}
-	fclose(dnhosts);
 	errno = ENOENT;
 	return 0;
 }
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdnet/dn.h>
 #include <netdnet/dnetdb.h>
 #include "dn_endian.h"
@@ -126,6 +127,15 @@ static int set_object_proxy(struct sockaddr_dn *sdn)
 	return 0;
 }
 
+static void close_keep_errno(int s)
+{
+	int tmp;
+
+	tmp = errno;
+	close(s);
+	errno = tmp;
+}
+
 static int set_object_name(struct sockaddr_dn *sdn, char *name)
 {
 	int len;
@@ -149,18 +159,20 @@ static int set_object_name(struct sockaddr_dn *sdn, char *name)
  * o Doesn't use PAM to prompt for a passwd when required (should have option
  *   of not using PAM too in which case use stdin/stdout)
  * o Can't cope with the possibility of multiple local network interfaces
- * o Isn't thread safe (really we need dnet_conn_r() as well)
  * o I'm not 100% sure of the proxy_requested semantics... this appears to
  *   be correct according to the manual that I've got here, but the details
  *   are thin on the ground.
  */
 
-int dnet_conn(char *host, char *objname, int type, unsigned char *opt_out, int opt_outl, unsigned char *opt_in, int *opt_inl)
+#ifdef SDF_PROXY
+/*
+ * Make a socket that is all ready to connect to the object, and the address
+ * to connect it to.
+ */
+static int conn_socket(char *host, char *objname, int type,
+		       unsigned char *opt_out, int opt_outl,
+		       struct sockaddr_dn *saddr)
 {
-#ifndef SDF_PROXY
-    return -1;
-#else
-    struct sockaddr_dn saddr;
 	char hname[DN_MAXNODEL + 1];
 	struct accessdata_dn access;
 	int s;
@@ -185,24 +197,23 @@ int dnet_conn(char *host, char *objname, int type, unsigned char *opt_out, int o
 	if (parse_host(host, hname, &access) < 0)
 		return -1;
 
-	memset(&saddr, 0, sizeof(struct sockaddr_dn));
-	saddr.sdn_family = AF_DECnet;
-
-	if (dnet_pton(AF_DECnet, hname, &saddr.sdn_add) != 1) {
-		/*
-		 * FIXME: This isn't thread safe.
-		 */
-		struct nodeent *ne = getnodebyname(hname);
-		if (ne) {
-			saddr.sdn_nodeaddrl = 2;
-			memcpy(saddr.sdn_nodeaddr, ne->n_addr, 2);
+	memset(saddr, 0, sizeof(struct sockaddr_dn));
+	saddr->sdn_family = AF_DECnet;
+
+	if (dnet_pton(AF_DECnet, hname, &saddr->sdn_add) != 1) {
+		struct nodeent ne;
+		char nebuf[DN_MAXNODEL + 3];
+
+		if (getnodebyname_r(hname, &ne, nebuf, sizeof(nebuf))) {
+			saddr->sdn_nodeaddrl = 2;
+			memcpy(saddr->sdn_nodeaddr, ne.n_addr, 2);
 		} else {
 			errno = EADDRNOTAVAIL;
 	    		return -1;
 		}
 	}
 
-	if (set_object_name(&saddr, objname))
+	if (set_object_name(saddr, objname))
 		return -1;
 
 	s = socket(PF_DECnet, type, DNPROTO_NSP);
@@ -223,11 +234,11 @@ int dnet_conn(char *host, char *objname, int type, unsigned char *opt_out, int o
 		sa_bind.sdn_flags = 0;
 		memcpy(&sa_bind.sdn_add, dna, sizeof(*dna));
 		if (set_object_proxy(&sa_bind))
-			return -1;
+			goto out_err;
 		if (bind(s, (struct sockaddr *)&sa_bind, sizeof(sa_bind)) < 0)
 			goto out_err;
 
-		saddr.sdn_flags |= SDF_PROXY;
+		saddr->sdn_flags |= SDF_PROXY;
 		   }
 
 	if (access.acc_accl || access.acc_passl || access.acc_userl) {
@@ -241,6 +252,42 @@ int dnet_conn(char *host, char *objname, int type, unsigned char *opt_out, int o
 	}
 
 	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	return s;
+
+out_err:
+	close_keep_errno(s);
+	return -1;
+}
+
+/* Why the other end refused the connection, -1 if it didn't say.
+   errno is left alone for the caller to report. */
+static int reject_reason(int s)
+{
+	struct optdata_dn optdata;
+	socklen_t len = sizeof(optdata);
+	int saved_errno = errno;
+	int reason = -1;
+
+	if (errno != ETIMEDOUT &&
+	    getsockopt(s, DNPROTO_NSP, DSO_DISDATA, &optdata, &len) == 0)
+		reason = optdata.opt_status;
+
+	errno = saved_errno;
+	return reason;
+}
+#endif
+
+int dnet_conn(char *host, char *objname, int type, unsigned char *opt_out, int opt_outl, unsigned char *opt_in, int *opt_inl)
+{
+#ifndef SDF_PROXY
+    return -1;
+#else
+    struct sockaddr_dn saddr;
+	int s;
+
+	s = conn_socket(host, objname, type, opt_out, opt_outl, &saddr);
+	if (s < 0)
+		return -1;
 
 	if (connect(s, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
 		goto out_err;
@@ -253,13 +300,97 @@ int dnet_conn(char *host, char *objname, int type, unsigned char *opt_out, int o
 	errno = 0;
 	return s;
 out_err:
-	{
-		int tmp;
-		tmp = errno;
-		close(s);
-		errno = tmp;
+	close_keep_errno(s);
+	return -1;
+#endif
+}
+
+/*
+ * Start connecting without waiting for the other end. The socket is
+ * returned non-blocking with errno set to EINPROGRESS (or 0 if it connected
+ * straight away); wait for it to be writable and call dnet_conn_finish().
+ */
+int dnet_conn_start(char *host, char *objname, int type, unsigned char *opt_out, int opt_outl, int *reason)
+{
+	if (reason)
+		*reason = -1;
+#ifndef SDF_PROXY
+    return -1;
+#else
+    struct sockaddr_dn saddr;
+	int s;
+
+	s = conn_socket(host, objname, type, opt_out, opt_outl, &saddr);
+	if (s < 0)
+		return -1;
+
+	if (fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) < 0)
+		goto out_err;
+
+	if (connect(s, (struct sockaddr *)&saddr, sizeof(saddr)) < 0) {
+		if (errno == EINPROGRESS)
+			return s;
+		if (reason)
+			*reason = reject_reason(s);
+		goto out_err;
 	}
+
+	errno = 0;
+	return s;
+out_err:
+	close_keep_errno(s);
 	return -1;
 #endif
 }
 
+/*
+ * Finish a connection started by dnet_conn_start(). On success the socket
+ * is put back into blocking mode and returned. If the connection failed it
+ * is closed and -1 returned with errno and *reason (a DNSTAT_ code, or -1)
+ * saying why. If it is still connecting, -1 is returned with errno set to
+ * EINPROGRESS and the socket is left alone.
+ */
+int dnet_conn_finish(int s, unsigned char *opt_in, int *opt_inl, int *reason)
+{
+	if (reason)
+		*reason = -1;
+#ifndef SDF_PROXY
+    return -1;
+#else
+    struct sockaddr_dn peer;
+	socklen_t len = sizeof(int);
+	int err;
+
+	if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		goto out_err;
+	if (err) {
+		errno = err;
+		if (reason)
+			*reason = reject_reason(s);
+		goto out_err;
+	}
+
+	len = sizeof(peer);
+	if (getpeername(s, (struct sockaddr *)&peer, &len) < 0) {
+		if (errno == ENOTCONN) {
+			errno = EINPROGRESS;
+			return -1;
+		}
+		goto out_err;
+	}
+
+	if (fcntl(s, F_SETFL, fcntl(s, F_GETFL) & ~O_NONBLOCK) < 0)
+		goto out_err;
+
+	if (opt_in && opt_inl) {
+		if (getsockopt(s, DNPROTO_NSP, DSO_CONDATA, opt_in, (socklen_t*)opt_inl) < 0)
+			goto out_err;
+	}
+
+	errno = 0;
+	return s;
+out_err:
+	close_keep_errno(s);
+	return -1;
+#endif
+}
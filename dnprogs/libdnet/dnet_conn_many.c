@@ -0,0 +1,176 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Connect to a list of node::object targets at the same time so that a
+ * program talking to hundreds of nodes doesn't have to wait for each one
+ * in turn. At most max_parallel connections are in progress at once, and
+ * each gets timeout_ms from when it was started before it is given up.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netdnet/dn.h>
+#include <netdnet/dnetdb.h>
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* A connection has finished one way or another, forget about it */
+static void remove_active(struct pollfd *pfds, int *which, long long *deadline,
+			  int i, int *active)
+{
+	(*active)--;
+	pfds[i]     = pfds[*active];
+	which[i]    = which[*active];
+	deadline[i] = deadline[*active];
+}
+
+/*
+ * Returns the number of targets that were connected, or -1 if we couldn't
+ * do anything at all. Each target's fd, error and reason say what happened
+ * to it.
+ */
+int dnet_conn_many(struct dnet_conn_target *targets, int num, int type,
+		   int max_parallel, int timeout_ms)
+{
+	struct pollfd *pfds;
+	int           *which;	/* Target of each pollfd */
+	long long     *deadline;
+	int            next = 0;
+	int            active = 0;
+	int            connected = 0;
+	int            i;
+
+	if (max_parallel <= 0 || max_parallel > num)
+		max_parallel = num;
+
+	for (i = 0; i < num; i++) {
+		targets[i].fd     = -1;
+		targets[i].error  = 0;
+		targets[i].reason = -1;
+	}
+	if (num <= 0)
+		return 0;
+
+	pfds     = malloc(max_parallel * sizeof(struct pollfd));
+	which    = malloc(max_parallel * sizeof(int));
+	deadline = malloc(max_parallel * sizeof(long long));
+	if (!pfds || !which || !deadline) {
+		free(pfds);
+		free(which);
+		free(deadline);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	while (next < num || active) {
+		long long now;
+		int wait = -1;
+
+		/* Start as many as we are allowed */
+		while (active < max_parallel && next < num) {
+			struct dnet_conn_target *t = &targets[next];
+			int s;
+
+			s = dnet_conn_start(t->node, t->object, type, NULL, 0,
+					    &t->reason);
+			if (s < 0) {
+				t->error = errno;
+				next++;
+				continue;
+			}
+			pfds[active].fd      = s;
+			pfds[active].events  = POLLOUT;
+			pfds[active].revents = 0;
+			which[active]        = next++;
+			deadline[active]     = now_ms() + timeout_ms;
+			active++;
+		}
+		if (!active)
+			break;
+
+		if (timeout_ms > 0) {
+			long long first = deadline[0];
+
+			for (i = 1; i < active; i++)
+				if (deadline[i] < first)
+					first = deadline[i];
+			now = now_ms();
+			wait = first > now ? first - now : 0;
+		}
+
+		if (poll(pfds, active, wait) < 0) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+
+			/* Give up on everything that's still going */
+			while (active) {
+				close(pfds[0].fd);
+				targets[which[0]].error = err;
+				remove_active(pfds, which, deadline, 0, &active);
+			}
+			continue;
+		}
+
+		now = now_ms();
+		for (i = 0; i < active; ) {
+			struct dnet_conn_target *t = &targets[which[i]];
+
+			if (pfds[i].revents) {
+				int s = dnet_conn_finish(pfds[i].fd, NULL, NULL,
+							 &t->reason);
+				if (s >= 0) {
+					t->fd = s;
+					connected++;
+					remove_active(pfds, which, deadline, i, &active);
+					continue;
+				}
+				if (errno != EINPROGRESS) {
+					t->error = errno;
+					remove_active(pfds, which, deadline, i, &active);
+					continue;
+				}
+			}
+			if (timeout_ms > 0 && now >= deadline[i]) {
+				close(pfds[i].fd);
+				t->error = ETIMEDOUT;
+				remove_active(pfds, which, deadline, i, &active);
+				continue;
+			}
+			i++;
+		}
+	}
+
+	free(pfds);
+	free(which);
+	free(deadline);
+	return connected;
+}
@@ -21,46 +21,54 @@
 #include <sys/socket.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <netdnet/dn.h>
 #include <netdnet/dnetdb.h>
 
-static char             nodetag[80],nametag[80],nodeadr[80],nodename[80];
-static char             asc_addr[6];
+#include "nodeindex.h"
 
-char *dnet_htoa(struct dn_naddr *addr)
+/*
+ * Reentrant version. Returns 'buf', or NULL if the name didn't fit or
+ * decnet.conf couldn't be read.
+ */
+char *dnet_htoa_r(struct dn_naddr *addr, char *buf, size_t buflen)
 {
-	FILE		*dnhosts;
-	char		nodeln[80];
-
-	sprintf(asc_addr,"%d.%d",(addr->a_addr[1] >> 2),
-		(((addr->a_addr[1] & 0x03) << 8) | addr->a_addr[0]));
+	struct nodeidx_entry e;
+	int    area = addr->a_addr[1] >> 2;
+	int    node = ((addr->a_addr[1] & 0x03) << 8) | addr->a_addr[0];
 
-	if ((dnhosts = fopen(SYSCONF_PREFIX "/etc/decnet.conf","r")) == NULL)
+	switch (dnet_nodeidx_byaddr(area, node, &e))
 	{
+	case NODEIDX_FOUND:
+		if (strlen(e.name) >= buflen)
+		{
+			errno = ERANGE;
+			return 0;
+		}
+		strcpy(buf, e.name);
+		return buf;
+
+	case NODEIDX_NO_CONF:
 		fprintf(stderr, "dnet_htoa: Can not open " SYSCONF_PREFIX "/etc/decnet.conf\n");
 		return 0;
+
+	case NODEIDX_BAD_SYNTAX:
+		fprintf(stderr, "dnet_htoa: Invalid decnet.conf syntax\n");
+		return 0;
 	}
-	while (fgets(nodeln,80,dnhosts) != NULL)
+
+	if (snprintf(buf, buflen, "%d.%d", area, node) >= (int)buflen)
 	{
-		sscanf(nodeln,"%s%s%s%s\n",nodetag,nodeadr,nametag,nodename);
-		if (strncmp(nodetag,"#",1) != 0)	
-		{
-		   if (((strcmp(nodetag,"executor") != 0) &&
-	    	       (strcmp(nodetag,"node")     != 0)) ||
-		       (strcmp(nametag,"name")     != 0))
-		   {
-		       fprintf(stderr, "dnet_htoa: Invalid decnet.conf syntax\n");
-			 fclose(dnhosts);
-		       return 0;
-		   }
-		   if (strcmp(nodeadr,asc_addr) == 0) 
-		   {
-			fclose(dnhosts);
-			return nodename;
-		   }
-		}
+		errno = ERANGE;
+		return 0;
 	}
-	fclose(dnhosts);
-	return asc_addr;
+	return buf;
+}
+
+char *dnet_htoa(struct dn_naddr *addr)
+{
+	static char nodename[256];
+
+	return dnet_htoa_r(addr, nodename, sizeof(nodename));
 }
 /*--------------------------------------------------------------------------*/
@@ -65,6 +65,18 @@ int dnet_recv(int s, void *buf, int len, unsigned int flags)
  	    status = recvmsg(s, &msg, recvflags);
 	    offset += status;
 	    iov.iov_base += status;
+
+	    /* Other record-based sockets (eg an AF_UNIX socketpair standing
+	       in for a link) deliver whole records and never set MSG_EOR */
+	    if (status > 0 && !(msg.msg_flags & MSG_EOR) && offset == status)
+	    {
+		int domain;
+		socklen_t dlen = sizeof(domain);
+
+		if (getsockopt(s, SOL_SOCKET, SO_DOMAIN, &domain, &dlen) == 0 &&
+		    domain != AF_DECnet)
+		    break;
+	    }
 	} 
 	while (status > 0 && !(msg.msg_flags & MSG_EOR));
 
@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <netdnet/dn.h>
 #include <netdnet/dnetdb.h>
 
@@ -34,22 +35,37 @@
 #include <netinet/ether.h>
 #endif
 
-static char             nodetag[80],nametag[80],nodeadr[80],nodename[80];
-static char             asc_addr[6];
-static struct nodeent	dp;
-static char   		laddr[2];
+#include "nodeindex.h"
 
-struct nodeent *getnodebyaddr_ether(const char *inaddr, int len, int family) {
-	struct ether_addr ea = {.ether_addr_octet = {0xAA, 0x00, 0x04, 0x00}};
-	int i;
+/* Longest node name the non-reentrant functions can return */
+#define NODENAME_MAX 256
 
-	memcpy((void*)laddr, (void*)inaddr, 2);
+/* Put a node's details into the caller's buffer */
+static struct nodeent *fill_nodeent(struct nodeent *ne, char *buf, size_t buflen,
+				    const char *addr, const char *name)
+{
+	if (buflen < strlen(name)+3)
+	{
+		errno = ERANGE;
+		return NULL;
+	}
+	memcpy(buf, addr, 2);
+	strcpy(buf+2, name);
+
+	ne->n_addr     = (unsigned char *)buf;
+	ne->n_length   = 2;
+	ne->n_name     = buf+2;
+	ne->n_addrtype = AF_DECnet;
+	return ne;
+}
 
-	dp.n_addr     = (unsigned char *)&laddr;
-	dp.n_length   = 2;
-	dp.n_addrtype = AF_DECnet;
+struct nodeent *getnodebyaddr_ether_r(const char *inaddr, int len, int family,
+				      struct nodeent *ne, char *buf, size_t buflen) {
+	struct ether_addr ea = {.ether_addr_octet = {0xAA, 0x00, 0x04, 0x00}};
+	char nodename[1024];
+	int i;
 
-	memcpy((void*)&ea.ether_addr_octet[4], (void*)laddr, 2);
+	memcpy((void*)&ea.ether_addr_octet[4], (void*)inaddr, 2);
 
 	if ( ether_ntohost(nodename, &ea) != 0 )
 	    return NULL;
@@ -61,51 +77,48 @@ struct nodeent *getnodebyaddr_ether(const char *inaddr, int len, int family) {
 	    }
 	}
 
-	dp.n_name = nodename;
-	return &dp;
+	return fill_nodeent(ne, buf, buflen, inaddr, nodename);
 }
 
-struct nodeent *getnodebyaddr(const char *inaddr, int len, int family)
+struct nodeent *getnodebyaddr_ether(const char *inaddr, int len, int family) {
+	static struct nodeent dp;
+	static char           buf[NODENAME_MAX+2];
+
+	return getnodebyaddr_ether_r(inaddr, len, family, &dp, buf, sizeof(buf));
+}
+
+/*
+ * Reentrant version, the address and name go in 'buf' which must have
+ * room for both.
+ */
+struct nodeent *getnodebyaddr_r(const char *inaddr, int len, int family,
+				struct nodeent *ne, char *buf, size_t buflen)
 {
-	FILE	*dnhosts;
-	char	nodeln[80];
 	const unsigned char *addr = (const unsigned char *)inaddr;
+	struct nodeidx_entry e;
 
-	sprintf (asc_addr,"%d.%d",((unsigned char)*(addr+1) >> 2),
-		 (((unsigned char)*(addr+1) & 0x03) << 8) | ((unsigned char)*(addr))
-		);
-	
-	if ((dnhosts = fopen(SYSCONF_PREFIX "/etc/decnet.conf","r")) == NULL)
+	switch (dnet_nodeidx_byaddr(addr[1] >> 2,
+				    ((addr[1] & 0x03) << 8) | addr[0], &e))
 	{
+	case NODEIDX_FOUND:
+		return fill_nodeent(ne, buf, buflen, inaddr, e.name);
+
+	case NODEIDX_NO_CONF:
 		printf("getnodebyaddr: Can not open " SYSCONF_PREFIX "/etc/decnet.conf\n");
 		return 0;
+
+	case NODEIDX_BAD_SYNTAX:
+		printf("getnodebyaddr: Invalid decnet.conf syntax\n");
+		return 0;
 	}
-	while (fgets(nodeln,80,dnhosts) != NULL)
-	{
-		sscanf(nodeln,"%s%s%s%s\n",nodetag,nodeadr,nametag,nodename);
-		if (strncmp(nodetag,"#",1) != 0)	
-		{
-		   if (((strcmp(nodetag,"executor") != 0) &&
-	    	       (strcmp(nodetag,"node")     != 0)) ||
-		       (strcmp(nametag,"name")     != 0))
-		   {
-		       printf("getnodebyaddr: Invalid decnet.conf syntax\n");
-			 fclose(dnhosts);
-		       return 0;
-		   }
-		   if (strcmp(nodeadr,asc_addr) == 0) 
-		   {
-			fclose(dnhosts);
-			memcpy(laddr,addr,len);
-			dp.n_addr=(unsigned char *)&laddr;
-			dp.n_length=2;		
-			dp.n_name=nodename;		
-			dp.n_addrtype=AF_DECnet;
-			return &dp;
-		   }
-		}
-	}
-	fclose(dnhosts);
-	return getnodebyaddr_ether(inaddr, len, family);
+	return getnodebyaddr_ether_r(inaddr, len, family, ne, buf, buflen);
 }
 
+struct nodeent *getnodebyaddr(const char *inaddr, int len, int family)
+{
+	static struct nodeent dp;
+	static char           buf[NODENAME_MAX+2];
+
+	return getnodebyaddr_r(inaddr, len, family, &dp, buf, sizeof(buf));
+}
+/*--------------------------------------------------------------------------*/
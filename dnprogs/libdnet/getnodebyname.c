@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <netdnet/dn.h>
 #include <netdnet/dnetdb.h>
 
@@ -35,112 +36,140 @@
 #include <netinet/ether.h>
 #endif
 
-static char             nodetag[80],nametag[80],nodeadr[80],nodename[80];
-static struct nodeent	dp;
-static struct dn_naddr	*naddr;
+#include "nodeindex.h"
 
 #define RESOLV_CONF "/etc/resolv.conf"
 
-struct nodeent *getnodebyname_ether(const char *name) {
-	static char search[3][32] = {{0}, {0}, {0}};
-	static int  search_len    =   0;
+/* Longest node name the non-reentrant functions can return */
+#define NODENAME_MAX 256
+
+/* Put a node's details into the caller's buffer */
+static struct nodeent *fill_nodeent(struct nodeent *ne, char *buf, size_t buflen,
+				    int area, int node, const char *name)
+{
+	if (buflen < strlen(name)+3)
+	{
+		errno = ERANGE;
+		return NULL;
+	}
+	buf[0] = node & 0xFF;
+	buf[1] = (area << 2) | ((node & 0x300) >> 8);
+	strcpy(buf+2, name);
+
+	ne->n_addr     = (unsigned char *)buf;
+	ne->n_length   = 2;
+	ne->n_name     = buf+2;
+	ne->n_addrtype = AF_DECnet;
+	return ne;
+}
+
+struct nodeent *getnodebyname_ether_r(const char *name, struct nodeent *ne,
+				      char *buf, size_t buflen) {
+	char search[3][32];
+	int  search_len = 0;
 	FILE * conf;
 	int i;
-	static struct ether_addr ea;
+	struct ether_addr ea;
 	u_int8_t decnet_prefix[4] = {0xAA, 0x00, 0x04, 0x00};
+	char line[80];
+	char nodename[NODENAME_MAX+32];
 
 	memset((void*)&ea, 0, sizeof(ea));
 
-	if ( !search_len ) {
-	    if ( (conf = fopen(RESOLV_CONF, "r")) != NULL ) {
-	        while (fgets(nodetag, 80, conf) != NULL) {
-	            if ( strncmp(nodetag, "search ", 7) == 0 ) {
-	                if ( (search_len = sscanf(nodetag, "search %s%s%s\n", search[0], search[0], search[3])) )
-	                    break;
-	            }
+	/* Read every time, so that this is safe to call from any thread */
+	if ( (conf = fopen(RESOLV_CONF, "r")) != NULL ) {
+	    while (fgets(line, 80, conf) != NULL) {
+	        if ( strncmp(line, "search ", 7) == 0 ) {
+	            if ( (search_len = sscanf(line, "search %31s%31s%31s\n", search[0], search[1], search[2])) > 0 )
+	                break;
+	            search_len = 0;
 	        }
-	        fclose(conf);
 	    }
+	    fclose(conf);
 	}
 
-	dp.n_addrtype = AF_DECnet;
-	dp.n_length   = 2;
-	dp.n_name     = (char*)name;
-
 	if ( ether_hostton(name, &ea) == 0 ) {
-	    if ( memcmp(ea.ether_addr_octet, decnet_prefix, 4) == 0 ) {
-	        dp.n_addr=(unsigned char *)&ea.ether_addr_octet[4];
-	        return &dp;
-	    }
+	    if ( memcmp(ea.ether_addr_octet, decnet_prefix, 4) == 0 )
+	        goto found;
 	}
 
 	for(i = 0; i < search_len; i++) {
-	    sprintf(nodename, "%s.%s", name, search[i]);
-
+	    snprintf(nodename, sizeof(nodename), "%s.%s", name, search[i]);
 
 	    if ( ether_hostton(nodename, &ea) == 0 ) {
-	        if ( memcmp(ea.ether_addr_octet, decnet_prefix, 4) == 0 ) {
-	            dp.n_addr=(unsigned char *)&ea.ether_addr_octet[4];
-	            return &dp;
-	        }
+	        if ( memcmp(ea.ether_addr_octet, decnet_prefix, 4) == 0 )
+	            goto found;
 	    }
 	}
 
 	return NULL;
+
+ found:
+	if (buflen < strlen(name)+3) {
+	    errno = ERANGE;
+	    return NULL;
+	}
+	memcpy(buf, &ea.ether_addr_octet[4], 2);
+	strcpy(buf+2, name);
+	ne->n_addrtype = AF_DECnet;
+	ne->n_length   = 2;
+	ne->n_addr     = (unsigned char *)buf;
+	ne->n_name     = buf+2;
+	return ne;
 }
 
-struct nodeent *getnodebyname(const char *name)
+struct nodeent *getnodebyname_ether(const char *name) {
+	static struct nodeent dp;
+	static char           buf[NODENAME_MAX+2];
+
+	return getnodebyname_ether_r(name, &dp, buf, sizeof(buf));
+}
+
+/*
+ * Reentrant version, the address and name go in 'buf' which must have
+ * room for both.
+ */
+struct nodeent *getnodebyname_r(const char *name, struct nodeent *ne,
+				char *buf, size_t buflen)
 {
-	FILE		*dnhosts;
-	char		nodeln[80];
-	int             a,n;
+	struct nodeidx_entry e;
+	int                  a,n;
 
 	/* See if it is an address really */
 	if (sscanf(name, "%d.%d", &a, &n) == 2)
 	{
-	    static struct dn_naddr addr;
-	    addr.a_addr[0] = n & 0xFF;
-	    addr.a_addr[1] = (a << 2) | ((n & 0x300) >> 8);
-	    dp.n_addr = (unsigned char *)&addr.a_addr;
-	    dp.n_length=2;
-	    dp.n_name=(char *)name;  /* No point looking this up for a real name */
-	    dp.n_addrtype=AF_DECnet;
-
-	    return &dp;
+	    /* No point looking this up for a real name */
+	    return fill_nodeent(ne, buf, buflen, a, n, name);
 	}
 
-	if ((dnhosts = fopen(SYSCONF_PREFIX "/etc/decnet.conf","r")) == NULL)
-	{
-		printf("getnodebyname: Can not open " SYSCONF_PREFIX "/etc/decnet.conf\n");
-		return 0;
-	}
-	while (fgets(nodeln,80,dnhosts) != NULL)
+	switch (dnet_nodeidx_byname(name, &e))
 	{
-		sscanf(nodeln,"%s%s%s%s\n",nodetag,nodeadr,nametag,nodename);
-		if (strncmp(nodetag,"#",1) != 0)	
+	case NODEIDX_FOUND:
+		if ((e.area < 0) || (e.area > 63) ||
+		    (e.node < 0) || (e.node > 1023))
 		{
-		   if (((strcmp(nodetag,"executor") != 0) &&
-	    	       (strcmp(nodetag,"node")     != 0)) ||
-		       (strcmp(nametag,"name")     != 0))
-		   {
-		       printf("getnodebyname: Invalid decnet.conf syntax\n");
-			 fclose(dnhosts);
-		       return 0;
-		   }
-		   if (strcmp(nodename,name) == 0) 
-		   {
-			fclose(dnhosts);
-			if ( (naddr=dnet_addr(nodename)) == 0)
-					return 0;
-			dp.n_addr=(unsigned char *)&naddr->a_addr; 
-			dp.n_length=2;
-			dp.n_name=nodename;		
-			dp.n_addrtype=AF_DECnet;
-			return &dp;
-		   }
+			printf("dnet_addr: Invalid address %d.%d\n",
+			       e.area, e.node);
+			return 0;
 		}
+		return fill_nodeent(ne, buf, buflen, e.area, e.node, e.name);
+
+	case NODEIDX_NO_CONF:
+		printf("getnodebyname: Can not open " SYSCONF_PREFIX "/etc/decnet.conf\n");
+		return 0;
+
+	case NODEIDX_BAD_SYNTAX:
+		printf("getnodebyname: Invalid decnet.conf syntax\n");
+		return 0;
 	}
-	fclose(dnhosts);
-	return getnodebyname_ether(name);
+	return getnodebyname_ether_r(name, ne, buf, buflen);
+}
+
+struct nodeent *getnodebyname(const char *name)
+{
+	static struct nodeent dp;
+	static char           buf[NODENAME_MAX+2];
+
+	return getnodebyname_r(name, &dp, buf, sizeof(buf));
 }
 /*--------------------------------------------------------------------------*/
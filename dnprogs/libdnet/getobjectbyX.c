@@ -23,7 +23,7 @@
 #include <netdnet/dn.h>
 #include <netdnet/dnetdb.h>
 
-#define DNETD_FILE SYSCONF_PREFIX "/etc/dnetd.conf"
+#include "objindex.h"
 
 static char * _dnet_objhinum_string   = NULL;
 static int    _dnet_objhinum_handling = DNOBJHINUM_ERROR;
@@ -107,33 +107,70 @@ int dnet_checkobjectnumber (int num) {
  }
 }
 
-static int getobjectbyname_nis(const char * name) {
- char           * cur, *next;
- char             proto[16];
- struct servent * se;
- static char    * search_order = NULL;
-
- if ( search_order == NULL ) {
-  if ( (search_order = getenv(DNOBJ_SEARCH_ENV)) == NULL )
-   search_order = DNOBJ_SEARCH_DEF;
-  if ( !*search_order )
-   search_order = DNOBJ_SEARCH_DEF;
- }
+// The NIS search order split into protocol names, done once
+#define DNOBJ_SEARCH_MAX 8
+
+static struct search_list {
+ int  num;
+ char proto[DNOBJ_SEARCH_MAX][16];
+} * _dnet_objsearch = NULL;
+
+static const struct search_list * get_search_order(void) {
+ struct search_list * sl = __atomic_load_n(&_dnet_objsearch, __ATOMIC_ACQUIRE);
+ struct search_list * none = NULL;
+ char               * search_order, * cur, * next;
+ size_t               len;
+
+ if ( sl != NULL )
+  return sl;
+
+ if ( (search_order = getenv(DNOBJ_SEARCH_ENV)) == NULL )
+  search_order = DNOBJ_SEARCH_DEF;
+ if ( !*search_order )
+  search_order = DNOBJ_SEARCH_DEF;
+
+ if ( (sl = calloc(1, sizeof(*sl))) == NULL )
+  return NULL;
 
  cur = search_order;
 
- while (cur && *cur) {
+ while (cur && *cur && sl->num < DNOBJ_SEARCH_MAX) {
   if ( (next = strstr(cur, " ")) == NULL ) {
-   strncpy(proto, cur, 16);
+   len = strlen(cur);
   } else {
-   strncpy(proto, cur, next-cur);
-   proto[next-cur] = 0;
+   len = next-cur;
    next++;
   }
+  if ( len > 15 )
+   len = 15;
+  memcpy(sl->proto[sl->num], cur, len);
+  sl->proto[sl->num++][len] = 0;
   cur = next;
+ }
+
+ // If another thread got here first use theirs, they are the same
+ if ( !__atomic_compare_exchange_n(&_dnet_objsearch, &none, sl, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+  free(sl);
+  sl = __atomic_load_n(&_dnet_objsearch, __ATOMIC_ACQUIRE);
+ }
+
+ return sl;
+}
 
-  if ( (se = getservbyname(name, proto)) != NULL ) {
-   return ntohs(se->s_port);
+static int getobjectbyname_nis(const char * name) {
+ const struct search_list * sl;
+ struct servent             se, * result;
+ char                       buf[1024];
+ int                        i;
+
+ if ( (sl = get_search_order()) == NULL )
+  return -1;
+
+ for (i = 0; i < sl->num; i++) {
+  if ( getservbyname_r(name, sl->proto[i], &se, buf, sizeof(buf), &result) == 0 &&
+       result != NULL ) {
+   return ntohs(se.s_port);
   }
  }
 
@@ -141,37 +178,23 @@ static int getobjectbyname_nis(const char * name) {
  return -1;
 }
 
-static const char * getobjectbynumber_nis(int num) {
- char           * cur, *next;
- char             proto[16];
- struct servent * se;
- static char    * search_order = NULL;
-
- if ( search_order == NULL ) {
-  if ( (search_order = getenv(DNOBJ_SEARCH_ENV)) == NULL )
-   search_order = DNOBJ_SEARCH_DEF;
-  if ( !*search_order )
-   search_order = DNOBJ_SEARCH_DEF;
- }
+// The name is put into 'buf'
+static const char * getobjectbynumber_nis(int num, char * buf, size_t buflen) {
+ const struct search_list * sl;
+ struct servent             se, * result;
+ int                        i;
 
- cur = search_order;
+ if ( (sl = get_search_order()) == NULL )
+  return NULL;
 
  num = htons(num);
 
- while (cur && *cur) {
-  if ( (next = strstr(cur, " ")) == NULL ) {
-   strncpy(proto, cur, 16);
-  } else {
-   strncpy(proto, cur, next-cur);
-   proto[next-cur] = 0;
-   next++;
-  }
-  cur = next;
-
-  if ( (se = getservbyport(num, proto)) != NULL ) {
-   if ( strcmp(proto, se->s_proto) == 0 ) /* check if we got what we requested,
-                                             may help on buggy libcs */
-    return se->s_name;
+ for (i = 0; i < sl->num; i++) {
+  if ( getservbyport_r(num, sl->proto[i], &se, buf, buflen, &result) == 0 &&
+       result != NULL ) {
+   if ( strcmp(sl->proto[i], se.s_proto) == 0 ) /* check if we got what we requested,
+                                                  may help on buggy libcs */
+    return se.s_name;
   }
  }
 
@@ -203,69 +226,12 @@ static const char * getobjectbynumber_static(int num) {
  return NULL;
 }
 
-static int getobjectbyname_dnetd(const char * name) {
- FILE * dnd;
- int    found = -1;
- int    ret;
- int    curr;
- char   line[1024], cname[16], rest[1024];
-
- cname[15] = 0; // work around bugy *scanf()s
-
- if ( (dnd = fopen(DNETD_FILE, "r")) == NULL ) {
-  return -1;
- }
-
- while (fgets(line, 1024, dnd) != NULL) {
-  if ( sscanf(line, "%15s %i %1024s\n", cname, &curr, rest) == 3 ) {
-   if ( *cname != '#' && strcasecmp(name, cname) == 0 ) {
-    found = curr;
-    break;
-   }
-  }
- }
-
- fclose(dnd);
-
- if ( found == -1 )
-  errno = ENOENT;
-
- return found;
-}
-
-static const char * getobjectbynumber_dnetd(int num) {
- FILE * dnd;
- int    curr;
- static char   cname[16]; // this is not thread safe
- char   line[1024], rest[1024];
-
- cname[15] = 0; // work around bugy *scanf()s
-
- if ( (dnd = fopen(DNETD_FILE, "r")) == NULL ) {
-  return NULL;
- }
-
- while (fgets(line, 1024, dnd) != NULL) {
-  if ( sscanf(line, "%15s %i %1024s\n", cname, &curr, rest) == 3 ) {
-   if ( *cname != '#' && num == curr ) {
-    fclose(dnd);
-    return cname;
-   }
-  }
- }
-
- fclose(dnd);
-
- errno = ENOENT;
- return NULL;
-}
-
 int getobjectbyname(const char * name) {
  int num;
  int old_errno = errno;
 
  if ( (num = getobjectbyname_nis(name)) == -1 )
-  if ( (num = getobjectbyname_dnetd(name)) == -1 )
+  if ( (num = dnet_objidx_byname(name)) == -1 )
    num = getobjectbyname_static(name);
 
  if ( num != -1 )
@@ -277,6 +243,8 @@ int getobjectbyname(const char * name) {
 int getobjectbynumber(int number, char * name, size_t name_len) {
  int num;
  const char * rname = NULL;
+ char nisbuf[1024];
+ char tblbuf[OBJIDX_NAME_MAX+1];
  int old_errno = errno;
 
  if ( (num = dnet_checkobjectnumber(number)) == -1 ) { // errno is set correctly after this call
@@ -288,8 +256,10 @@ int getobjectbynumber(int number, char * name, size_t name_len) {
   return -1;
  }
 
- if ( (rname = getobjectbynumber_nis(number)) == NULL )
-  if ( (rname = getobjectbynumber_dnetd(number)) == NULL )
+ if ( (rname = getobjectbynumber_nis(number, nisbuf, sizeof(nisbuf))) == NULL )
+  if ( dnet_objidx_bynumber(number, tblbuf) == 0 )
+   rname = tblbuf;
+  else
    rname = getobjectbynumber_static(number);
 
  if ( rname == NULL ) {
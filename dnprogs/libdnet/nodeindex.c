@@ -0,0 +1,685 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Compiled index of /etc/decnet.conf.
+ *
+ * Reading decnet.conf a line at a time for every lookup is slow on
+ * sites with thousands of nodes, so the first lookup compiles it into
+ * an index with a perfect hash table of node names and a table of all
+ * 64K addresses. The index is kept in /etc/decnet.conf.idx (if we are
+ * allowed to write it) so other processes just map it. It is rebuilt
+ * whenever decnet.conf changes.
+ *
+ * The index gives the same answers as reading the file did: the first
+ * line for a name or address wins, and a bad line hides everything
+ * after it.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "nodeindex.h"
+
+#define NODE_CONF  SYSCONF_PREFIX "/etc/decnet.conf"
+#define NODE_INDEX SYSCONF_PREFIX "/etc/decnet.conf.idx"
+
+#define INDEX_MAGIC   "DNNODES1"
+#define NUM_ADDRS     65536
+#define MAX_SEED_TRIES 100000
+
+struct idx_header
+{
+	char     magic[8];
+	uint32_t length;	/* Of the whole index */
+	uint32_t flags;
+	uint64_t conf_dev;	/* The decnet.conf it was made from */
+	uint64_t conf_ino;
+	int64_t  conf_size;
+	int64_t  conf_mtime;
+	int64_t  conf_mtime_nsec;
+	uint32_t num_nodes;
+	uint32_t num_buckets;
+	uint32_t num_slots;
+	uint32_t strings_len;
+	/* Offsets of the tables from the start of the index */
+	uint32_t nodes;		/* struct idx_node[num_nodes] */
+	uint32_t seeds;		/* uint32_t[num_buckets] */
+	uint32_t slots;		/* uint32_t[num_slots], node number+1 */
+	uint32_t addrs;		/* uint32_t[NUM_ADDRS], node number+1 */
+	uint32_t strings;
+};
+
+/* flags */
+#define IDX_BAD_SYNTAX 1
+
+struct idx_node
+{
+	uint32_t name;		/* Offset in strings */
+	int32_t  area;
+	int32_t  node;
+};
+
+/*
+ * The index in use. When decnet.conf changes the old one is put on the
+ * retired list because another thread could still be looking at it.
+ * Lookups count themselves in 'readers' and the retired indexes are
+ * freed by the first one to find that nobody else is looking.
+ */
+struct loaded_index
+{
+	const struct idx_header *idx;
+	int                      mapped;	/* Or malloced */
+	struct loaded_index     *next;		/* On the retired list */
+};
+
+static struct loaded_index *current;
+static struct loaded_index *retired;
+static int                  readers;
+
+/* Things we need while building the index */
+struct builder
+{
+	struct idx_node *nodes;
+	uint32_t         num_nodes;
+	uint32_t         nodes_size;
+	char            *strings;
+	uint32_t         strings_len;
+	uint32_t         strings_size;
+	uint32_t        *names;		/* Open hash of names so far */
+	uint32_t         names_size;
+	uint32_t        *addrs;
+	uint32_t         flags;
+};
+
+/*--------------------------------------------------------------------------*/
+static uint32_t name_hash(const char *s, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+	while (*s)
+	{
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h;
+}
+
+static const char *node_name(const struct idx_header *idx, uint32_t n)
+{
+	const struct idx_node *nodes =
+		(const struct idx_node *)((const char *)idx + idx->nodes);
+
+	if (nodes[n].name >= idx->strings_len)
+		return "";
+	return (const char *)idx + idx->strings + nodes[n].name;
+}
+
+static int matches_conf(const struct idx_header *idx, struct stat *st)
+{
+	return idx->conf_dev        == (uint64_t)st->st_dev &&
+	       idx->conf_ino        == (uint64_t)st->st_ino &&
+	       idx->conf_size       == (int64_t)st->st_size &&
+	       idx->conf_mtime      == (int64_t)st->st_mtim.tv_sec &&
+	       idx->conf_mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Find a name in the builder's hash, returns its slot */
+static uint32_t find_name(struct builder *b, const char *name)
+{
+	uint32_t i = name_hash(name, 0) & (b->names_size-1);
+
+	while (b->names[i] &&
+	       strcmp(b->strings + b->nodes[b->names[i]-1].name, name) != 0)
+		i = (i+1) & (b->names_size-1);
+	return i;
+}
+
+static int grow_names(struct builder *b)
+{
+	uint32_t *old = b->names;
+	uint32_t  old_size = b->names_size;
+	uint32_t  i;
+
+	b->names_size = old_size ? old_size*2 : 1024;
+	b->names = calloc(b->names_size, sizeof(uint32_t));
+	if (!b->names)
+		return 0;
+
+	for (i=0; i<old_size; i++)
+	{
+		if (old[i])
+			b->names[find_name(b, b->strings + b->nodes[old[i]-1].name)] = old[i];
+	}
+	free(old);
+	return 1;
+}
+
+/* Add a line from decnet.conf */
+static int add_node(struct builder *b, const char *name, const char *addr)
+{
+	uint32_t slot;
+	uint32_t n;
+	int      area, node, len;
+	char    *end;
+	char     canon[32];
+
+	if ((b->num_nodes+1)*2 > b->names_size && !grow_names(b))
+		return 0;
+
+	slot = find_name(b, name);
+	n = b->names[slot];
+	if (!n)
+	{
+		size_t namelen = strlen(name)+1;
+
+		if (b->num_nodes == b->nodes_size)
+		{
+			struct idx_node *newnodes;
+
+			b->nodes_size = b->nodes_size ? b->nodes_size*2 : 256;
+			newnodes = realloc(b->nodes, b->nodes_size*sizeof(struct idx_node));
+			if (!newnodes)
+				return 0;
+			b->nodes = newnodes;
+		}
+		while (b->strings_len + namelen > b->strings_size)
+		{
+			char *newstrings;
+
+			b->strings_size = b->strings_size ? b->strings_size*2 : 4096;
+			newstrings = realloc(b->strings, b->strings_size);
+			if (!newstrings)
+				return 0;
+			b->strings = newstrings;
+		}
+		memcpy(b->strings + b->strings_len, name, namelen);
+
+		/* The same way dnet_addr() reads it */
+		b->nodes[b->num_nodes].name = b->strings_len;
+		b->nodes[b->num_nodes].area = strtol(addr, &end, 0);
+		b->nodes[b->num_nodes].node = *end ? strtol(end+1, &end, 0) : 0;
+		b->strings_len += namelen;
+
+		n = ++b->num_nodes;
+		b->names[slot] = n;
+	}
+
+	/*
+	 * Lookups by address compared the text with "area.node", so only
+	 * addresses written exactly like that can be found.
+	 */
+	if (sscanf(addr, "%d.%d%n", &area, &node, &len) == 2 &&
+	    area >= 0 && area <= 63 && node >= 0 && node <= 1023)
+	{
+		snprintf(canon, sizeof(canon), "%d.%d", area, node);
+		if (strcmp(canon, addr) == 0 && !b->addrs[area<<10 | node])
+			b->addrs[area<<10 | node] = n;
+	}
+	return 1;
+}
+
+/* Read decnet.conf just the way the lookup functions used to */
+static int read_conf(struct builder *b, FILE *conf)
+{
+	char nodeln[80];
+	char nodetag[80] = "", nametag[80] = "", nodeadr[80] = "", nodename[80] = "";
+
+	while (fgets(nodeln,80,conf) != NULL)
+	{
+		sscanf(nodeln,"%s%s%s%s\n",nodetag,nodeadr,nametag,nodename);
+		if (strncmp(nodetag,"#",1) != 0)
+		{
+			if (((strcmp(nodetag,"executor") != 0) &&
+			     (strcmp(nodetag,"node")     != 0)) ||
+			    (strcmp(nametag,"name")     != 0))
+			{
+				b->flags |= IDX_BAD_SYNTAX;
+				break;
+			}
+			if (!add_node(b, nodename, nodeadr))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Make the perfect hash. Names are put into buckets by one hash, then
+ * for each bucket (biggest first) we look for a seed for a second hash
+ * that puts all its names into free slots.
+ */
+struct bucket
+{
+	uint32_t bucket;
+	uint32_t count;
+	uint32_t first;
+};
+
+static int compare_buckets(const void *a, const void *b)
+{
+	return ((const struct bucket *)b)->count - ((const struct bucket *)a)->count;
+}
+
+static int make_hash(struct builder *b, uint32_t num_buckets, uint32_t num_slots,
+		     uint32_t *seeds, uint32_t *slots)
+{
+	struct bucket *buckets = calloc(num_buckets, sizeof(struct bucket));
+	uint32_t      *members = malloc((b->num_nodes+1) * sizeof(uint32_t));
+	uint32_t      *fill    = calloc(num_buckets, sizeof(uint32_t));
+	uint32_t       want[64];
+	uint32_t       i, j, k;
+	int            ok = 0;
+
+	if (!buckets || !members || !fill)
+		goto out;
+
+	memset(slots, 0, num_slots * sizeof(uint32_t));
+	for (i=0; i<num_buckets; i++)
+		buckets[i].bucket = i;
+	for (i=0; i<b->num_nodes; i++)
+		buckets[name_hash(b->strings + b->nodes[i].name, 0) % num_buckets].count++;
+	for (i=1; i<num_buckets; i++)
+		buckets[i].first = buckets[i-1].first + buckets[i-1].count;
+	for (i=0; i<b->num_nodes; i++)
+	{
+		uint32_t bk = name_hash(b->strings + b->nodes[i].name, 0) % num_buckets;
+		members[buckets[bk].first + fill[bk]++] = i;
+	}
+	qsort(buckets, num_buckets, sizeof(struct bucket), compare_buckets);
+
+	for (i=0; i<num_buckets; i++)
+	{
+		struct bucket *bk = &buckets[i];
+		uint32_t seed;
+
+		seeds[bk->bucket] = 0;
+		if (bk->count == 0)
+			continue;
+		if (bk->count > sizeof(want)/sizeof(want[0]))
+			goto out;
+
+		for (seed=1; seed<MAX_SEED_TRIES; seed++)
+		{
+			for (j=0; j<bk->count; j++)
+			{
+				const char *name = b->strings + b->nodes[members[bk->first+j]].name;
+
+				want[j] = name_hash(name, seed) % num_slots;
+				if (slots[want[j]])
+					break;
+				for (k=0; k<j; k++)
+					if (want[k] == want[j])
+						break;
+				if (k < j)
+					break;
+			}
+			if (j == bk->count)
+				break;
+		}
+		if (seed == MAX_SEED_TRIES)
+			goto out;
+
+		seeds[bk->bucket] = seed;
+		for (j=0; j<bk->count; j++)
+			slots[want[j]] = members[bk->first+j]+1;
+	}
+	ok = 1;
+
+out:
+	free(buckets);
+	free(members);
+	free(fill);
+	return ok;
+}
+
+/* Compile decnet.conf, returns a malloced index */
+static struct idx_header *build_index(struct stat *st)
+{
+	struct builder     b;
+	struct idx_header *idx = NULL;
+	FILE              *conf;
+	uint32_t           num_buckets, num_slots;
+	size_t             len;
+	char              *base;
+
+	memset(&b, 0, sizeof(b));
+	if ((conf = fopen(NODE_CONF, "r")) == NULL)
+		return NULL;
+
+	b.addrs = calloc(NUM_ADDRS, sizeof(uint32_t));
+	if (!b.addrs || !grow_names(&b) || !read_conf(&b, conf))
+		goto out;
+
+	num_buckets = b.num_nodes/4 + 1;
+	num_slots   = b.num_nodes + b.num_nodes/4 + 1;
+
+	len = sizeof(struct idx_header) +
+		b.num_nodes * sizeof(struct idx_node) +
+		(num_buckets + NUM_ADDRS) * sizeof(uint32_t) +
+		num_slots * sizeof(uint32_t) * 2 +	/* Room to try again */
+		b.strings_len;
+	base = calloc(1, len);
+	if (!base)
+		goto out;
+	idx = (struct idx_header *)base;
+
+	idx->nodes = sizeof(struct idx_header);
+	idx->seeds = idx->nodes + b.num_nodes * sizeof(struct idx_node);
+	idx->addrs = idx->seeds + num_buckets * sizeof(uint32_t);
+	idx->slots = idx->addrs + NUM_ADDRS * sizeof(uint32_t);
+
+	/* If it won't fit, more slots make it easier */
+	while (!make_hash(&b, num_buckets, num_slots,
+			  (uint32_t *)(base + idx->seeds),
+			  (uint32_t *)(base + idx->slots)))
+	{
+		if (num_slots >= (b.num_nodes + b.num_nodes/4 + 1) * 2)
+		{
+			free(base);
+			idx = NULL;
+			goto out;
+		}
+		num_slots += num_slots/4 + 1;
+		if (num_slots > (b.num_nodes + b.num_nodes/4 + 1) * 2)
+			num_slots = (b.num_nodes + b.num_nodes/4 + 1) * 2;
+	}
+
+	idx->strings = idx->slots + num_slots * sizeof(uint32_t);
+	memcpy(idx->magic, INDEX_MAGIC, sizeof(idx->magic));
+	idx->length          = idx->strings + b.strings_len;
+	idx->flags           = b.flags;
+	idx->conf_dev        = st->st_dev;
+	idx->conf_ino        = st->st_ino;
+	idx->conf_size       = st->st_size;
+	idx->conf_mtime      = st->st_mtim.tv_sec;
+	idx->conf_mtime_nsec = st->st_mtim.tv_nsec;
+	idx->num_nodes       = b.num_nodes;
+	idx->num_buckets     = num_buckets;
+	idx->num_slots       = num_slots;
+	idx->strings_len     = b.strings_len;
+	memcpy(base + idx->nodes, b.nodes, b.num_nodes * sizeof(struct idx_node));
+	memcpy(base + idx->addrs, b.addrs, NUM_ADDRS * sizeof(uint32_t));
+	memcpy(base + idx->strings, b.strings, b.strings_len);
+
+out:
+	fclose(conf);
+	free(b.nodes);
+	free(b.strings);
+	free(b.names);
+	free(b.addrs);
+	return idx;
+}
+
+/* Write the index for everyone else to use. Only root can do this. */
+static void save_index(const struct idx_header *idx)
+{
+	char tmpname[] = NODE_INDEX ".XXXXXX";
+	int  fd;
+
+	fd = mkstemp(tmpname);
+	if (fd == -1)
+		return;
+
+	if (fchmod(fd, 0644) ||
+	    write(fd, idx, idx->length) != (ssize_t)idx->length ||
+	    close(fd))
+	{
+		unlink(tmpname);
+		return;
+	}
+	if (rename(tmpname, NODE_INDEX))
+		unlink(tmpname);
+}
+
+/* Map the saved index if it's up to date */
+static const struct idx_header *load_index(struct stat *conf_st)
+{
+	const struct idx_header *idx;
+	struct stat st;
+	void  *map;
+	int    fd;
+
+	fd = open(NODE_INDEX, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	/* Only believe it if it's from someone who could write decnet.conf */
+	if (fstat(fd, &st) ||
+	    (st.st_uid != 0 && st.st_uid != conf_st->st_uid) ||
+	    st.st_size < (off_t)sizeof(struct idx_header))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	idx = map;
+	if (memcmp(idx->magic, INDEX_MAGIC, sizeof(idx->magic)) != 0 ||
+	    idx->length != (uint64_t)st.st_size ||
+	    !matches_conf(idx, conf_st) ||
+	    idx->num_buckets == 0 || idx->num_slots == 0 ||
+	    idx->seeds != idx->nodes + (uint64_t)idx->num_nodes * sizeof(struct idx_node) ||
+	    idx->addrs != idx->seeds + (uint64_t)idx->num_buckets * sizeof(uint32_t) ||
+	    idx->slots != idx->addrs + NUM_ADDRS * sizeof(uint32_t) ||
+	    idx->strings != idx->slots + (uint64_t)idx->num_slots * sizeof(uint32_t) ||
+	    idx->length != idx->strings + (uint64_t)idx->strings_len ||
+	    (idx->strings_len && ((const char *)idx)[idx->length-1] != '\0'))
+	{
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	return idx;
+}
+
+static void free_index(struct loaded_index *li)
+{
+	if (li->mapped)
+		munmap((void *)li->idx, li->idx->length);
+	else
+		free((void *)li->idx);
+	free(li);
+}
+
+/* Put a list of indexes (first...last) on the retired list */
+static void retire(struct loaded_index *first, struct loaded_index *last)
+{
+	last->next = __atomic_load_n(&retired, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&retired, &last->next, first, 1,
+					    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Free the retired indexes if there are no lookups going on. Everything
+ * on the list we take was replaced before we count the readers, so a
+ * lookup that could still be using one of them is counted.
+ */
+static void free_retired(void)
+{
+	struct loaded_index *list, *last;
+
+	if (!__atomic_load_n(&retired, __ATOMIC_RELAXED))
+		return;
+
+	list = __atomic_exchange_n(&retired, NULL, __ATOMIC_SEQ_CST);
+	if (!list)
+		return;
+
+	if (__atomic_load_n(&readers, __ATOMIC_SEQ_CST) == 0)
+	{
+		while (list)
+		{
+			last = list->next;
+			free_index(list);
+			list = last;
+		}
+		return;
+	}
+
+	/* Still in use, perhaps. Put them back for next time */
+	for (last = list; last->next; last = last->next)
+		;
+	retire(list, last);
+}
+
+/*
+ * Get an index that is up to date with decnet.conf. If this returns an
+ * index then the caller must call put_index() when it has finished
+ * with it.
+ */
+static struct loaded_index *get_index(void)
+{
+	struct loaded_index *li, *old;
+	struct idx_header   *built;
+	struct stat st;
+
+	__atomic_add_fetch(&readers, 1, __ATOMIC_SEQ_CST);
+	li = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+
+	if (stat(NODE_CONF, &st))
+		goto fail;
+
+	if (li && matches_conf(li->idx, &st))
+		return li;
+
+	li = malloc(sizeof(*li));
+	if (!li)
+		goto fail;
+
+	li->mapped = 1;
+	li->idx = load_index(&st);
+	if (!li->idx)
+	{
+		built = build_index(&st);
+		if (built)
+			save_index(built);
+		li->mapped = 0;
+		li->idx = built;
+	}
+	if (!li->idx)
+	{
+		free(li);
+		goto fail;
+	}
+
+	/* Anyone still using the old one has it counted in 'readers' */
+	old = __atomic_exchange_n(&current, li, __ATOMIC_SEQ_CST);
+	if (old)
+		retire(old, old);
+	return li;
+
+ fail:
+	__atomic_sub_fetch(&readers, 1, __ATOMIC_SEQ_CST);
+	free_retired();
+	return NULL;
+}
+
+static void put_index(void)
+{
+	__atomic_sub_fetch(&readers, 1, __ATOMIC_SEQ_CST);
+	free_retired();
+}
+
+static void copy_name(struct nodeidx_entry *e, const struct idx_header *idx,
+		      uint32_t n)
+{
+	snprintf(e->name, sizeof(e->name), "%s", node_name(idx, n));
+}
+
+/*--------------------------------------------------------------------------*/
+int dnet_nodeidx_byname(const char *name, struct nodeidx_entry *e)
+{
+	struct loaded_index *li = get_index();
+	const struct idx_header *idx;
+	const uint32_t *seeds, *slots;
+	const struct idx_node *nodes;
+	uint32_t n;
+	int ret;
+
+	if (!li)
+		return NODEIDX_NO_CONF;
+	idx = li->idx;
+
+	seeds = (const uint32_t *)((const char *)idx + idx->seeds);
+	slots = (const uint32_t *)((const char *)idx + idx->slots);
+	nodes = (const struct idx_node *)((const char *)idx + idx->nodes);
+
+	n = slots[name_hash(name, seeds[name_hash(name, 0) % idx->num_buckets]) %
+		  idx->num_slots];
+	if (n && n <= idx->num_nodes && strcmp(node_name(idx, n-1), name) == 0)
+	{
+		copy_name(e, idx, n-1);
+		e->area = nodes[n-1].area;
+		e->node = nodes[n-1].node;
+		ret = NODEIDX_FOUND;
+	}
+	else if (idx->flags & IDX_BAD_SYNTAX)
+		ret = NODEIDX_BAD_SYNTAX;
+	else
+		ret = NODEIDX_NOT_FOUND;
+
+	put_index();
+	return ret;
+}
+
+int dnet_nodeidx_byaddr(int area, int node, struct nodeidx_entry *e)
+{
+	struct loaded_index *li = get_index();
+	const struct idx_header *idx;
+	const uint32_t *addrs;
+	uint32_t n;
+	int ret;
+
+	if (!li)
+		return NODEIDX_NO_CONF;
+	idx = li->idx;
+
+	addrs = (const uint32_t *)((const char *)idx + idx->addrs);
+	n = addrs[(area << 10 | node) & (NUM_ADDRS-1)];
+	if (n && n <= idx->num_nodes)
+	{
+		copy_name(e, idx, n-1);
+		e->area = area;
+		e->node = node;
+		ret = NODEIDX_FOUND;
+	}
+	else if (idx->flags & IDX_BAD_SYNTAX)
+		ret = NODEIDX_BAD_SYNTAX;
+	else
+		ret = NODEIDX_NOT_FOUND;
+
+	put_index();
+	return ret;
+}
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,25 @@
+/*
+ * nodeindex.h
+ *
+ * Private to libdnet. The compiled index of decnet.conf used by the
+ * node name & address lookup functions.
+ */
+
+/* Return codes */
+#define NODEIDX_FOUND      0
+#define NODEIDX_NOT_FOUND  1
+#define NODEIDX_NO_CONF    2	/* decnet.conf can't be read */
+#define NODEIDX_BAD_SYNTAX 3	/* Not before a bad line, can't say after */
+
+/* decnet.conf lines are read 80 characters at a time */
+#define NODEIDX_NAME_MAX 79
+
+struct nodeidx_entry
+{
+	char        name[NODEIDX_NAME_MAX+1];
+	int         area;	/* Address as dnet_addr() reads it, */
+	int         node;	/* not necessarily valid */
+};
+
+extern int dnet_nodeidx_byname(const char *name, struct nodeidx_entry *e);
+extern int dnet_nodeidx_byaddr(int area, int node, struct nodeidx_entry *e);
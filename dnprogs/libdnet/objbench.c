@@ -0,0 +1,273 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+*/
+
+/*
+ * Microbenchmark for the dnetd.conf object table.
+ *
+ * Looks every object in dnetd.conf (and a few that aren't) up by name
+ * and by number, first by reading the file the way libdnet used to and
+ * then through the table, checks they agree and prints the times. With
+ * -t the table lookups are also run in several threads at once.
+ *
+ * This is built with "make objbench" in the libdnet directory and is
+ * not installed.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "objindex.h"
+
+#define MAX_OBJS 256
+
+static char names[MAX_OBJS][16];
+static int  nums[MAX_OBJS];
+static int  num_objs;
+static int  iterations = 10000;
+static int  failures;
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+/* The lookups as they were before the table */
+static int scan_byname(const char * name) {
+ FILE * dnd;
+ int    found = -1;
+ int    curr;
+ char   line[1024], cname[16], rest[1024];
+
+ cname[15] = 0;
+
+ if ( (dnd = fopen(DNETD_FILE, "r")) == NULL ) {
+  return -1;
+ }
+
+ while (fgets(line, 1024, dnd) != NULL) {
+  if ( sscanf(line, "%15s %i %1024s\n", cname, &curr, rest) == 3 ) {
+   if ( *cname != '#' && strcasecmp(name, cname) == 0 ) {
+    found = curr;
+    break;
+   }
+  }
+ }
+
+ fclose(dnd);
+
+ if ( found == -1 )
+  errno = ENOENT;
+
+ return found;
+}
+
+static const char * scan_bynumber(int num) {
+ FILE * dnd;
+ int    curr;
+ static char   cname[16];
+ char   line[1024], rest[1024];
+
+ cname[15] = 0;
+
+ if ( (dnd = fopen(DNETD_FILE, "r")) == NULL ) {
+  return NULL;
+ }
+
+ while (fgets(line, 1024, dnd) != NULL) {
+  if ( sscanf(line, "%15s %i %1024s\n", cname, &curr, rest) == 3 ) {
+   if ( *cname != '#' && num == curr ) {
+    fclose(dnd);
+    return cname;
+   }
+  }
+ }
+
+ fclose(dnd);
+
+ errno = ENOENT;
+ return NULL;
+}
+
+/* Everything to look up: what's in the file, in other cases, and
+   some things that aren't there */
+static void get_objects(void)
+{
+	FILE *dnd;
+	char  line[1024], rest[1024];
+	int   i, n;
+
+	if ((dnd = fopen(DNETD_FILE, "r")) == NULL)
+	{
+		perror(DNETD_FILE);
+		exit(2);
+	}
+	while (fgets(line, 1024, dnd) != NULL && num_objs < MAX_OBJS/2)
+	{
+		names[num_objs][15] = 0;
+		if (sscanf(line, "%15s %i %1024s\n", names[num_objs],
+			   &nums[num_objs], rest) == 3)
+			num_objs++;
+	}
+	fclose(dnd);
+
+	n = num_objs;
+	for (i = 0; i < n; i++)
+	{
+		char *c;
+
+		strcpy(names[num_objs], names[i]);
+		for (c = names[num_objs]; *c; c++)
+			*c = (*c >= 'A' && *c <= 'Z') ? *c + 32 : *c;
+		nums[num_objs++] = nums[i] + 1;
+	}
+	for (i = 0; i < 4 && num_objs < MAX_OBJS; i++)
+	{
+		sprintf(names[num_objs], "NOSUCH%d", i);
+		nums[num_objs++] = 200 + i;
+	}
+	strcpy(names[num_objs], "*");
+	nums[num_objs++] = 1000;
+}
+
+static void check(void)
+{
+	int i;
+
+	for (i = 0; i < num_objs; i++)
+	{
+		const char *s;
+		int   a = scan_byname(names[i]);
+		int   b = dnet_objidx_byname(names[i]);
+		int   t;
+		char  sname[16] = "", tname[OBJIDX_NAME_MAX+1] = "";
+
+		if (a != b)
+		{
+			printf("FAIL: %s: file %d, table %d\n", names[i], a, b);
+			failures++;
+		}
+		if ((s = scan_bynumber(nums[i])))
+			strcpy(sname, s);
+		t = dnet_objidx_bynumber(nums[i], tname);
+		if (!s != (t == -1) || strcmp(sname, tname))
+		{
+			printf("FAIL: %d: file %s, table %s\n", nums[i],
+			       s ? sname : "(none)", t == 0 ? tname : "(none)");
+			failures++;
+		}
+	}
+}
+
+static void *table_thread(void *arg)
+{
+	int i, j;
+
+	for (j = 0; j < iterations; j++)
+		for (i = 0; i < num_objs; i++)
+		{
+			char name[OBJIDX_NAME_MAX+1];
+
+			dnet_objidx_byname(names[i]);
+			dnet_objidx_bynumber(nums[i], name);
+		}
+	return NULL;
+}
+
+static void usage(char *prog, FILE *f)
+{
+	fprintf(f, "%s options:\n", prog);
+	fprintf(f, " -n<num>   Number of times to look everything up (default 10000)\n");
+	fprintf(f, " -t<num>   Also run the table lookups in this many threads\n");
+	fprintf(f, " -h        Help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	double start, file_time, table_time;
+	int    threads = 0;
+	int    opt, i, j;
+
+	while ((opt = getopt(argc, argv, "?hn:t:")) != EOF)
+	{
+		switch (opt)
+		{
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+
+		case '?':
+			usage(argv[0], stderr);
+			exit(2);
+
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+
+		case 't':
+			threads = atoi(optarg);
+			break;
+		}
+	}
+
+	get_objects();
+	check();
+
+	start = now();
+	for (j = 0; j < iterations; j++)
+		for (i = 0; i < num_objs; i++)
+		{
+			scan_byname(names[i]);
+			scan_bynumber(nums[i]);
+		}
+	file_time = now() - start;
+
+	start = now();
+	table_thread(NULL);
+	table_time = now() - start;
+
+	printf("%d lookups of %d objects\n", iterations * num_objs * 2, num_objs);
+	printf("file scan: %8.3fs %10.0f lookups/s\n", file_time,
+	       iterations * num_objs * 2 / file_time);
+	printf("table:     %8.3fs %10.0f lookups/s\n", table_time,
+	       iterations * num_objs * 2 / table_time);
+
+	if (threads > 0)
+	{
+		pthread_t *tids = malloc(threads * sizeof(pthread_t));
+
+		start = now();
+		for (i = 0; i < threads; i++)
+			pthread_create(&tids[i], NULL, table_thread, NULL);
+		for (i = 0; i < threads; i++)
+			pthread_join(tids[i], NULL);
+		table_time = now() - start;
+		printf("table, %d threads: %8.3fs %10.0f lookups/s\n", threads,
+		       table_time, threads * iterations * num_objs * 2 / table_time);
+		free(tids);
+		check();
+	}
+
+	if (failures)
+		printf("%d FAILURES\n", failures);
+	return failures != 0;
+}
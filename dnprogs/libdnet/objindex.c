@@ -0,0 +1,309 @@
+/******************************************************************************
+    (c) 2026 The dnprogs contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Parsed copy of /etc/dnetd.conf.
+ *
+ * dnet_conn() looks the object up on every connection, and that used
+ * to mean reading dnetd.conf each time. Now it is read once into a
+ * table with a case-insensitive hash of the names and a direct table
+ * of object numbers 0-255, and read again only when it changes. We
+ * look to see if it has changed at most once a second.
+ *
+ * A table is never changed once it has been made, so any number of
+ * threads can use it. When dnetd.conf changes a new one replaces it and
+ * the old one is freed, as the node index does, once no lookup is
+ * counted in 'readers'. Names are copied out before that.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include "objindex.h"
+
+#define NUM_OBJNUMS 256
+
+struct obj_entry
+{
+	char name[OBJIDX_NAME_MAX+1];
+	int  num;
+	int  next;		/* In the hash chain, -1 at the end */
+};
+
+struct obj_table
+{
+	dev_t             dev;	/* The dnetd.conf it was made from */
+	ino_t             ino;
+	off_t             size;
+	struct timespec   mtime;
+	int               num_entries;
+	int               hash_size;	/* Power of 2 */
+	int              *hash;		/* First entry in each chain or -1 */
+	int               bynum[NUM_OBJNUMS]; /* First entry with number or -1 */
+	struct obj_entry *entries;	/* In file order */
+	struct obj_table *next;		/* On the retired list */
+};
+
+static struct obj_table *current;
+static struct obj_table *retired;
+static int               readers;
+static time_t            last_check;
+
+static unsigned int name_hash(const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (unsigned char)tolower((unsigned char)*name++)) * 16777619U;
+	return h;
+}
+
+static int same_file(const struct obj_table *t, struct stat *st)
+{
+	return t->dev            == st->st_dev &&
+	       t->ino            == st->st_ino &&
+	       t->size           == st->st_size &&
+	       t->mtime.tv_sec   == st->st_mtim.tv_sec &&
+	       t->mtime.tv_nsec  == st->st_mtim.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Read dnetd.conf into a new table. Lines are taken exactly as the old
+   lookup functions took them, and the first one for a name or number
+   wins */
+static struct obj_table *read_table(void)
+{
+	struct obj_table *t;
+	struct stat st;
+	FILE  *dnd;
+	int    entries_size = 32;
+	int    curr, i;
+	char   line[1024], cname[OBJIDX_NAME_MAX+1], rest[1024];
+
+	cname[OBJIDX_NAME_MAX] = 0; // work around bugy *scanf()s
+
+	if ( (dnd = fopen(DNETD_FILE, "r")) == NULL )
+		return NULL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t || fstat(fileno(dnd), &st))
+		goto fail;
+
+	t->dev   = st.st_dev;
+	t->ino   = st.st_ino;
+	t->size  = st.st_size;
+	t->mtime = st.st_mtim;
+	t->entries = malloc(entries_size * sizeof(struct obj_entry));
+	if (!t->entries)
+		goto fail;
+
+	while (fgets(line, 1024, dnd) != NULL) {
+		if ( sscanf(line, "%15s %i %1023s\n", cname, &curr, rest) == 3 &&
+		     *cname != '#' ) {
+			if (t->num_entries == entries_size) {
+				struct obj_entry *e;
+
+				entries_size *= 2;
+				e = realloc(t->entries, entries_size * sizeof(struct obj_entry));
+				if (!e)
+					goto fail;
+				t->entries = e;
+			}
+			strcpy(t->entries[t->num_entries].name, cname);
+			t->entries[t->num_entries].num  = curr;
+			t->entries[t->num_entries].next = -1;
+			t->num_entries++;
+		}
+	}
+	fclose(dnd);
+	dnd = NULL;
+
+	t->hash_size = 16;
+	while (t->hash_size < t->num_entries*2)
+		t->hash_size *= 2;
+	t->hash = malloc(t->hash_size * sizeof(int));
+	if (!t->hash)
+		goto fail;
+	memset(t->hash, 0xff, t->hash_size * sizeof(int));
+	memset(t->bynum, 0xff, sizeof(t->bynum));
+
+	for (i = 0; i < t->num_entries; i++) {
+		struct obj_entry *e = &t->entries[i];
+		int *link = &t->hash[name_hash(e->name) & (t->hash_size-1)];
+
+		/* Later duplicates stay in the list for number lookups but
+		   are never found by name */
+		while (*link != -1 && strcasecmp(t->entries[*link].name, e->name))
+			link = &t->entries[*link].next;
+		if (*link == -1)
+			*link = i;
+
+		if (e->num >= 0 && e->num < NUM_OBJNUMS && t->bynum[e->num] == -1)
+			t->bynum[e->num] = i;
+	}
+	return t;
+
+ fail:
+	if (dnd)
+		fclose(dnd);
+	if (t) {
+		free(t->entries);
+		free(t);
+	}
+	errno = ENOMEM;
+	return NULL;
+}
+
+static void free_table(struct obj_table *t)
+{
+	free(t->hash);
+	free(t->entries);
+	free(t);
+}
+
+/* Put a table on the retired list */
+static void retire(struct obj_table *first, struct obj_table *last)
+{
+	last->next = __atomic_load_n(&retired, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&retired, &last->next, first, 1,
+					    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		;
+}
+
+/* Free the retired tables if there are no lookups going on */
+static void free_retired(void)
+{
+	struct obj_table *list, *last;
+
+	if (!__atomic_load_n(&retired, __ATOMIC_RELAXED))
+		return;
+
+	list = __atomic_exchange_n(&retired, NULL, __ATOMIC_SEQ_CST);
+	if (!list)
+		return;
+
+	if (__atomic_load_n(&readers, __ATOMIC_SEQ_CST) == 0) {
+		while (list) {
+			last = list->next;
+			free_table(list);
+			list = last;
+		}
+		return;
+	}
+
+	/* Still in use, perhaps. Put them back for next time */
+	for (last = list; last->next; last = last->next)
+		;
+	retire(list, last);
+}
+
+static void put_table(void)
+{
+	__atomic_sub_fetch(&readers, 1, __ATOMIC_SEQ_CST);
+	free_retired();
+}
+
+/* Get a table that is up to date with dnetd.conf. If this returns a
+   table then the caller must call put_table() when it has finished
+   with it. */
+static const struct obj_table *get_table(void)
+{
+	struct obj_table *t, *old;
+	time_t now = time(NULL);
+	struct stat st;
+
+	__atomic_add_fetch(&readers, 1, __ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+
+	if (t && __atomic_load_n(&last_check, __ATOMIC_RELAXED) == now)
+		return t;
+	__atomic_store_n(&last_check, now, __ATOMIC_RELAXED);
+
+	if (stat(DNETD_FILE, &st))
+		t = NULL;
+	else if (t && same_file(t, &st))
+		return t;
+	else
+		t = read_table();
+
+	/* Anyone still using the old one has it counted in 'readers' */
+	old = __atomic_exchange_n(&current, t, __ATOMIC_SEQ_CST);
+	if (old)
+		retire(old, old);
+	if (!t)
+		put_table();
+	return t;
+}
+
+/*--------------------------------------------------------------------------*/
+int dnet_objidx_byname(const char *name)
+{
+	const struct obj_table *t = get_table();
+	int i, num = -1;
+
+	if (!t)
+		return -1;
+
+	for (i = t->hash[name_hash(name) & (t->hash_size-1)]; i != -1;
+	     i = t->entries[i].next) {
+		if (strcasecmp(name, t->entries[i].name) == 0) {
+			num = t->entries[i].num;
+			break;
+		}
+	}
+
+	put_table();
+	if (num == -1)
+		errno = ENOENT;
+	return num;
+}
+
+int dnet_objidx_bynumber(int num, char *name)
+{
+	const struct obj_table *t = get_table();
+	int i, found = -1;
+
+	if (!t)
+		return -1;
+
+	if (num >= 0 && num < NUM_OBJNUMS)
+		found = t->bynum[num];
+	else {
+		for (i = 0; i < t->num_entries; i++)
+			if (t->entries[i].num == num) {
+				found = i;
+				break;
+			}
+	}
+	if (found != -1)
+		strcpy(name, t->entries[found].name);
+
+	put_table();
+	if (found == -1) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,16 @@
+/*
+ * objindex.h
+ *
+ * Private to libdnet. The parsed copy of dnetd.conf used by
+ * getobjectbyname() & getobjectbynumber().
+ */
+
+#define DNETD_FILE SYSCONF_PREFIX "/etc/dnetd.conf"
+
+#define OBJIDX_NAME_MAX 15
+
+/* Both return -1 with errno set if the object isn't there.
+   dnet_objidx_bynumber() copies the name into 'name', which must have
+   room for OBJIDX_NAME_MAX+1 characters. */
+extern int dnet_objidx_byname(const char *name);
+extern int dnet_objidx_bynumber(int num, char *name);
@@ -0,0 +1,300 @@
+/*
+    batch.cc from librms
+
+    Copyright (C) 2026 The dnprogs contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Batched rms_write/rms_update/rms_delete.
+//
+// Normally each of these sends its CONTROL (and DATA) and then waits for
+// FAL's STATUS, so loading a file goes at one record per round trip.
+// Once rms_write_batch() has been called they are sent in blocked DAP
+// messages and we only wait for a STATUS when there are more than
+// batch_max of them outstanding. STATUSes are counted off as they arrive
+// so an error can be tied back to the operation that caused it;
+// rms_flush() waits for the rest and says which one (if any) failed.
+//
+// FAL doesn't read anything more from us while it is waiting to send a
+// reply, so if we let a write block while there are replies for us to
+// read then neither end would ever move again. Writes in a batch are
+// non-blocking and if the link is full we read replies until it isn't.
+//
+// Every other librms call leaves FAL's reply to it on the link until
+// the next call reads it, so before a batch starts we ask for the file
+// attributes and read up to the ACK after them. After that the next
+// STATUS is the reply to the first operation in the batch.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdnet/dn.h>
+#include <netdnet/dnetdb.h>
+#include "connection.h"
+#include "protocol.h"
+#include "rms.h"
+#include "rmsp.h"
+
+// Read anything that was waiting before the batch started
+static bool resync(rms_conn *rc)
+{
+    dap_connection *conn = (dap_connection *)rc->conn;
+    bool got_attrib = false;
+
+    dap_control_message ctl;
+    ctl.set_ctlfunc(dap_control_message::DISPLAY);
+    ctl.set_display(dap_access_message::DISPLAY_MAIN_MASK);
+    if (!ctl.write(*conn))
+    {
+	rc->lasterror = conn->get_error();
+	return false;
+    }
+
+    for (;;)
+    {
+	dap_message *m = dap_message::read_message(*conn, true);
+	if (!m)
+	{
+	    rc->lasterror = conn->get_error();
+	    return false;
+	}
+
+	int type = m->get_type();
+	if (type == dap_message::ATTRIB)
+	    got_attrib = true;
+
+	if (type == dap_message::STATUS && got_attrib)
+	{
+	    // DISPLAY itself failed
+	    if (check_status(rc, m) != 0) return false;
+	    continue;
+	}
+	delete m;
+
+	if (type == dap_message::ACK && got_attrib)
+	    break;
+    }
+    rc->in_step = true;
+    return true;
+}
+
+// Take one reply off the link. Returns false if the link failed, or if
+// 'wait' isn't set and there was nothing there.
+static bool collect_reply(rms_conn *rc, bool wait)
+{
+    dap_connection *conn = (dap_connection *)rc->conn;
+
+    dap_message *m = dap_message::read_message(*conn, wait);
+    if (!m)
+    {
+	if (wait) rc->lasterror = conn->get_error();
+	return false;
+    }
+
+    if (m->get_type() != dap_message::STATUS)
+    {
+	delete m;
+	return true;
+    }
+
+    dap_status_message *sm = (dap_status_message *)m;
+    int code = sm->get_code() & 0xFF;
+
+    if (code != 0225 && rc->batch_failed == -1)
+    {
+	rc->batch_failed = rc->batch_replies;
+	rc->batch_code   = code;
+	rc->batch_error  = (char *)sm->get_message();
+    }
+    rc->batch_replies++;
+    delete m;
+    return true;
+}
+
+// Make writes non-blocking. Returns the flags to put back.
+static int start_write(dap_connection *conn)
+{
+    int flags = fcntl(conn->get_fd(), F_GETFL, 0);
+
+    fcntl(conn->get_fd(), F_SETFL, flags | O_NONBLOCK);
+    return flags;
+}
+
+// If a write couldn't go because the link was full then read replies
+// until it can. 'written' is what the write returned, 'unblocking' says
+// it was set_blocked(false) sending the saved-up output rather than
+// write() sending a message.
+static bool finish_write(rms_conn *rc, bool written, int flags,
+			 bool unblocking)
+{
+    dap_connection *conn = (dap_connection *)rc->conn;
+
+    while (!written && errno == EAGAIN)
+    {
+	struct pollfd pfd;
+
+	pfd.fd      = conn->get_fd();
+	pfd.events  = POLLIN | POLLOUT;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, -1) < 0)
+	{
+	    if (errno != EINTR) break;
+	    pfd.revents = 0;
+	}
+
+	if (pfd.revents & POLLIN)
+	{
+	    while (rc->batch_replies < rc->batch_sent && collect_reply(rc, false))
+		;
+	}
+
+	// The output is still in the buffer, so just try again. A failed
+	// set_blocked(false) has already switched blocking off, so put it
+	// back on and switch it off again to resend all that was saved.
+	errno = EAGAIN;
+	if (pfd.revents & (POLLOUT | POLLERR | POLLHUP))
+	{
+	    if (unblocking)
+	    {
+		conn->set_blocked(true);
+		written = conn->set_blocked(false);
+	    }
+	    else
+		written = conn->write();
+	}
+    }
+    fcntl(conn->get_fd(), F_SETFL, flags);
+
+    if (!written)
+	rc->lasterror = conn->get_error();
+    return written;
+}
+
+// Send a CONTROL message (and DATA if there is any) without waiting for
+// the reply. Returns its index in the batch.
+int rms_batch_send(rms_conn *rc, dap_control_message *ctl, char *buf, int len)
+{
+    dap_connection *conn = (dap_connection *)rc->conn;
+
+    // Don't make things worse
+    if (rc->batch_failed != -1)
+    {
+	rc->lasterr   = rc->batch_code;
+	rc->lasterror = rc->batch_error;
+	return -1;
+    }
+
+    if (!rc->in_step && !resync(rc)) return -1;
+
+    conn->set_blocked(true);
+    int flags = start_write(conn);
+    if (!finish_write(rc, ctl->write(*conn), flags, false)) return -1;
+
+    if (buf)
+    {
+	dap_data_message data;
+	bool status;
+
+	data.set_data(buf, len);
+	flags = start_write(conn);
+	if (len >= 256)
+	    status = data.write_with_len256(*conn);
+	else
+	    status = data.write_with_len(*conn);
+	if (!finish_write(rc, status, flags, false)) return -1;
+    }
+    rc->batch_sent++;
+
+    // Pick up whatever replies have already arrived and, if that still
+    // leaves too many outstanding, send what we have and wait for some.
+    while (rc->batch_replies < rc->batch_sent && collect_reply(rc, false))
+	;
+    if (rc->batch_sent - rc->batch_replies > rc->batch_max)
+    {
+	flags = start_write(conn);
+	if (!finish_write(rc, conn->set_blocked(false), flags, true)) return -1;
+	while (rc->batch_sent - rc->batch_replies > rc->batch_max)
+	{
+	    if (!collect_reply(rc, true)) return -1;
+	}
+    }
+    return rc->batch_sent - 1;
+}
+
+int rms_flush(RMSHANDLE h, int *failed)
+{
+    if (!h) return -1;
+
+    rms_conn *rc = (rms_conn *)h;
+    dap_connection *conn = (dap_connection *)rc->conn;
+    int ret = 0;
+
+    if (failed) *failed = -1;
+    int flags = start_write(conn);
+    if (!finish_write(rc, conn->set_blocked(false), flags, true))
+	ret = -1;
+
+    while (ret == 0 && rc->batch_replies < rc->batch_sent)
+    {
+	if (!collect_reply(rc, true)) ret = -1;
+    }
+
+    if (ret == 0)
+    {
+	if (rc->batch_failed != -1)
+	{
+	    if (failed) *failed = rc->batch_failed;
+	    rc->lasterr   = rc->batch_code;
+	    rc->lasterror = rc->batch_error;
+	    ret = -1;
+	}
+    }
+    else
+    {
+	// Lost the link: we don't know what happened to the rest of them
+	// but if one failed before that then that is probably why.
+	if (rc->batch_failed != -1)
+	{
+	    rc->lasterr   = rc->batch_code;
+	    rc->lasterror = rc->batch_error;
+	}
+	if (failed)
+	    *failed = (rc->batch_failed != -1) ? rc->batch_failed : rc->batch_replies;
+	rc->in_step = false;
+    }
+
+    rc->batch_sent    = 0;
+    rc->batch_replies = 0;
+    rc->batch_failed  = -1;
+    return ret;
+}
+
+int rms_write_batch(RMSHANDLE h, int max_outstanding)
+{
+    if (!h) return -1;
+
+    rms_conn *rc = (rms_conn *)h;
+    int ret = 0;
+
+    if (rc->batch_sent) ret = rms_flush(h, NULL);
+    rc->batch_max = max_outstanding > 0 ? max_outstanding : 0;
+    return ret;
+}
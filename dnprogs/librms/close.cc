@@ -36,6 +36,9 @@ int rms_close(RMSHANDLE h)
 
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
+    int flushed = 0;
+
+    if (rc->batch_sent) flushed = rms_flush(h, NULL);
 
     dap_accomp_message ac;
     ac.set_cmpfunc(dap_accomp_message::CLOSE);
@@ -44,11 +47,26 @@ int rms_close(RMSHANDLE h)
     dap_message *m;
     int r = rms_getreply(h, 1, NULL, &m);
 
+    // If a read-ahead was still going then the rest of the file (and
+    // its EOF) may come before the reply to the CLOSE.
+    while (rc->streaming && (r == -2 || r == 047))
+    {
+	if (r == -2) delete m;
+	r = rms_getreply(h, 1, NULL, &m);
+    }
+
+    // This points into the connection's buffers
+    if (rc->record) delete rc->record;
+    free(rc->ring);
+    free_templates(rc);
+
     conn->close();
     
     delete conn;
     delete rc;
 
+    // Records that didn't get written are worth knowing about
+    if (flushed < 0) return -1;
     return r;
 }
 
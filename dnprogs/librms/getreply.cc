@@ -94,6 +94,7 @@ int rms_getreply(RMSHANDLE h, int wait, struct FAB *fab, dap_message **msg)
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
     *msg = NULL;
+    rc->in_step = false;
 
     if (!wait)
     {
@@ -87,8 +87,9 @@ struct va_list_passer
     va_list ap;
 };
 
-static bool get_item(char *options, unsigned int &option_ptr,
-		     char *key, char *value, struct va_list_passer &vlp)
+// Get the next key and value, exactly as they are in the string
+static bool scan_item(char *options, unsigned int &option_ptr,
+		      char *key, char *value)
 {
     // We've reached the end.
     if (option_ptr+4 >= strlen(options)) return false;
@@ -151,51 +152,273 @@ static bool get_item(char *options, unsigned int &option_ptr,
     // Terminate the string
     value[value_ptr] = '\0';
 
+    // If there's a comma then skip past it
+    SPAN_BLANKS(options, option_ptr);
+    if (options[option_ptr] == ',')
+	option_ptr++;
+    SPAN_BLANKS(options, option_ptr);
+
+    return true;
+}
+
+// Is the value one of the % options that take items from the variable
+// argument list? Returns the conversion character (which may not be one
+// we know) or 0.
+static char arg_type(const char *value, bool *len_arg)
+{
+    int ptr = 1;
+
+    *len_arg = false;
+    if (value[0] != '%') return 0;
+    if (value[1] == '*')
+    {
+	*len_arg = true;
+	ptr++;
+    }
+    if (!value[ptr] && !*len_arg) return 0;
+    return value[ptr] ? value[ptr] : '*';
+}
+
+// Replace a % option with its item from the variable argument list
+static void get_arg(char type, bool len_arg, char *value,
+		    struct va_list_passer &vlp)
+{
+    int len = 0;
+    int intval;
+    char *charval;
+
+    if (len_arg) // Length is also an argument
+	len = va_arg(vlp.ap, int);
+
+    switch (type)
+    {
+    case 'd':
+	// Rather depressingly we have to convert this to a string before
+	// converting it back to a number :-(
+	intval = va_arg(vlp.ap, int);
+	sprintf(value, "%d", intval);
+	break;
+
+    case 's':
+	charval = va_arg(vlp.ap, char *);
+	if (len)
+	{
+	    memcpy(value, charval, len);
+	}
+	else
+	{
+	    strcpy(value, charval);
+	}
+	break;
+    }
+}
+
+static bool get_item(char *options, unsigned int &option_ptr,
+		     char *key, char *value, struct va_list_passer &vlp)
+{
+    if (!scan_item(options, option_ptr, key, value)) return false;
+
 
     // Check for % options which indicate items in the variable argument list
-    if (value[0] == '%')
+    bool len_arg;
+    char type = arg_type(value, &len_arg);
+    if (type) get_arg(type, len_arg, value, vlp);
+
+    return true;
+}
+
+// Compiled option strings.
+//
+// A template is the RAB and FAB that the literal values in an options
+// string make, plus a list of the items that can't be done until we get
+// the variable arguments. Keys go in that list too because they are kept
+// in the handle. Filling in a RAB from a template is then just a copy and
+// whatever % items there are (and anything after them).
+//
+// Each handle keeps the templates for the last few option strings it was
+// given, found by the address of the string, so that rms_t_read() etc in
+// a loop don't parse the same string every time.
+
+struct deferred_item
+{
+    int   entry;        // In field_types
+    char  type;         // % conversion, or 0 for a literal value
+    bool  len_arg;      // %*
+    char  value[256];   // As it was in the string
+};
+
+struct rms_template
+{
+    char      *options; // Copy of the string it was made from
+    struct FAB fab;
+    struct RAB rab;
+    int        num_deferred;
+    struct deferred_item *deferred;
+};
+
+static int find_field(const char *key)
+{
+    for (int i=0; field_types[i].key; i++)
     {
-	int len = 0;
-	int ptr = 1;
-	int intval;
-	char *charval;
+	if (strcasecmp(key, field_types[i].key) == 0)
+	    return i;
+    }
+    return -1;
+}
 
-	if (value[1] == '*') // Length is also an argument
+// Returns NULL if there is a key we don't know, or no memory.
+static struct rms_template *compile_template(char *options, bool report)
+{
+    unsigned int option_ptr = 0;
+    char key[4];
+    char value[256];
+    int  num_items = 0;
+    int  deferred_size = 0;
+    struct rms_template *t;
+
+    // Check all the keys first so that errors only get reported once
+    while (scan_item(options, option_ptr, key, value))
+    {
+	if (find_field(key) == -1)
 	{
-	    ptr++;
-	    len = va_arg(vlp.ap, int);
+	    if (report) fprintf(stderr,"Unrecognised key name: %s\n", options);
+	    return NULL;
 	}
-	switch (value[ptr])
+	num_items++;
+    }
+
+    t = (struct rms_template *)calloc(1, sizeof(struct rms_template));
+    if (!t) return NULL;
+    t->options = strdup(options);
+    if (!t->options)
+    {
+	free(t);
+	return NULL;
+    }
+
+    option_ptr = 0;
+    for (int i=0; i<num_items; i++)
+    {
+	scan_item(options, option_ptr, key, value);
+
+	int  entry = find_field(key);
+	bool len_arg;
+	char type = arg_type(value, &len_arg);
+
+	// Once one item has to wait, the rest must too so that they are
+	// still done in the order they were given
+	if (type || field_types[entry].proc == set_key || t->num_deferred)
 	{
-	case 'd':
-	    // Rather depressingly we have to convert this to a string before 
-	    // converting it back to a number :-(
-	    intval = va_arg(vlp.ap, int);
-	    sprintf(value, "%d", intval);
-	    break;
+	    struct deferred_item *d;
 
-	case 's':
-	    charval = va_arg(vlp.ap, char *);
-	    if (len)
+	    if (t->num_deferred == deferred_size)
 	    {
-		memcpy(value, charval, len);
+		deferred_size = deferred_size ? deferred_size*2 : 4;
+		d = (struct deferred_item *)realloc(t->deferred,
+				 deferred_size * sizeof(struct deferred_item));
+		if (!d)
+		{
+		    rms_t_free(t);
+		    return NULL;
+		}
+		t->deferred = d;
 	    }
-	    else
-	    {
-		strcpy(value, charval);
-	    }
-	    break;
+	    d = &t->deferred[t->num_deferred++];
+	    d->entry   = entry;
+	    d->type    = type;
+	    d->len_arg = len_arg;
+	    strcpy(d->value, value);
+	}
+	else
+	{
+	    field_types[entry].proc(NULL, entry, value, &t->rab, &t->fab);
 	}
     }
+    return t;
+}
 
+static void fill_template(RMSHANDLE h, struct rms_template *t,
+			  struct FAB *fab, struct RAB *rab, va_list ap)
+{
+    struct va_list_passer vlp;
 
-    // If there's a comma then skip past it
-    SPAN_BLANKS(options, option_ptr);
-    if (options[option_ptr] == ',')
-	option_ptr++;
-    SPAN_BLANKS(options, option_ptr);
+    *fab = t->fab;
+    *rab = t->rab;
+    if (!t->num_deferred) return;
 
-    return true;
+#ifdef __va_copy
+    __va_copy(vlp.ap, ap);
+#else
+    vlp.ap = ap;
+#endif
+
+    for (int i=0; i<t->num_deferred; i++)
+    {
+	struct deferred_item *d = &t->deferred[i];
+	char value[256];
+
+	strcpy(value, d->value);
+	if (d->type) get_arg(d->type, d->len_arg, value, vlp);
+	field_types[d->entry].proc(h, d->entry, value, rab, fab);
+    }
+}
+
+static struct rms_template *cached_template(rms_conn *rc, char *options)
+{
+    int slot = ((unsigned long)options >> 3) % TCACHE_SIZE;
+    struct rms_template *t = rc->tcache[slot];
+
+    // The same address doesn't have to mean the same string
+    if (t && rc->tcache_key[slot] == options && strcmp(t->options, options) == 0)
+	return t;
+
+    t = compile_template(options, false);
+    if (!t) return NULL;
+
+    if (rc->tcache[slot]) rms_t_free(rc->tcache[slot]);
+    rc->tcache[slot]     = t;
+    rc->tcache_key[slot] = options;
+    return t;
+}
+
+void free_templates(rms_conn *rc)
+{
+    for (int i=0; i<TCACHE_SIZE; i++)
+    {
+	if (rc->tcache[i]) rms_t_free(rc->tcache[i]);
+	rc->tcache[i] = NULL;
+    }
+}
+
+RMSTEMPLATE rms_t_compile(char *options)
+{
+    if (!options) options = (char *)"";
+    return (RMSTEMPLATE)compile_template(options, true);
+}
+
+int rms_t_fill(RMSHANDLE h, RMSTEMPLATE t, struct FAB *fab, struct RAB *rab, ...)
+{
+    struct FAB localfab;
+    struct RAB localrab;
+    va_list ap;
+
+    if (!h || !t) return -1;
+
+    va_start(ap, rab);
+    fill_template(h, (struct rms_template *)t, fab ? fab : &localfab,
+		  rab ? rab : &localrab, ap);
+    va_end(ap);
+    return 0;
+}
+
+void rms_t_free(RMSTEMPLATE t)
+{
+    struct rms_template *tp = (struct rms_template *)t;
+
+    if (!tp) return;
+    free(tp->options);
+    free(tp->deferred);
+    free(tp);
 }
 
 // Parse string options into a RAB and a FAB.
@@ -216,6 +439,18 @@ bool parse_options(RMSHANDLE h, char *options, struct FAB *fab,
     // a NULL option string is legal
     if (!options) return true;
 
+    // With a handle we can use the compiled version of the string. If
+    // it won't compile then the old way will say why.
+    if (h)
+    {
+	struct rms_template *t = cached_template((rms_conn *)h, options);
+	if (t)
+	{
+	    fill_template(h, t, fab, rab, ap);
+	    return true;
+	}
+    }
+
 // Oh dear, oh dear, oh dear.
 #ifdef __va_copy
     __va_copy(vlp.ap, ap);
@@ -0,0 +1,282 @@
+/*
+    readahead.cc from librms
+
+    Copyright (C) 2026 The dnprogs contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Read-ahead for sequential rms_read()s.
+//
+// A sequential read with RAB$M_RAH set asks FAL for the rest of the file
+// in file transfer mode (one CONTROL GET with RAC=SEQFT) rather than one
+// GET per record. FAL then sends DATA messages until it gets to the end
+// of the file, and the link's own flow control holds it back when we
+// stop reading. Records are kept in a ring buffer here and rms_read()
+// hands them out one at a time, taking anything else that has arrived
+// off the link each time so the remote end always has room to send.
+//
+// Anything other than a sequential read has to be done record by record
+// so rms_stream_stop() reads (and throws away) the rest of the stream and
+// if necessary puts the remote file back at the record the caller thinks
+// it is at.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <netdnet/dn.h>
+#include <netdnet/dnetdb.h>
+#include "connection.h"
+#include "protocol.h"
+#include "rms.h"
+#include "rmsp.h"
+
+// Big enough for several of the largest records DAP can send
+#define RING_SIZE   (256*1024)
+#define MAX_RECORD  65535
+
+// Each record in the ring is an int length then the data, either of
+// which may wrap around the end.
+static void ring_copy_in(rms_conn *rc, const char *data, int len)
+{
+    int first = RING_SIZE - rc->ring_tail;
+
+    if (first > len) first = len;
+    memcpy(rc->ring + rc->ring_tail, data, first);
+    memcpy(rc->ring, data + first, len - first);
+    rc->ring_tail = (rc->ring_tail + len) % RING_SIZE;
+    rc->ring_used += len;
+}
+
+static void ring_copy_out(rms_conn *rc, char *data, int len)
+{
+    int first = RING_SIZE - rc->ring_head;
+
+    if (first > len) first = len;
+    memcpy(data, rc->ring + rc->ring_head, first);
+    memcpy(data + first, rc->ring, len - first);
+    rc->ring_head = (rc->ring_head + len) % RING_SIZE;
+    rc->ring_used -= len;
+}
+
+// Length of the next record, without removing it
+static int ring_peek_len(rms_conn *rc)
+{
+    int len;
+    int head = rc->ring_head;
+
+    ring_copy_out(rc, (char *)&len, sizeof(len));
+    rc->ring_head = head;
+    rc->ring_used += sizeof(len);
+    return len;
+}
+
+static void ring_clear(rms_conn *rc)
+{
+    rc->ring_head = rc->ring_tail = rc->ring_used = 0;
+    rc->ring_records = 0;
+}
+
+// Move whatever has arrived into the ring. If 'wait' is set, wait for at
+// least one message. Returns false if the link failed.
+static bool fill_ring(rms_conn *rc, bool wait)
+{
+    dap_connection *conn = (dap_connection *)rc->conn;
+
+    while (!rc->stream_eof && !rc->stream_error &&
+	   RING_SIZE - rc->ring_used >= MAX_RECORD + (int)sizeof(int))
+    {
+	dap_message *m = dap_message::read_message(*conn, wait);
+	if (!m)
+	{
+	    if (!wait) return true;
+	    rc->lasterror = conn->get_error();
+	    return false;
+	}
+
+	// The reply to whatever was done before the stream started may
+	// still be waiting in front of it, so ACKs and success STATUSes
+	// don't count as something to wait for.
+	if (m->get_type() == dap_message::ACK)
+	{
+	    delete m;
+	    continue;
+	}
+
+	if (m->get_type() == dap_message::DATA)
+	{
+	    dap_data_message *dm = (dap_data_message *)m;
+	    int len = dm->get_datalen();
+
+	    ring_copy_in(rc, (char *)&len, sizeof(len));
+	    ring_copy_in(rc, dm->get_dataptr(), len);
+	    rc->ring_records++;
+	    delete m;
+	    wait = false;
+	    continue;
+	}
+
+	// EOF or an error. Either way that's the end of the stream, but an
+	// error only gets reported after the records that came before it.
+	if (m->get_type() == dap_message::STATUS)
+	{
+	    int status = check_status(rc, m);
+	    if (status == 0)
+		continue;
+	    if (status == 047)
+	    {
+		rc->stream_eof = true;
+	    }
+	    else
+	    {
+		rc->stream_error = rc->lasterror;
+		if (!rc->stream_error) rc->stream_error = (char *)"Stream failed";
+	    }
+	    continue;
+	}
+
+	static char err[1024];
+	sprintf(err, "got unexpected DAP message: %s\n", m->type_name());
+	rc->stream_error = err;
+	delete m;
+    }
+    return true;
+}
+
+// Sequential read with read-ahead. Starts the stream if needed.
+int rms_stream_read(rms_conn *rc, char *buf, int maxlen, struct RAB *rab)
+{
+    dap_connection *conn = (dap_connection *)rc->conn;
+
+    if (!rc->streaming)
+    {
+	dap_control_message ctl;
+	ctl.set_ctlfunc(dap_control_message::GET);
+	ctl.set_rac(dap_control_message::SEQFT);
+	if (rab && rab->rab$l_rop) ctl.set_rop(rab->rab$l_rop);
+	if (rab && rab->rab$w_usz) ctl.set_usz(rab->rab$w_usz);
+
+	if (!rc->ring)
+	{
+	    rc->ring = (char *)malloc(RING_SIZE);
+	    if (!rc->ring)
+	    {
+		rc->lasterror = (char *)"Out of memory";
+		return -1;
+	    }
+	}
+	ring_clear(rc);
+
+	if (!ctl.write(*conn))
+	{
+	    rc->lasterror = conn->get_error();
+	    return -1;
+	}
+	rc->streaming    = true;
+	rc->stream_eof   = false;
+	rc->stream_error = NULL;
+    }
+
+    if (!rc->ring_records)
+    {
+	if (!fill_ring(rc, true))
+	{
+	    rc->streaming = false;
+	    return -1;
+	}
+    }
+
+    if (rc->ring_records)
+    {
+	int len = ring_peek_len(rc);
+
+	// Leave it there until they give us enough room
+	if (len > maxlen)
+	    return -len;
+
+	ring_copy_out(rc, (char *)&len, sizeof(len));
+	ring_copy_out(rc, buf, len);
+	rc->ring_records--;
+	rc->position++;
+
+	// Make room at the other end
+	if (!fill_ring(rc, false))
+	    rc->stream_error = rc->lasterror;
+	return len;
+    }
+
+    // Nothing left, so that's the end of the stream one way or another
+    rc->streaming = false;
+    if (rc->stream_error)
+    {
+	rc->lasterror = rc->stream_error;
+	return -1;
+    }
+    rc->lasterror = (char *)"EOF";
+    return 0;
+}
+
+// Finish with the stream so that the next operation can be done record
+// by record. If 'reposition' is set, make the remote file's current
+// record the last one the caller read.
+bool rms_stream_stop(rms_conn *rc, bool reposition)
+{
+    bool all_read = (rc->ring_records == 0);
+    long position = rc->position;
+
+    // Everything FAL has left to send has to come off the link
+    while (!rc->stream_eof && !rc->stream_error)
+    {
+	ring_clear(rc);
+	if (!fill_ring(rc, true))
+	{
+	    rc->streaming = false;
+	    ring_clear(rc);
+	    return false;
+	}
+	if (rc->ring_records) all_read = false;
+    }
+    rc->streaming = false;
+    ring_clear(rc);
+
+    if (rc->stream_error)
+    {
+	rc->lasterror = rc->stream_error;
+	return false;
+    }
+
+    // If they read everything then FAL is already where they think it is
+    if (!reposition || all_read)
+	return true;
+
+    if (rms_rewind(rc, NULL) < 0)
+	return false;
+    while (rc->position < position)
+    {
+	long before = rc->position;
+
+	if (rms_find(rc, NULL) < 0)
+	    return false;
+	if (rc->position == before)
+	{
+	    rc->lasterror = (char *)"File is shorter than when it was read";
+	    return false;
+	}
+    }
+    return true;
+}
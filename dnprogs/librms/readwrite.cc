@@ -53,6 +53,29 @@ static void build_control_message(rms_conn *rc, dap_control_message *ctl, struct
 		ctl->set_usz(rab->rab$w_usz);
 }
 
+// Next record rather than a particular one
+static bool is_sequential(struct RAB *rab)
+{
+	return !rab || (rab->rab$b_rac == RAB$C_SEQ && !rab->rab$l_kbf);
+}
+
+// Get out of read-ahead before doing anything else. Operations that work
+// on the current record need FAL to agree with us about which that is.
+static bool stop_streaming(rms_conn *rc, bool reposition)
+{
+	if (rc->streaming)
+		return rms_stream_stop(rc, reposition);
+	return true;
+}
+
+// Anything that isn't batched has to wait for the batch to finish
+static bool end_batch(rms_conn *rc)
+{
+	if (rc->batch_sent)
+		return rms_flush((RMSHANDLE)rc, NULL) == 0;
+	return true;
+}
+
 int rms_read(RMSHANDLE h, char *buf, int maxlen, struct RAB *rab)
 {
     if (!h) return -1;
@@ -61,13 +84,14 @@ int rms_read(RMSHANDLE h, char *buf, int maxlen, struct RAB *rab)
     dap_connection *conn = (dap_connection *)rc->conn;
 
     rc->lasterror = NULL;
+    if (!end_batch(rc)) return -1;
 
 // If there is an outstanding record then return that if we can
     if (rc->record)
     {
 	if (maxlen >= rc->dlen)
 	{
-	    memcpy(buf, rc->record, rc->dlen);
+	    memcpy(buf, rc->record->get_dataptr(), rc->dlen);
 	    delete rc->record;
 	    rc->record = NULL;
 	    return rc->dlen;
@@ -77,6 +101,18 @@ int rms_read(RMSHANDLE h, char *buf, int maxlen, struct RAB *rab)
 	return -rc->dlen;
     }
 
+    if (is_sequential(rab))
+    {
+	if (rc->streaming ||
+	    (rab && (rab->rab$l_rop & RAB$M_RAH) && rc->pos_known))
+	    return rms_stream_read(rc, buf, maxlen, rab);
+    }
+    else
+    {
+	if (!stop_streaming(rc, false)) return -1;
+	rc->pos_known = false;
+    }
+
     // Send GET - these are the defaults if no RAB
     dap_control_message ctl;
     ctl.set_ctlfunc(dap_control_message::GET);
@@ -109,17 +145,17 @@ int rms_read(RMSHANDLE h, char *buf, int maxlen, struct RAB *rab)
 	dlen = dm->get_datalen();
 	if (dlen > maxlen)
 	{
-	    // Take a temporary copy and return the actual length
-	    rc->record = new char[dlen];
+	    // Hang onto it (in the receive buffer) and return the actual length
+	    dm->hold_data();
+	    rc->record = dm;
 	    rc->dlen = dlen;
 	    rc->lasterror = NULL;
-	    dm->get_data(rc->record, &dlen);
-
-	    delete m;
+	    rc->position++;
 	    return -dlen;
 	}
 	dm->get_data(buf, &dlen);
 	delete m;
+	rc->position++;
 	return dlen;
     }
 
@@ -162,6 +198,10 @@ int rms_find(RMSHANDLE h, struct RAB *rab)
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
 
+    if (!end_batch(rc)) return -1;
+    if (!stop_streaming(rc, is_sequential(rab))) return -1;
+    if (!is_sequential(rab)) rc->pos_known = false;
+
     dap_control_message ctl;
     ctl.set_ctlfunc(dap_control_message::FIND);
 
@@ -179,6 +219,7 @@ int rms_find(RMSHANDLE h, struct RAB *rab)
     if (r < 0) return -1;
     if (r == 047) return 0; // EOF
 
+    rc->position++;
     return 0;
 }
 
@@ -189,10 +230,14 @@ int rms_write(RMSHANDLE h, char *buf, int len, struct RAB *rab)
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
 
+    if (!stop_streaming(rc, is_sequential(rab))) return -1;
+    rc->pos_known = false;
+
     dap_control_message ctl;
     ctl.set_ctlfunc(dap_control_message::PUT);
 
     if (rab) build_control_message(rc, &ctl, rab);
+    if (rc->batch_max) return rms_batch_send(rc, &ctl, buf, len);
 
     if (!ctl.write(*conn))
     {
@@ -229,10 +274,13 @@ int rms_update(RMSHANDLE h, char *buf, int len, struct RAB *rab)
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
 
+    if (!stop_streaming(rc, true)) return -1;
+
     dap_control_message ctl;
     ctl.set_ctlfunc(dap_control_message::UPDATE);
 
     if (rab) build_control_message(rc, &ctl, rab);
+    if (rc->batch_max) return rms_batch_send(rc, &ctl, buf, len);
 
     if (!ctl.write(*conn))
     {
@@ -268,10 +316,14 @@ int rms_delete(RMSHANDLE h, struct RAB *rab)
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
 
+    if (!stop_streaming(rc, true)) return -1;
+    rc->pos_known = false;
+
     dap_control_message ctl;
     ctl.set_ctlfunc(dap_control_message::DELETE);
 
     if (rab) build_control_message(rc, &ctl, rab);
+    if (rc->batch_max) return rms_batch_send(rc, &ctl, NULL, 0);
 
     if (!ctl.write(*conn))
     {
@@ -294,6 +346,9 @@ int rms_truncate(RMSHANDLE h, struct RAB *rab)
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
 
+    if (!end_batch(rc)) return -1;
+    if (!stop_streaming(rc, true)) return -1;
+
     dap_control_message ctl;
     ctl.set_ctlfunc(dap_control_message::TRUNCATE);
 
@@ -320,6 +375,9 @@ int rms_rewind(RMSHANDLE h, struct RAB *rab)
     rms_conn *rc = (rms_conn *)h;
     dap_connection *conn = (dap_connection *)rc->conn;
 
+    if (!end_batch(rc)) return -1;
+    if (!stop_streaming(rc, false)) return -1;
+
     dap_control_message ctl;
     ctl.set_ctlfunc(dap_control_message::REWIND);
 
@@ -336,6 +394,8 @@ int rms_rewind(RMSHANDLE h, struct RAB *rab)
     if (r == -2) delete m;
     if (r < 0) return -1;
 
+    rc->pos_known = true;
+    rc->position = 0;
     return 0;
 }
 
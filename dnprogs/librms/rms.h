@@ -23,6 +23,7 @@
 #include "rabdef.h"
 
 typedef void * RMSHANDLE;
+typedef void * RMSTEMPLATE;
 
 
 #ifdef __cplusplus
@@ -38,6 +39,8 @@ int   rms_find(RMSHANDLE h, struct RAB *);
 int   rms_delete(RMSHANDLE h, struct RAB *);
 int   rms_rewind(RMSHANDLE h, struct RAB *);
 int   rms_truncate(RMSHANDLE h, struct RAB *);
+int   rms_write_batch(RMSHANDLE h, int max_outstanding);
+int   rms_flush(RMSHANDLE h, int *failed);
 char *rms_lasterror(RMSHANDLE h);
 int   rms_lasterrorcode(RMSHANDLE h);
 char *rms_openerror(void);
@@ -52,6 +55,10 @@ int   rms_t_delete(RMSHANDLE h, char *options, ...);
 int   rms_t_rewind(RMSHANDLE h, char *options, ...);
 int   rms_t_truncate(RMSHANDLE h, char *options, ...);
 
+RMSTEMPLATE rms_t_compile(char *options);
+int   rms_t_fill(RMSHANDLE h, RMSTEMPLATE t, struct FAB *fab, struct RAB *rab, ...);
+void  rms_t_free(RMSTEMPLATE t);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,22 +23,67 @@
 // IT WILL BREAK when I release future versions of librms.
 // You have been warned!
 
+struct rms_template;
+#define TCACHE_SIZE 8
+
 class rms_conn
 {
  public:
     dap_connection *conn;
     int lasterr;           // DAP code of last error
     char *lasterror;       // Text of last error
-    char *record;          // Temp storage for records that are too long
+    dap_data_message *record; // Held record that was too long for the caller
     int  dlen;             // Size of message
     char key[256];
 
+    // Read-ahead, see readahead.cc
+    bool  streaming;       // In file transfer mode
+    bool  stream_eof;      // FAL has sent all of the file
+    char *stream_error;    // ...or it failed, after the records in the ring
+    char *ring;            // Records received but not yet read
+    int   ring_head;
+    int   ring_tail;
+    int   ring_used;       // Bytes
+    int   ring_records;
+    bool  pos_known;       // Only sequential access since open or rewind,
+    long  position;        // so this is how many records have been passed
+
+    // Batched writes, see batch.cc
+    bool  in_step;         // No replies to earlier calls left on the link
+    int   batch_max;       // Most replies outstanding, 0 if not batching
+    int   batch_sent;      // Operations since the last rms_flush()
+    int   batch_replies;   // STATUSes we've had for them
+    int   batch_failed;    // Index of the first that failed, or -1
+    int   batch_code;      // ...and its error
+    char *batch_error;
+
+    // Compiled option strings, see parse.cc
+    char *tcache_key[TCACHE_SIZE];
+    struct rms_template *tcache[TCACHE_SIZE];
+
     rms_conn(dap_connection *c)
 	{
 	    conn = c;
 	    lasterr = 0;
 	    lasterror = NULL;
 	    record = NULL;
+	    streaming = false;
+	    stream_eof = false;
+	    stream_error = NULL;
+	    ring = NULL;
+	    ring_head = ring_tail = ring_used = ring_records = 0;
+	    pos_known = true;
+	    position = 0;
+	    in_step = false;
+	    batch_max = batch_sent = batch_replies = 0;
+	    batch_failed = -1;
+	    batch_code = 0;
+	    batch_error = NULL;
+	    for (int i=0; i<TCACHE_SIZE; i++)
+	    {
+		tcache_key[i] = NULL;
+		tcache[i] = NULL;
+	    }
 	}
 
 };
@@ -46,4 +91,8 @@ class rms_conn
 int   rms_getreply(RMSHANDLE h, int wait, struct FAB *fab, dap_message **msg);
 int   check_status(rms_conn *c, dap_message *m);
 bool  parse_options(RMSHANDLE h, char *options, struct FAB *fab, struct RAB *rab, va_list ap);
+void  free_templates(rms_conn *rc);
+int   rms_stream_read(rms_conn *rc, char *buf, int maxlen, struct RAB *rab);
+bool  rms_stream_stop(rms_conn *rc, bool reposition);
+int   rms_batch_send(rms_conn *rc, dap_control_message *ctl, char *buf, int len);
 